@@ -269,6 +269,20 @@ namespace dlib
         return point_transform_affine(lhs.get_m()*rhs.get_m(), lhs.get_m()*rhs.get_b()+lhs.get_b());
     }
 
+// ----------------------------------------------------------------------------------------
+
+    inline point_transform_affine inv (
+        const point_transform_affine& trans
+    )
+    {
+        const matrix<double,2,2>& m = trans.get_m();
+        const double det = m(0,0)*m(1,1) - m(0,1)*m(1,0);
+        matrix<double,2,2> im;
+        im = m(1,1)/det, -m(0,1)/det,
+            -m(1,0)/det,  m(0,0)/det;
+        return point_transform_affine(im, -im*trans.get_b());
+    }
+
 // ----------------------------------------------------------------------------------------
 
     class point_transform_projective
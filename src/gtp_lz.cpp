@@ -13,6 +13,7 @@
 #include <random>
 #include <string>
 #include <vector>
+#include "lz/NNCache.h"
 #include "lz/Utils.h"
 #include "lz/Zobrist.h"
 #include "lz/SGFTree.h"
@@ -661,6 +662,17 @@ void GtpLZ::run() {
             }
             gtp_print("");
 
+        }  else if (command.find("cachebench") == 0) {
+            std::istringstream cmdstream(command);
+            std::string tmp;
+            int threads;
+
+            cmdstream >> tmp;  // eat cachebench
+            cmdstream >> threads;
+
+            NNCache::benchmark(!cmdstream.fail() ? threads : 32);
+            gtp_print("");
+
         }  else if (command.find("kgs-time_settings") == 0) {
             // none, absolute, byoyomi, or canadian
             std::istringstream cmdstream(command);
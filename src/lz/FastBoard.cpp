@@ -74,6 +74,30 @@ std::pair<int, int> FastBoard::get_xy(int vertex) const {
     return std::make_pair(x, y);
 }
 
+std::pair<int, int> FastBoard::get_symmetry(const std::pair<int, int> xy,
+                                            int symmetry,
+                                            const int boardsize) {
+    assert(symmetry >= 0 && symmetry < 8);
+    auto x = xy.first;
+    auto y = xy.second;
+
+    if (symmetry >= 4) {
+        std::swap(x, y);
+        symmetry -= 4;
+    }
+
+    if (symmetry == 1) {
+        y = boardsize - y - 1;
+    } else if (symmetry == 2) {
+        x = boardsize - x - 1;
+    } else if (symmetry == 3) {
+        x = boardsize - x - 1;
+        y = boardsize - y - 1;
+    }
+
+    return std::make_pair(x, y);
+}
+
 FastBoard::square_t FastBoard::get_square(int vertex) const {
     assert(vertex >= 0 && vertex < MAXSQ);
     assert(vertex >= 0 && vertex < m_maxsq);
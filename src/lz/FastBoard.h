@@ -77,6 +77,11 @@ public:
     void set_square(int vertex, square_t content);
     std::pair<int, int> get_xy(int vertex) const;
 
+    // Coordinates of x, y under one of the 8 board symmetries.
+    static std::pair<int, int> get_symmetry(const std::pair<int, int> xy,
+                                            int symmetry,
+                                            const int boardsize);
+
     bool is_suicide(int i, int color) const;
     int count_pliberties(const int i) const;
     bool is_eye(const int color, const int vtx) const;
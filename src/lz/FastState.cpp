@@ -74,14 +74,14 @@ void FastState::play_move(int vertex) {
 }
 
 void FastState::play_move(int color, int vertex) {
-    board.m_hash ^= Zobrist::zobrist_ko[m_komove];
+    board.update_ko_hash(m_komove);
     if (vertex == FastBoard::PASS) {
         // No Ko move
         m_komove = 0;
     } else {
         m_komove = board.update_board(color, vertex);
     }
-    board.m_hash ^= Zobrist::zobrist_ko[m_komove];
+    board.update_ko_hash(m_komove);
 
     m_lastmove = vertex;
     m_movenum++;
@@ -22,19 +22,86 @@
 #include <cassert>
 
 #include "FullBoard.h"
+#include "GTP.h"
 #include "Utils.h"
 #include "Zobrist.h"
 
 using namespace Utils;
 
+// Vertex of every square under the 8 symmetries, for each board size.
+// Off-board squares map to themselves.
+using SymmetryTable = std::array<std::array<int, FastBoard::MAXSQ>, 8>;
+
+static const SymmetryTable& symmetry_table(const int boardsize) {
+    static const auto tables = [] {
+        auto tables = std::array<SymmetryTable, BOARD_SIZE + 1>{};
+        for (auto size = 1; size <= BOARD_SIZE; size++) {
+            const auto squaresize = size + 2;
+            for (auto s = 0; s < 8; s++) {
+                auto& table = tables[size][s];
+                for (auto i = 0; i < FastBoard::MAXSQ; i++) {
+                    table[i] = i;
+                }
+                for (auto y = 0; y < size; y++) {
+                    for (auto x = 0; x < size; x++) {
+                        const auto sym = FastBoard::get_symmetry({x, y}, s,
+                                                                 size);
+                        table[(y + 1) * squaresize + x + 1] =
+                            (sym.second + 1) * squaresize + sym.first + 1;
+                    }
+                }
+            }
+        }
+        return tables;
+    }();
+    return tables[boardsize];
+}
+
+void FullBoard::update_square_hash(const int pos) {
+    const auto& zobrist = Zobrist::zobrist[m_square[pos]];
+    m_hash    ^= zobrist[pos];
+    m_ko_hash ^= zobrist[pos];
+
+    if (cfg_cache_symmetry) {
+        const auto& table = symmetry_table(m_boardsize);
+        for (auto s = 0; s < 8; s++) {
+            m_sym_hash[s] ^= zobrist[table[s][pos]];
+        }
+    }
+}
+
+void FullBoard::update_ko_hash(const int komove) {
+    m_hash ^= Zobrist::zobrist_ko[komove];
+
+    if (cfg_cache_symmetry) {
+        const auto& table = symmetry_table(m_boardsize);
+        for (auto s = 0; s < 8; s++) {
+            m_sym_hash[s] ^= Zobrist::zobrist_ko[table[s][komove]];
+        }
+    }
+}
+
+std::uint64_t FullBoard::get_symmetry_hash(const int symmetry) const {
+    return m_hash ^ m_sym_hash[0] ^ m_sym_hash[symmetry];
+}
+
+int FullBoard::get_canonical_symmetry(void) const {
+    auto best = 0;
+    for (auto s = 1; s < 8; s++) {
+        if (m_sym_hash[s] < m_sym_hash[best]) {
+            best = s;
+        }
+    }
+    return best;
+}
+
 int FullBoard::remove_string(int i) {
     int pos = i;
     int removed = 0;
     int color = m_square[i];
 
     do {
-        m_hash    ^= Zobrist::zobrist[m_square[pos]][pos];
-        m_ko_hash ^= Zobrist::zobrist[m_square[pos]][pos];
+        update_square_hash(pos);
 
         m_square[pos] = EMPTY;
         m_parent[pos] = MAXSQ;
@@ -45,8 +112,7 @@ int FullBoard::remove_string(int i) {
         m_empty[m_empty_cnt]  = pos;
         m_empty_cnt++;
 
-        m_hash    ^= Zobrist::zobrist[m_square[pos]][pos];
-        m_ko_hash ^= Zobrist::zobrist[m_square[pos]][pos];
+        update_square_hash(pos);
 
         removed++;
         pos = m_next[pos];
@@ -72,9 +138,22 @@ std::uint64_t FullBoard::calc_ko_hash(void) {
 std::uint64_t FullBoard::calc_hash(int komove) {
     auto res = Zobrist::zobrist_empty;
 
+    const auto& table = symmetry_table(m_boardsize);
+    m_sym_hash.fill(0);
     for (int i = 0; i < m_maxsq; i++) {
         if (m_square[i] != INVAL) {
             res ^= Zobrist::zobrist[m_square[i]][i];
+            if (cfg_cache_symmetry) {
+                for (auto s = 0; s < 8; s++) {
+                    m_sym_hash[s] ^=
+                        Zobrist::zobrist[m_square[i]][table[s][i]];
+                }
+            }
+        }
+    }
+    if (cfg_cache_symmetry) {
+        for (auto s = 0; s < 8; s++) {
+            m_sym_hash[s] ^= Zobrist::zobrist_ko[table[s][komove]];
         }
     }
 
@@ -112,8 +191,7 @@ int FullBoard::update_board(const int color, const int i) {
     assert(i != FastBoard::PASS);
     assert(m_square[i] == EMPTY);
 
-    m_hash ^= Zobrist::zobrist[m_square[i]][i];
-    m_ko_hash ^= Zobrist::zobrist[m_square[i]][i];
+    update_square_hash(i);
 
     m_square[i] = square_t(color);
     m_next[i] = i;
@@ -121,8 +199,7 @@ int FullBoard::update_board(const int color, const int i) {
     m_libs[i] = count_pliberties(i);
     m_stones[i] = 1;
 
-    m_hash ^= Zobrist::zobrist[m_square[i]][i];
-    m_ko_hash ^= Zobrist::zobrist[m_square[i]][i];
+    update_square_hash(i);
 
     /* update neighbor liberties (they all lose 1) */
     add_neighbour(i, color);
@@ -20,6 +20,7 @@
 #define FULLBOARD_H_INCLUDED
 
 #include "config.h"
+#include <array>
 #include <cstdint>
 #include "FastBoard.h"
 
@@ -33,12 +34,27 @@ public:
     std::uint64_t get_hash(void) const;
     std::uint64_t get_ko_hash(void) const;
     void set_to_move(int tomove);
+    void update_ko_hash(int komove);
+
+    // Hash of the position mirrored or rotated by one of the 8 board
+    // symmetries, and the symmetry under which the hash is smallest.
+    // The symmetries are only tracked with cfg_cache_symmetry, otherwise
+    // only symmetry 0 is valid.
+    std::uint64_t get_symmetry_hash(int symmetry) const;
+    int get_canonical_symmetry(void) const;
 
     void reset_board(int size);
     void display_board(int lastmove = -1);
 
     std::uint64_t m_hash;
     std::uint64_t m_ko_hash;
+
+private:
+    void update_square_hash(int pos);
+
+    // The stone and ko terms of m_hash under every symmetry, the
+    // remaining terms are the same for all of them.
+    std::array<std::uint64_t, 8> m_sym_hash;
 };
 
 #endif
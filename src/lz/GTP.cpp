@@ -35,6 +35,7 @@
 #include "FastBoard.h"
 #include "FullBoard.h"
 #include "GameState.h"
+#include "NNCache.h"
 #include "Network.h"
 #include "SGFTree.h"
 #include "SMP.h"
@@ -58,6 +59,13 @@ int cfg_noise;
 int cfg_random_cnt;
 std::uint64_t cfg_rng_seed;
 bool cfg_dumbpass;
+int cfg_batch_size;
+int cfg_batch_wait_us;
+int cfg_nn_threads;
+int cfg_winograd_tile;
+bool cfg_int8;
+std::string cfg_int8_calibration;
+Gemm::Storage cfg_weight_storage;
 #ifdef USE_OPENCL
 std::vector<int> cfg_gpus;
 bool cfg_sgemm_exhaustive;
@@ -66,7 +74,10 @@ bool cfg_tune_only;
 float cfg_puct;
 float cfg_softmax_temp;
 float cfg_fpu_reduction;
+bool cfg_search_graph;
 std::string cfg_weightsfile;
+std::string cfg_cache_file;
+bool cfg_cache_symmetry;
 std::string cfg_logfile;
 FILE* cfg_logfile_handle;
 bool cfg_quiet;
@@ -95,11 +106,19 @@ void GTP::setup_default_parameters() {
     cfg_puct = 0.8f;
     cfg_softmax_temp = 1.0f;
     cfg_fpu_reduction = 0.25f;
+    cfg_search_graph = false;
     // see UCTSearch::should_resign
     cfg_resignpct = -1;
     cfg_noise = false;
     cfg_random_cnt = 0;
     cfg_dumbpass = false;
+    cfg_batch_size = 1;
+    cfg_batch_wait_us = 500;
+    cfg_nn_threads = 0;
+    cfg_winograd_tile = 2;
+    cfg_int8 = false;
+    cfg_weight_storage = Gemm::FP32;
+    cfg_cache_symmetry = false;
     cfg_logfile_handle = nullptr;
     cfg_quiet = false;
     cfg_benchmark = false;
@@ -683,6 +702,18 @@ bool GTP::execute(GameState & game, std::string xinput) {
         gtp_printf(id, "");
         return true;
 
+    } else if (command.find("cachebench") == 0) {
+        std::istringstream cmdstream(command);
+        std::string tmp;
+        int threads;
+
+        cmdstream >> tmp;  // eat cachebench
+        cmdstream >> threads;
+
+        NNCache::benchmark(!cmdstream.fail() ? threads : 32);
+        gtp_printf(id, "");
+        return true;
+
     } else if (command.find("printsgf") == 0) {
         std::istringstream cmdstream(command);
         std::string tmp, filename;
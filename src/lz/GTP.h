@@ -25,6 +25,7 @@
 #include <string>
 #include <vector>
 
+#include "Gemm.h"
 #include "GameState.h"
 #include "UCTSearch.h"
 
@@ -41,6 +42,13 @@ extern int cfg_noise;
 extern int cfg_random_cnt;
 extern std::uint64_t cfg_rng_seed;
 extern bool cfg_dumbpass;
+extern int cfg_batch_size;
+extern int cfg_batch_wait_us;
+extern int cfg_nn_threads;
+extern int cfg_winograd_tile;
+extern bool cfg_int8;
+extern std::string cfg_int8_calibration;
+extern Gemm::Storage cfg_weight_storage;
 #ifdef USE_OPENCL
 extern std::vector<int> cfg_gpus;
 extern bool cfg_sgemm_exhaustive;
@@ -49,8 +57,11 @@ extern bool cfg_tune_only;
 extern float cfg_puct;
 extern float cfg_softmax_temp;
 extern float cfg_fpu_reduction;
+extern bool cfg_search_graph;
 extern std::string cfg_logfile;
 extern std::string cfg_weightsfile;
+extern std::string cfg_cache_file;
+extern bool cfg_cache_symmetry;
 extern FILE* cfg_logfile_handle;
 extern bool cfg_quiet;
 extern std::string cfg_options_str;
@@ -0,0 +1,316 @@
+/*
+    This file is part of Leela Zero.
+    Copyright (C) 2017-2018 Gian-Carlo Pascutto and contributors
+
+    Leela Zero is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Leela Zero is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Leela Zero.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "Gemm.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+
+#include "half/half.hpp"
+
+const char* Gemm::get_name(const Storage storage) {
+    switch (storage) {
+    case FP16:
+        return "fp16";
+    case BF16:
+        return "bf16";
+    default:
+        return "fp32";
+    }
+}
+
+std::vector<Gemm::Kernels> Gemm::get_available_kernels() {
+    auto kernels = std::vector<Kernels>{};
+#ifdef SIMD_X86
+    const auto level = SIMD::get_level();
+    if (level >= SIMD::AVX512) {
+        kernels.push_back({SIMD::AVX512, multiply_avx512});
+    }
+    if (level >= SIMD::AVX2) {
+        kernels.push_back({SIMD::AVX2, multiply_avx2});
+    }
+#endif
+    kernels.push_back({SIMD::SCALAR, multiply_scalar});
+    return kernels;
+}
+
+static std::uint16_t to_fp16(const float x) {
+    const auto h = half_float::half(x);
+    auto bits = std::uint16_t{};
+    std::memcpy(&bits, &h, sizeof(bits));
+    return bits;
+}
+
+static float from_fp16(const std::uint16_t bits) {
+    return half_float::detail::half2float<float>(bits);
+}
+
+// BF16 is the upper half of an FP32, rounded to nearest even. NaNs are
+// kept quiet instead of being rounded into infinities.
+static std::uint16_t to_bf16(const float x) {
+    auto bits = std::uint32_t{};
+    std::memcpy(&bits, &x, sizeof(bits));
+    if ((bits & 0x7fffffff) > 0x7f800000) {
+        return std::uint16_t((bits >> 16) | 0x0040);
+    }
+    bits += 0x7fff + ((bits >> 16) & 1);
+    return std::uint16_t(bits >> 16);
+}
+
+static float from_bf16(const std::uint16_t bits) {
+    const auto wide = std::uint32_t{bits} << 16;
+    auto x = 0.0f;
+    std::memcpy(&x, &wide, sizeof(x));
+    return x;
+}
+
+Gemm::Weights Gemm::pack_weights(const float* U,
+                                 const int tiles,
+                                 const int C, const int K,
+                                 const Storage storage) {
+    const auto panels = (K + PANEL - 1) / PANEL;
+    auto weights = Weights{storage, tiles, C, K, {}, {}, nullptr};
+    const auto size = get_packed_size(tiles, C, K);
+    if (storage == FP32) {
+        weights.data_fp32.resize(size);
+    } else {
+        weights.data.resize(size);
+    }
+
+    auto i = size_t{0};
+    for (auto b = 0; b < tiles; b++) {
+        for (auto n = 0; n < panels; n++) {
+            for (auto c = 0; c < C; c++) {
+                for (auto j = 0; j < PANEL; j++, i++) {
+                    const auto k = n * PANEL + j;
+                    // Padding outputs are never stored.
+                    const auto x = k < K ? U[(b * C + c) * K + k] : 0.0f;
+                    if (storage == FP32) {
+                        weights.data_fp32[i] = x;
+                    } else {
+                        weights.data[i] = storage == FP16 ? to_fp16(x)
+                                                          : to_bf16(x);
+                    }
+                }
+            }
+        }
+    }
+    return weights;
+}
+
+Gemm::Weights Gemm::map_weights(const float* panels,
+                                const int tiles,
+                                const int C, const int K) {
+    return Weights{FP32, tiles, C, K, {}, {}, panels};
+}
+
+// Buffer for one panel widened from 16 bits. It is kept by each thread,
+// so that a multiplication doesn't allocate.
+static float* get_unpacked(const Gemm::Weights& U) {
+    thread_local auto unpacked = std::vector<float>{};
+    const auto size = size_t(U.channels) * Gemm::PANEL;
+    if (U.storage != Gemm::FP32 && unpacked.size() < size) {
+        unpacked.resize(size);
+    }
+    return unpacked.data();
+}
+
+// The FP32 panel of a block. 16 bit panels are widened into unpacked.
+static const float* get_panel_scalar(const Gemm::Weights& U, const int block,
+                                     float* unpacked) {
+    const auto size = U.channels * Gemm::PANEL;
+    if (U.storage == Gemm::FP32) {
+        return (U.mapped ? U.mapped : U.data_fp32.data()) + block * size;
+    }
+    const auto src = U.data.data() + block * size;
+    for (auto i = 0; i < size; i++) {
+        unpacked[i] = U.storage == Gemm::FP16 ? from_fp16(src[i])
+                                              : from_bf16(src[i]);
+    }
+    return unpacked;
+}
+
+void Gemm::multiply_scalar(const Weights& U, const float* V,
+                           const int BP, float* M,
+                           const int begin, const int end) {
+    const auto C = U.channels;
+    const auto K = U.outputs;
+    const auto panels = (K + PANEL - 1) / PANEL;
+    const auto unpacked = get_unpacked(U);
+
+    for (auto block = begin; block < end; block++) {
+        const auto b = block / panels;
+        const auto n = block % panels;
+        const auto Vb = V + b * C * BP;
+        const auto panel = get_panel_scalar(U, block, unpacked);
+        for (auto i = 0; i < PANEL && n * PANEL + i < K; i++) {
+            const auto Mk = M + (b * K + n * PANEL + i) * BP;
+            std::fill(Mk, Mk + BP, 0.0f);
+            for (auto c = 0; c < C; c++) {
+                const auto w = panel[c * PANEL + i];
+                for (auto p = 0; p < BP; p++) {
+                    Mk[p] += w * Vb[c * BP + p];
+                }
+            }
+        }
+    }
+}
+
+#ifdef SIMD_X86
+// Columns of V that the SIMD kernels multiply with all panels of a tile
+// before they move on, 256 KB of V for 256 channels.
+constexpr auto CHUNK = 256;
+
+// Widens one panel of PANEL outputs by C channels to FP32.
+SIMD_TARGET("avx2,f16c")
+static void unpack_panel(const Gemm::Storage storage,
+                         const std::uint16_t* src, const int C, float* dst) {
+    static_assert(Gemm::PANEL == 8, "One panel row is one vector");
+    for (auto c = 0; c < C; c++) {
+        const auto row = _mm_loadu_si128(
+            reinterpret_cast<const __m128i*>(src + c * Gemm::PANEL));
+        const auto wide = storage == Gemm::FP16
+            ? _mm256_cvtph_ps(row)
+            : _mm256_castsi256_ps(
+                  _mm256_slli_epi32(_mm256_cvtepu16_epi32(row), 16));
+        _mm256_storeu_ps(dst + c * Gemm::PANEL, wide);
+    }
+}
+
+// The FP32 panel of a block. 16 bit panels are widened into unpacked.
+SIMD_TARGET("avx2,f16c")
+static const float* get_panel(const Gemm::Weights& U, const int block,
+                              float* unpacked) {
+    const auto size = U.channels * Gemm::PANEL;
+    if (U.storage == Gemm::FP32) {
+        return (U.mapped ? U.mapped : U.data_fp32.data()) + block * size;
+    }
+    unpack_panel(U.storage, U.data.data() + block * size, U.channels,
+                 unpacked);
+    return unpacked;
+}
+
+// Each pass computes the PANEL outputs of a panel for 8 tiles.
+SIMD_TARGET("avx2,fma")
+void Gemm::multiply_avx2(const Weights& U, const float* V,
+                         const int BP, float* M,
+                         const int begin, const int end) {
+    const auto C = U.channels;
+    const auto K = U.outputs;
+    const auto panels = (K + PANEL - 1) / PANEL;
+    const auto lanes = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+    const auto unpacked = get_unpacked(U);
+
+    // All panels of a tile go over the same columns of V before moving
+    // on, so a chunk of V stays in L2 for large batches.
+    for (auto block = begin; block < end; ) {
+        const auto b = block / panels;
+        const auto tile_end = std::min(end, (b + 1) * panels);
+        const auto Vb = V + b * C * BP;
+        for (auto chunk = 0; chunk < BP; chunk += CHUNK) {
+            const auto chunk_end = std::min(BP, chunk + CHUNK);
+            for (auto i = block; i < tile_end; i++) {
+                const auto n = i % panels;
+                const auto panel = get_panel(U, i, unpacked);
+                for (auto p = chunk; p < chunk_end; p += 8) {
+                    const auto mask = _mm256_cmpgt_epi32(
+                        _mm256_set1_epi32(BP - p), lanes);
+                    __m256 acc[PANEL];
+                    for (auto j = 0; j < PANEL; j++) {
+                        acc[j] = _mm256_setzero_ps();
+                    }
+                    for (auto c = 0; c < C; c++) {
+                        const auto v = _mm256_maskload_ps(Vb + c * BP + p,
+                                                          mask);
+                        const auto w = panel + c * PANEL;
+                        for (auto j = 0; j < PANEL; j++) {
+                            acc[j] = _mm256_fmadd_ps(
+                                _mm256_broadcast_ss(w + j), v, acc[j]);
+                        }
+                    }
+                    for (auto j = 0; j < PANEL && n * PANEL + j < K; j++) {
+                        _mm256_maskstore_ps(
+                            M + (b * K + n * PANEL + j) * BP + p, mask,
+                            acc[j]);
+                    }
+                }
+            }
+        }
+        block = tile_end;
+    }
+}
+
+// Each pass computes the PANEL outputs of a panel for 32 tiles.
+SIMD_TARGET("avx512f,fma")
+void Gemm::multiply_avx512(const Weights& U, const float* V,
+                           const int BP, float* M,
+                           const int begin, const int end) {
+    const auto C = U.channels;
+    const auto K = U.outputs;
+    const auto panels = (K + PANEL - 1) / PANEL;
+    const auto unpacked = get_unpacked(U);
+
+    const auto tail_mask = [BP](const int p) {
+        return __mmask16(p >= BP ? 0
+                         : BP - p >= 16 ? 0xffff : (1u << (BP - p)) - 1);
+    };
+
+    // All panels of a tile go over the same columns of V before moving
+    // on, so a chunk of V stays in L2 for large batches.
+    for (auto block = begin; block < end; ) {
+        const auto b = block / panels;
+        const auto tile_end = std::min(end, (b + 1) * panels);
+        const auto Vb = V + b * C * BP;
+        for (auto chunk = 0; chunk < BP; chunk += CHUNK) {
+            const auto chunk_end = std::min(BP, chunk + CHUNK);
+            for (auto i = block; i < tile_end; i++) {
+                const auto n = i % panels;
+                const auto panel = get_panel(U, i, unpacked);
+                for (auto p = chunk; p < chunk_end; p += 32) {
+                    const auto mask0 = tail_mask(p);
+                    const auto mask1 = tail_mask(p + 16);
+                    __m512 acc[PANEL][2];
+                    for (auto j = 0; j < PANEL; j++) {
+                        acc[j][0] = _mm512_setzero_ps();
+                        acc[j][1] = _mm512_setzero_ps();
+                    }
+                    for (auto c = 0; c < C; c++) {
+                        const auto v0 = _mm512_maskz_loadu_ps(
+                            mask0, Vb + c * BP + p);
+                        const auto v1 = _mm512_maskz_loadu_ps(
+                            mask1, Vb + c * BP + p + 16);
+                        const auto w = panel + c * PANEL;
+                        for (auto j = 0; j < PANEL; j++) {
+                            const auto wj = _mm512_set1_ps(w[j]);
+                            acc[j][0] = _mm512_fmadd_ps(wj, v0, acc[j][0]);
+                            acc[j][1] = _mm512_fmadd_ps(wj, v1, acc[j][1]);
+                        }
+                    }
+                    for (auto j = 0; j < PANEL && n * PANEL + j < K; j++) {
+                        const auto Mk = M + (b * K + n * PANEL + j) * BP + p;
+                        _mm512_mask_storeu_ps(Mk, mask0, acc[j][0]);
+                        _mm512_mask_storeu_ps(Mk + 16, mask1, acc[j][1]);
+                    }
+                }
+            }
+        }
+        block = tile_end;
+    }
+}
+#endif
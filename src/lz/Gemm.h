@@ -0,0 +1,101 @@
+/*
+    This file is part of Leela Zero.
+    Copyright (C) 2017-2018 Gian-Carlo Pascutto and contributors
+
+    Leela Zero is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Leela Zero is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Leela Zero.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef GEMM_H_INCLUDED
+#define GEMM_H_INCLUDED
+
+#include "config.h"
+
+#include <cstdint>
+#include <vector>
+
+#include "SIMD.h"
+
+// Winograd domain multiplication M = U^T V for all tiles at once. U is
+// packed in panels of PANEL output channels, which the kernels multiply
+// with blocks of V held in registers. Filters stored in 16 bits are
+// widened to FP32 in L1 right before a panel is used, so only half the
+// weight bytes are streamed from memory. V is [tile][C][BP] and M
+// [tile][K][BP], as for the sgemm.
+namespace Gemm {
+    enum Storage {
+        FP32, FP16, BF16
+    };
+    const char* get_name(Storage storage);
+
+    constexpr auto PANEL = 8;
+
+    struct Weights {
+        Storage storage;
+        int tiles;
+        int channels;
+        int outputs;
+        // [tile][K_pad / PANEL][C][PANEL], in data for 16 bit storage
+        // and in data_fp32 or mapped for FP32.
+        std::vector<std::uint16_t> data;
+        std::vector<float> data_fp32;
+        const float* mapped;
+    };
+
+    // Values in the packed layout, padding included.
+    inline size_t get_packed_size(const int tiles, const int C, const int K) {
+        return size_t(tiles) * ((K + PANEL - 1) / PANEL) * C * PANEL;
+    }
+
+    // U is laid out as [tile][C][K], like the FP32 filters.
+    Weights pack_weights(const float* U, const int tiles,
+                         const int C, const int K, const Storage storage);
+    // FP32 panels that are already packed, such as those of a binary
+    // weights file, used in place.
+    Weights map_weights(const float* panels, const int tiles,
+                        const int C, const int K);
+
+    // Blocks of one panel in one tile, the unit of work of the kernels.
+    inline int get_blocks(const Weights& U) {
+        return U.tiles * ((U.outputs + PANEL - 1) / PANEL);
+    }
+
+    // Only computes the outputs of blocks [begin, end), so a
+    // multiplication can be split across threads.
+    using Multiply = void (*)(const Weights& U, const float* V,
+                              const int BP, float* M,
+                              const int begin, const int end);
+
+    struct Kernels {
+        SIMD::Level level;
+        Multiply multiply;
+    };
+
+    // Kernels that run on this CPU, fastest first. The scalar kernel is
+    // always last.
+    std::vector<Kernels> get_available_kernels();
+
+    void multiply_scalar(const Weights& U, const float* V,
+                         const int BP, float* M,
+                         const int begin, const int end);
+#ifdef SIMD_X86
+    void multiply_avx2(const Weights& U, const float* V,
+                       const int BP, float* M,
+                       const int begin, const int end);
+    void multiply_avx512(const Weights& U, const float* V,
+                         const int BP, float* M,
+                         const int begin, const int end);
+#endif
+}
+
+#endif
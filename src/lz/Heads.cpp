@@ -0,0 +1,354 @@
+/*
+    This file is part of Leela Zero.
+    Copyright (C) 2017-2018 Gian-Carlo Pascutto and contributors
+
+    Leela Zero is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Leela Zero is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Leela Zero.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "config.h"
+#include "Heads.h"
+
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <cmath>
+#include <limits>
+#include <numeric>
+
+std::vector<Heads::Kernels> Heads::get_available_kernels() {
+    auto kernels = std::vector<Kernels>{};
+#ifdef SIMD_X86
+    const auto level = SIMD::get_level();
+    if (level >= SIMD::AVX512) {
+        kernels.push_back({SIMD::AVX512, convolve_avx512, softmax_avx512});
+    }
+    if (level >= SIMD::AVX2) {
+        kernels.push_back({SIMD::AVX2, convolve_avx2, softmax_avx2});
+    }
+#endif
+    kernels.push_back({SIMD::SCALAR, convolve_scalar, softmax_scalar});
+    return kernels;
+}
+
+Heads::Weights Heads::fold_batchnorm(const int channels,
+                                     const int policy_outputs,
+                                     const float* policy_weights,
+                                     const float* policy_means,
+                                     const float* policy_stddivs,
+                                     const int value_outputs,
+                                     const float* value_weights,
+                                     const float* value_means,
+                                     const float* value_stddivs) {
+    assert(policy_outputs + value_outputs <= MAX_OUTPUTS);
+    auto heads = Weights{channels, policy_outputs, value_outputs, {}, {}};
+    heads.weights.assign(channels * MAX_OUTPUTS, 0.0f);
+    heads.biases.assign(MAX_OUTPUTS, 0.0f);
+
+    const auto fold = [&heads, channels](const int first, const int outputs,
+                                         const float* weights,
+                                         const float* means,
+                                         const float* stddivs) {
+        for (auto o = 0; o < outputs; o++) {
+            for (auto c = 0; c < channels; c++) {
+                heads.weights[c * MAX_OUTPUTS + first + o] =
+                    stddivs[o] * weights[o * channels + c];
+            }
+            heads.biases[first + o] = -stddivs[o] * means[o];
+        }
+    };
+    fold(0, policy_outputs, policy_weights, policy_means, policy_stddivs);
+    fold(policy_outputs, value_outputs,
+         value_weights, value_means, value_stddivs);
+    return heads;
+}
+
+static float* output_row(const Heads::Weights& heads, const int o,
+                         float* policy, float* value) {
+    if (o < heads.policy_outputs) {
+        return policy + o * BOARD_SQUARES;
+    }
+    return value + (o - heads.policy_outputs) * BOARD_SQUARES;
+}
+
+void Heads::convolve_scalar(const Weights& heads, const float* in,
+                            float* policy, float* value) {
+    const auto outputs = heads.policy_outputs + heads.value_outputs;
+    for (auto o = 0; o < outputs; o++) {
+        const auto out = output_row(heads, o, policy, value);
+        std::fill(out, out + BOARD_SQUARES, heads.biases[o]);
+        for (auto c = 0; c < heads.channels; c++) {
+            const auto w = heads.weights[c * MAX_OUTPUTS + o];
+            const auto in_c = in + c * BOARD_SQUARES;
+            for (auto p = 0; p < BOARD_SQUARES; p++) {
+                out[p] += w * in_c[p];
+            }
+        }
+        for (auto p = 0; p < BOARD_SQUARES; p++) {
+            out[p] = std::max(0.0f, out[p]);
+        }
+    }
+}
+
+void Heads::softmax_scalar(const float* in, float* out, const int size,
+                           const float temperature) {
+    const auto alpha = *std::max_element(in, in + size);
+    auto denom = 0.0f;
+
+    for (auto i = 0; i < size; i++) {
+        const auto val = std::exp((in[i] - alpha) / temperature);
+        denom += val;
+        out[i] = val;
+    }
+
+    for (auto i = 0; i < size; i++) {
+        out[i] /= denom;
+    }
+}
+
+#ifdef SIMD_X86
+// The exponentials are taken as 2^n * exp(r), with n = round(x / ln 2)
+// and the polynomial for exp(r) from Cephes, about 1 ulp. The softmax
+// inputs are at most 0, and anything below -87 underflows to 2^-126.
+constexpr auto LOG2E = 1.44269504088896341f;
+constexpr auto LN2_HI = 0.693359375f;
+constexpr auto LN2_LO = -2.12194440e-4f;
+constexpr float EXP_POLY[] = {
+    1.9875691500e-4f, 1.3981999507e-3f, 8.3334519073e-3f,
+    4.1665795894e-2f, 1.6666665459e-1f, 5.0000001201e-1f
+};
+
+SIMD_TARGET("avx2,fma")
+static __m256 exp_avx2(__m256 x) {
+    x = _mm256_max_ps(x, _mm256_set1_ps(-87.0f));
+    const auto n = _mm256_round_ps(_mm256_mul_ps(x, _mm256_set1_ps(LOG2E)),
+                                   _MM_FROUND_TO_NEAREST_INT
+                                   | _MM_FROUND_NO_EXC);
+    auto r = _mm256_fnmadd_ps(n, _mm256_set1_ps(LN2_HI), x);
+    r = _mm256_fnmadd_ps(n, _mm256_set1_ps(LN2_LO), r);
+    auto p = _mm256_set1_ps(EXP_POLY[0]);
+    for (auto i = 1; i < 6; i++) {
+        p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(EXP_POLY[i]));
+    }
+    p = _mm256_fmadd_ps(p, _mm256_mul_ps(r, r), r);
+    p = _mm256_add_ps(p, _mm256_set1_ps(1.0f));
+    const auto scale = _mm256_slli_epi32(
+        _mm256_add_epi32(_mm256_cvtps_epi32(n), _mm256_set1_epi32(127)), 23);
+    return _mm256_mul_ps(p, _mm256_castsi256_ps(scale));
+}
+
+SIMD_TARGET("avx2")
+static float reduce_max_avx2(const __m256 x) {
+    auto m = _mm_max_ps(_mm256_castps256_ps128(x),
+                        _mm256_extractf128_ps(x, 1));
+    m = _mm_max_ps(m, _mm_movehl_ps(m, m));
+    m = _mm_max_ss(m, _mm_shuffle_ps(m, m, 1));
+    return _mm_cvtss_f32(m);
+}
+
+SIMD_TARGET("avx2")
+static float reduce_add_avx2(const __m256 x) {
+    auto s = _mm_add_ps(_mm256_castps256_ps128(x),
+                        _mm256_extractf128_ps(x, 1));
+    s = _mm_add_ps(s, _mm_movehl_ps(s, s));
+    s = _mm_add_ss(s, _mm_shuffle_ps(s, s, 1));
+    return _mm_cvtss_f32(s);
+}
+
+// Each pass computes all outputs for 16 points.
+SIMD_TARGET("avx2,fma")
+void Heads::convolve_avx2(const Weights& heads, const float* in,
+                          float* policy, float* value) {
+    const auto outputs = heads.policy_outputs + heads.value_outputs;
+    const auto lanes = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+    const auto zero = _mm256_setzero_ps();
+
+    for (auto p = 0; p < BOARD_SQUARES; p += 16) {
+        const auto mask0 = _mm256_cmpgt_epi32(
+            _mm256_set1_epi32(BOARD_SQUARES - p), lanes);
+        const auto mask1 = _mm256_cmpgt_epi32(
+            _mm256_set1_epi32(BOARD_SQUARES - p - 8), lanes);
+        __m256 acc[MAX_OUTPUTS][2];
+        for (auto o = 0; o < MAX_OUTPUTS; o++) {
+            acc[o][0] = _mm256_broadcast_ss(&heads.biases[o]);
+            acc[o][1] = acc[o][0];
+        }
+        for (auto c = 0; c < heads.channels; c++) {
+            const auto in_c = in + c * BOARD_SQUARES + p;
+            const auto v0 = _mm256_maskload_ps(in_c, mask0);
+            const auto v1 = _mm256_maskload_ps(in_c + 8, mask1);
+            const auto w = heads.weights.data() + c * MAX_OUTPUTS;
+            for (auto o = 0; o < MAX_OUTPUTS; o++) {
+                const auto wo = _mm256_broadcast_ss(w + o);
+                acc[o][0] = _mm256_fmadd_ps(wo, v0, acc[o][0]);
+                acc[o][1] = _mm256_fmadd_ps(wo, v1, acc[o][1]);
+            }
+        }
+        for (auto o = 0; o < outputs; o++) {
+            const auto out = output_row(heads, o, policy, value) + p;
+            _mm256_maskstore_ps(out, mask0, _mm256_max_ps(acc[o][0], zero));
+            _mm256_maskstore_ps(out + 8, mask1,
+                                _mm256_max_ps(acc[o][1], zero));
+        }
+    }
+}
+
+SIMD_TARGET("avx2,fma")
+void Heads::softmax_avx2(const float* in, float* out, const int size,
+                         const float temperature) {
+    const auto vectors = size - size % 8;
+    auto max = _mm256_set1_ps(-std::numeric_limits<float>::infinity());
+    for (auto i = 0; i < vectors; i += 8) {
+        max = _mm256_max_ps(max, _mm256_loadu_ps(in + i));
+    }
+    auto alpha = reduce_max_avx2(max);
+    for (auto i = vectors; i < size; i++) {
+        alpha = std::max(alpha, in[i]);
+    }
+
+    const auto scale = 1.0f / temperature;
+    const auto shift = _mm256_set1_ps(alpha);
+    auto sum = _mm256_setzero_ps();
+    for (auto i = 0; i < vectors; i += 8) {
+        const auto x = _mm256_sub_ps(_mm256_loadu_ps(in + i), shift);
+        const auto val = exp_avx2(_mm256_mul_ps(x, _mm256_set1_ps(scale)));
+        sum = _mm256_add_ps(sum, val);
+        _mm256_storeu_ps(out + i, val);
+    }
+    auto denom = reduce_add_avx2(sum);
+    for (auto i = vectors; i < size; i++) {
+        out[i] = std::exp((in[i] - alpha) * scale);
+        denom += out[i];
+    }
+
+    const auto norm = 1.0f / denom;
+    for (auto i = 0; i < vectors; i += 8) {
+        _mm256_storeu_ps(out + i, _mm256_mul_ps(_mm256_loadu_ps(out + i),
+                                                _mm256_set1_ps(norm)));
+    }
+    for (auto i = vectors; i < size; i++) {
+        out[i] *= norm;
+    }
+}
+
+// GCC 12 warns about the undefined source of the unmasked forms.
+static constexpr auto all_lanes = __mmask16(0xffff);
+
+static __mmask16 tail_mask(const int remaining) {
+    return __mmask16(remaining <= 0 ? 0
+                     : remaining >= 16 ? 0xffff : (1u << remaining) - 1);
+}
+
+SIMD_TARGET("avx512f,fma")
+static __m512 exp_avx512(__m512 x) {
+    x = _mm512_maskz_max_ps(all_lanes, x, _mm512_set1_ps(-87.0f));
+    const auto n = _mm512_maskz_roundscale_ps(
+        all_lanes, _mm512_mul_ps(x, _mm512_set1_ps(LOG2E)),
+        _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+    auto r = _mm512_fnmadd_ps(n, _mm512_set1_ps(LN2_HI), x);
+    r = _mm512_fnmadd_ps(n, _mm512_set1_ps(LN2_LO), r);
+    auto p = _mm512_set1_ps(EXP_POLY[0]);
+    for (auto i = 1; i < 6; i++) {
+        p = _mm512_fmadd_ps(p, r, _mm512_set1_ps(EXP_POLY[i]));
+    }
+    p = _mm512_fmadd_ps(p, _mm512_mul_ps(r, r), r);
+    p = _mm512_add_ps(p, _mm512_set1_ps(1.0f));
+    return _mm512_maskz_scalef_ps(all_lanes, p, n);
+}
+
+// Each pass computes all outputs for 32 points.
+SIMD_TARGET("avx512f,fma")
+void Heads::convolve_avx512(const Weights& heads, const float* in,
+                            float* policy, float* value) {
+    const auto outputs = heads.policy_outputs + heads.value_outputs;
+    const auto zero = _mm512_setzero_ps();
+
+    for (auto p = 0; p < BOARD_SQUARES; p += 32) {
+        const auto mask0 = tail_mask(BOARD_SQUARES - p);
+        const auto mask1 = tail_mask(BOARD_SQUARES - p - 16);
+        __m512 acc[MAX_OUTPUTS][2];
+        for (auto o = 0; o < MAX_OUTPUTS; o++) {
+            acc[o][0] = _mm512_set1_ps(heads.biases[o]);
+            acc[o][1] = acc[o][0];
+        }
+        for (auto c = 0; c < heads.channels; c++) {
+            const auto in_c = in + c * BOARD_SQUARES + p;
+            const auto v0 = _mm512_maskz_loadu_ps(mask0, in_c);
+            const auto v1 = _mm512_maskz_loadu_ps(mask1, in_c + 16);
+            const auto w = heads.weights.data() + c * MAX_OUTPUTS;
+            for (auto o = 0; o < MAX_OUTPUTS; o++) {
+                const auto wo = _mm512_set1_ps(w[o]);
+                acc[o][0] = _mm512_fmadd_ps(wo, v0, acc[o][0]);
+                acc[o][1] = _mm512_fmadd_ps(wo, v1, acc[o][1]);
+            }
+        }
+        for (auto o = 0; o < outputs; o++) {
+            const auto out = output_row(heads, o, policy, value) + p;
+            _mm512_mask_storeu_ps(out, mask0,
+                                  _mm512_maskz_max_ps(all_lanes,
+                                                      acc[o][0], zero));
+            _mm512_mask_storeu_ps(out + 16, mask1,
+                                  _mm512_maskz_max_ps(all_lanes,
+                                                      acc[o][1], zero));
+        }
+    }
+}
+
+// Horizontal reductions through memory, _mm512_reduce_*_ps trips false
+// uninitialized warnings in some compilers.
+SIMD_TARGET("avx512f,fma")
+static float reduce_max_avx512(const __m512 x) {
+    auto lanes = std::array<float, 16>{};
+    _mm512_storeu_ps(lanes.data(), x);
+    return *std::max_element(cbegin(lanes), cend(lanes));
+}
+
+SIMD_TARGET("avx512f,fma")
+static float reduce_add_avx512(const __m512 x) {
+    auto lanes = std::array<float, 16>{};
+    _mm512_storeu_ps(lanes.data(), x);
+    return std::accumulate(cbegin(lanes), cend(lanes), 0.0f);
+}
+
+SIMD_TARGET("avx512f,fma")
+void Heads::softmax_avx512(const float* in, float* out, const int size,
+                           const float temperature) {
+    const auto lowest = _mm512_set1_ps(-std::numeric_limits<float>::infinity());
+    auto max = lowest;
+    for (auto i = 0; i < size; i += 16) {
+        const auto x = _mm512_mask_loadu_ps(lowest, tail_mask(size - i),
+                                            in + i);
+        max = _mm512_maskz_max_ps(all_lanes, max, x);
+    }
+    const auto alpha = reduce_max_avx512(max);
+
+    const auto scale = _mm512_set1_ps(1.0f / temperature);
+    const auto shift = _mm512_set1_ps(alpha);
+    auto sum = _mm512_setzero_ps();
+    for (auto i = 0; i < size; i += 16) {
+        const auto mask = tail_mask(size - i);
+        const auto x = _mm512_sub_ps(_mm512_maskz_loadu_ps(mask, in + i),
+                                     shift);
+        const auto val = exp_avx512(_mm512_mul_ps(x, scale));
+        sum = _mm512_mask_add_ps(sum, mask, sum, val);
+        _mm512_mask_storeu_ps(out + i, mask, val);
+    }
+
+    const auto norm = _mm512_set1_ps(1.0f / reduce_add_avx512(sum));
+    for (auto i = 0; i < size; i += 16) {
+        const auto mask = tail_mask(size - i);
+        _mm512_mask_storeu_ps(out + i, mask,
+            _mm512_mul_ps(_mm512_maskz_loadu_ps(mask, out + i), norm));
+    }
+}
+#endif
@@ -0,0 +1,91 @@
+/*
+    This file is part of Leela Zero.
+    Copyright (C) 2017-2018 Gian-Carlo Pascutto and contributors
+
+    Leela Zero is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Leela Zero is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Leela Zero.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef HEADS_H_INCLUDED
+#define HEADS_H_INCLUDED
+
+#include "config.h"
+
+#include <vector>
+
+#include "SIMD.h"
+
+// Policy and value heads of the CPU forward pass. The 1x1 convolutions
+// of both heads run as a single pass over the output of the residual
+// tower, with the batchnorm folded into the weights and the ReLU
+// applied on the way out. The inner products are left to the BLAS.
+namespace Heads {
+    constexpr auto MAX_OUTPUTS = 4;
+
+    struct Weights {
+        int channels;
+        int policy_outputs;
+        int value_outputs;
+        // [channels][MAX_OUTPUTS] and [MAX_OUTPUTS], policy outputs first
+        // and zero padded, so every kernel computes MAX_OUTPUTS outputs.
+        std::vector<float> weights;
+        std::vector<float> biases;
+    };
+
+    // Folds the batchnorm of each head into its 1x1 convolution, as
+    // stddiv * (w * x - mean). The convolution biases are expected to be
+    // folded into the means already.
+    Weights fold_batchnorm(const int channels,
+                           const int policy_outputs,
+                           const float* policy_weights,
+                           const float* policy_means,
+                           const float* policy_stddivs,
+                           const int value_outputs,
+                           const float* value_weights,
+                           const float* value_means,
+                           const float* value_stddivs);
+
+    // Both head convolutions of one board, in is [channels][BOARD_SQUARES].
+    using Convolve = void (*)(const Weights& heads, const float* in,
+                              float* policy, float* value);
+    // Softmax of in / temperature, out may alias in.
+    using Softmax = void (*)(const float* in, float* out, const int size,
+                             const float temperature);
+
+    struct Kernels {
+        SIMD::Level level;
+        Convolve convolve;
+        Softmax softmax;
+    };
+
+    // Kernels that run on this CPU, fastest first. The scalar kernels
+    // are always last.
+    std::vector<Kernels> get_available_kernels();
+
+    void convolve_scalar(const Weights& heads, const float* in,
+                         float* policy, float* value);
+    void softmax_scalar(const float* in, float* out, const int size,
+                        const float temperature);
+#ifdef SIMD_X86
+    void convolve_avx2(const Weights& heads, const float* in,
+                       float* policy, float* value);
+    void softmax_avx2(const float* in, float* out, const int size,
+                      const float temperature);
+    void convolve_avx512(const Weights& heads, const float* in,
+                         float* policy, float* value);
+    void softmax_avx512(const float* in, float* out, const int size,
+                        const float temperature);
+#endif
+}
+
+#endif
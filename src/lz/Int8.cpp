@@ -0,0 +1,330 @@
+/*
+    This file is part of Leela Zero.
+    Copyright (C) 2017-2018 Gian-Carlo Pascutto and contributors
+
+    Leela Zero is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Leela Zero is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Leela Zero.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "Int8.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+std::vector<Int8::Kernels> Int8::get_available_kernels() {
+    auto kernels = std::vector<Kernels>{};
+#ifdef SIMD_X86
+    const auto level = SIMD::get_level();
+    if (level >= SIMD::AVX512VNNI) {
+        kernels.push_back({SIMD::AVX512VNNI,
+                           quantize_input_avx512, gemm_avx512vnni});
+    }
+    if (level >= SIMD::AVX2) {
+        kernels.push_back({SIMD::AVX2, quantize_input_avx2, gemm_avx2});
+    }
+#endif
+    kernels.push_back({SIMD::SCALAR, quantize_input_scalar, gemm_scalar});
+    return kernels;
+}
+
+Int8::Weights Int8::quantize_weights(const float* U,
+                                     const int tiles,
+                                     const int C, const int K) {
+    const auto C_pad = get_padded_channels(C);
+    auto weights = Weights{tiles, C, K, {}, {}, {}};
+    weights.data.resize(tiles * K * C_pad);
+    weights.scales.resize(tiles * K);
+    weights.offsets.resize(tiles * K);
+
+    for (auto b = 0; b < tiles; b++) {
+        for (auto k = 0; k < K; k++) {
+            const auto row = b * K + k;
+            auto max_abs = 0.0f;
+            for (auto c = 0; c < C; c++) {
+                max_abs = std::max(max_abs, std::abs(U[(b * C + c) * K + k]));
+            }
+            const auto scale = max_abs > 0.0f ? max_abs / 127.0f : 1.0f;
+
+            auto sum = 0;
+            for (auto c = 0; c < C; c++) {
+                const auto q = int(std::lround(U[(b * C + c) * K + k] / scale));
+                weights.data[row * C_pad + c] = std::int8_t(q);
+                sum += q;
+            }
+            weights.scales[row] = scale;
+            weights.offsets[row] = 128 * sum;
+        }
+    }
+    return weights;
+}
+
+void Int8::quantize_input_scalar(const float* V, const int tiles,
+                                 const int C, const int BP,
+                                 const float* scales, std::uint8_t* Vq) {
+    const auto C_pad = get_padded_channels(C);
+    const auto BP_pad = get_padded_tiles(BP);
+
+    for (auto b = 0; b < tiles; b++) {
+        const auto multiplier = 1.0f / scales[b];
+        for (auto c = 0; c < C_pad; c += 4) {
+            const auto dst = Vq + (b * C_pad + c) * BP_pad;
+            // 128 is the quantized zero.
+            std::fill(dst, dst + BP_pad * 4, std::uint8_t{128});
+            for (auto i = 0; i < 4 && c + i < C; i++) {
+                const auto src = V + (b * C + c + i) * BP;
+                for (auto p = 0; p < BP; p++) {
+                    // Calibration doesn't cover every position, clip
+                    // outliers. The sum is positive, so adding 128.5
+                    // and truncating rounds to nearest.
+                    auto x = src[p] * multiplier;
+                    x = x < -127.0f ? -127.0f : x;
+                    x = x > 127.0f ? 127.0f : x;
+                    dst[p * 4 + i] = std::uint8_t(int(x + 128.5f));
+                }
+            }
+        }
+    }
+}
+
+void Int8::gemm_scalar(const Weights& U, const std::uint8_t* Vq,
+                       const float* scales, const int BP, float* M) {
+    const auto C_pad = get_padded_channels(U.channels);
+    const auto BP_pad = get_padded_tiles(BP);
+    const auto K = U.outputs;
+
+    for (auto b = 0; b < U.tiles; b++) {
+        const auto Vb = Vq + b * C_pad * BP_pad;
+        for (auto k = 0; k < K; k++) {
+            const auto row = b * K + k;
+            const auto Urow = U.data.data() + row * C_pad;
+            const auto scale = U.scales[row] * scales[b];
+            for (auto p = 0; p < BP; p++) {
+                auto acc = 0;
+                for (auto c = 0; c < C_pad; c++) {
+                    acc += Urow[c] * Vb[((c / 4) * BP_pad + p) * 4 + c % 4];
+                }
+                M[row * BP + p] = float(acc - U.offsets[row]) * scale;
+            }
+        }
+    }
+}
+
+#ifdef SIMD_X86
+// Four consecutive channels of a filter row, as one dot product operand.
+static std::int32_t load_group(const std::int8_t* src) {
+    auto group = std::int32_t{};
+    std::memcpy(&group, src, sizeof(group));
+    return group;
+}
+
+// The vector versions quantize a group of 4 channels at once. Packing
+// the 4 bytes of each tile into one 32-bit lane gives the Vq layout.
+SIMD_TARGET("avx2")
+void Int8::quantize_input_avx2(const float* V, const int tiles,
+                               const int C, const int BP,
+                               const float* scales, std::uint8_t* Vq) {
+    const auto C_pad = get_padded_channels(C);
+    const auto BP_pad = get_padded_tiles(BP);
+    const auto lanes = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+    const auto lo = _mm256_set1_ps(-127.0f);
+    const auto hi = _mm256_set1_ps(127.0f);
+    const auto zero = _mm256_set1_epi32(128);
+
+    for (auto b = 0; b < tiles; b++) {
+        const auto multiplier = _mm256_set1_ps(1.0f / scales[b]);
+        for (auto c = 0; c < C_pad; c += 4) {
+            const auto dst = Vq + (b * C_pad + c) * BP_pad;
+            for (auto p = 0; p < BP_pad; p += 8) {
+                // Tiles past BP load as zero.
+                const auto mask = _mm256_cmpgt_epi32(
+                    _mm256_set1_epi32(BP - p), lanes);
+                auto packed = _mm256_setzero_si256();
+                for (auto i = 0; i < 4; i++) {
+                    auto q = zero;
+                    if (c + i < C) {
+                        const auto x = _mm256_maskload_ps(
+                            V + (b * C + c + i) * BP + p, mask);
+                        const auto clipped = _mm256_min_ps(hi,
+                            _mm256_max_ps(lo, _mm256_mul_ps(x, multiplier)));
+                        q = _mm256_add_epi32(zero,
+                                             _mm256_cvtps_epi32(clipped));
+                    }
+                    packed = _mm256_or_si256(packed,
+                                             _mm256_slli_epi32(q, 8 * i));
+                }
+                _mm256_storeu_si256(
+                    reinterpret_cast<__m256i*>(dst + p * 4), packed);
+            }
+        }
+    }
+}
+
+SIMD_TARGET("avx512f")
+void Int8::quantize_input_avx512(const float* V, const int tiles,
+                                 const int C, const int BP,
+                                 const float* scales, std::uint8_t* Vq) {
+    const auto C_pad = get_padded_channels(C);
+    const auto BP_pad = get_padded_tiles(BP);
+    const auto lo = _mm512_set1_ps(-127.0f);
+    const auto hi = _mm512_set1_ps(127.0f);
+    const auto zero = _mm512_set1_epi32(128);
+
+    for (auto b = 0; b < tiles; b++) {
+        const auto multiplier = _mm512_set1_ps(1.0f / scales[b]);
+        for (auto c = 0; c < C_pad; c += 4) {
+            const auto dst = Vq + (b * C_pad + c) * BP_pad;
+            for (auto p = 0; p < BP_pad; p += 16) {
+                // Tiles past BP load as zero.
+                const auto mask = __mmask16(
+                    p >= BP ? 0 : BP - p >= 16 ? 0xffff : (1u << (BP - p)) - 1);
+                auto packed = _mm512_setzero_si512();
+                for (auto i = 0; i < 4; i++) {
+                    auto q = zero;
+                    if (c + i < C) {
+                        const auto x = _mm512_maskz_loadu_ps(
+                            mask, V + (b * C + c + i) * BP + p);
+                        const auto clipped = _mm512_min_ps(hi,
+                            _mm512_max_ps(lo, _mm512_mul_ps(x, multiplier)));
+                        q = _mm512_add_epi32(zero,
+                                             _mm512_cvtps_epi32(clipped));
+                    }
+                    packed = _mm512_or_si512(packed,
+                                             _mm512_slli_epi32(q, 8 * i));
+                }
+                _mm512_storeu_si512(dst + p * 4, packed);
+            }
+        }
+    }
+}
+
+// AVX2 has no 8-bit dot product without saturation, so both operands
+// are widened to 16 bits. Each pass computes 4 output channels for 8
+// tiles, every 32-bit lane holding the sum of 2 channels of one tile.
+SIMD_TARGET("avx2")
+void Int8::gemm_avx2(const Weights& U, const std::uint8_t* Vq,
+                     const float* scales, const int BP, float* M) {
+    const auto C_pad = get_padded_channels(U.channels);
+    const auto BP_pad = get_padded_tiles(BP);
+    const auto K = U.outputs;
+    const auto lanes = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+
+    for (auto b = 0; b < U.tiles; b++) {
+        const auto Vb = Vq + b * C_pad * BP_pad;
+        for (auto k0 = 0; k0 < K; k0 += 4) {
+            const std::int8_t* Urows[4];
+            for (auto i = 0; i < 4; i++) {
+                const auto k = std::min(k0 + i, K - 1);
+                Urows[i] = U.data.data() + (b * K + k) * C_pad;
+            }
+            for (auto p0 = 0; p0 < BP; p0 += 8) {
+                __m256i acc_lo[4], acc_hi[4];
+                for (auto i = 0; i < 4; i++) {
+                    acc_lo[i] = _mm256_setzero_si256();
+                    acc_hi[i] = _mm256_setzero_si256();
+                }
+                for (auto c = 0; c < C_pad; c += 4) {
+                    const auto v = _mm256_loadu_si256(
+                        reinterpret_cast<const __m256i*>(
+                            Vb + (c * BP_pad + p0 * 4)));
+                    const auto v_lo =
+                        _mm256_cvtepu8_epi16(_mm256_castsi256_si128(v));
+                    const auto v_hi =
+                        _mm256_cvtepu8_epi16(_mm256_extracti128_si256(v, 1));
+                    for (auto i = 0; i < 4; i++) {
+                        const auto w = _mm256_broadcastq_epi64(
+                            _mm_cvtepi8_epi16(
+                                _mm_cvtsi32_si128(load_group(Urows[i] + c))));
+                        acc_lo[i] = _mm256_add_epi32(acc_lo[i],
+                                                     _mm256_madd_epi16(v_lo, w));
+                        acc_hi[i] = _mm256_add_epi32(acc_hi[i],
+                                                     _mm256_madd_epi16(v_hi, w));
+                    }
+                }
+
+                const auto mask = _mm256_cmpgt_epi32(
+                    _mm256_set1_epi32(BP - p0), lanes);
+                for (auto i = 0; i < 4 && k0 + i < K; i++) {
+                    const auto row = b * K + k0 + i;
+                    // hadd leaves the tiles as 0 1 4 5 2 3 6 7.
+                    const auto acc = _mm256_permute4x64_epi64(
+                        _mm256_hadd_epi32(acc_lo[i], acc_hi[i]), 0xd8);
+                    const auto out = _mm256_mul_ps(
+                        _mm256_cvtepi32_ps(_mm256_sub_epi32(
+                            acc, _mm256_set1_epi32(U.offsets[row]))),
+                        _mm256_set1_ps(U.scales[row] * scales[b]));
+                    _mm256_maskstore_ps(M + row * BP + p0, mask, out);
+                }
+            }
+        }
+    }
+}
+
+// Each pass computes 4 output channels for 32 tiles. VPDPBUSD multiplies
+// the unsigned inputs with the signed filters and sums groups of 4
+// channels into 32-bit lanes.
+SIMD_TARGET("avx512f,avx512vnni")
+void Int8::gemm_avx512vnni(const Weights& U, const std::uint8_t* Vq,
+                           const float* scales, const int BP, float* M) {
+    const auto C_pad = get_padded_channels(U.channels);
+    const auto BP_pad = get_padded_tiles(BP);
+    const auto K = U.outputs;
+
+    for (auto b = 0; b < U.tiles; b++) {
+        const auto Vb = Vq + b * C_pad * BP_pad;
+        for (auto k0 = 0; k0 < K; k0 += 4) {
+            const std::int8_t* Urows[4];
+            for (auto i = 0; i < 4; i++) {
+                const auto k = std::min(k0 + i, K - 1);
+                Urows[i] = U.data.data() + (b * K + k) * C_pad;
+            }
+            for (auto p0 = 0; p0 < BP; p0 += 32) {
+                __m512i acc[4][2];
+                for (auto i = 0; i < 4; i++) {
+                    acc[i][0] = _mm512_setzero_si512();
+                    acc[i][1] = _mm512_setzero_si512();
+                }
+                for (auto c = 0; c < C_pad; c += 4) {
+                    const auto v = Vb + (c * BP_pad + p0 * 4);
+                    const auto v0 = _mm512_loadu_si512(v);
+                    const auto v1 = _mm512_loadu_si512(v + 64);
+                    for (auto i = 0; i < 4; i++) {
+                        const auto w = _mm512_set1_epi32(load_group(Urows[i] + c));
+                        acc[i][0] = _mm512_dpbusd_epi32(acc[i][0], v0, w);
+                        acc[i][1] = _mm512_dpbusd_epi32(acc[i][1], v1, w);
+                    }
+                }
+
+                for (auto i = 0; i < 4 && k0 + i < K; i++) {
+                    const auto row = b * K + k0 + i;
+                    const auto offset = _mm512_set1_epi32(U.offsets[row]);
+                    const auto scale = _mm512_set1_ps(U.scales[row] * scales[b]);
+                    for (auto j = 0; j < 2; j++) {
+                        const auto p = p0 + j * 16;
+                        if (p >= BP) {
+                            break;
+                        }
+                        const auto mask = __mmask16(
+                            BP - p >= 16 ? 0xffff : (1u << (BP - p)) - 1);
+                        const auto out = _mm512_mul_ps(
+                            _mm512_cvtepi32_ps(
+                                _mm512_sub_epi32(acc[i][j], offset)),
+                            scale);
+                        _mm512_mask_storeu_ps(M + row * BP + p, mask, out);
+                    }
+                }
+            }
+        }
+    }
+}
+#endif
@@ -0,0 +1,98 @@
+/*
+    This file is part of Leela Zero.
+    Copyright (C) 2017-2018 Gian-Carlo Pascutto and contributors
+
+    Leela Zero is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Leela Zero is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Leela Zero.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef INT8_H_INCLUDED
+#define INT8_H_INCLUDED
+
+#include "config.h"
+
+#include <cstdint>
+#include <vector>
+
+#include "SIMD.h"
+
+// INT8 version of the Winograd domain multiplication M = U^T V. The
+// filters U are quantized per tile element and output channel. The input
+// tiles V are quantized per tile element with scales calibrated on sample
+// positions, and stored offset by 128 so they fit the unsigned operand of
+// the integer dot product instructions.
+namespace Int8 {
+    // The dot products consume groups of 4 channels, and the vector
+    // kernels cover 32 tiles (batch * P) per pass.
+    constexpr int get_padded_channels(const int C) {
+        return (C + 3) / 4 * 4;
+    }
+    constexpr int get_padded_tiles(const int BP) {
+        return (BP + 31) / 32 * 32;
+    }
+
+    struct Weights {
+        int tiles;
+        int channels;
+        int outputs;
+        // [tile][K][C_pad]
+        std::vector<std::int8_t> data;
+        // [tile][K], dequantization scale of each row
+        std::vector<float> scales;
+        // [tile][K], 128 times the sum of each row
+        std::vector<std::int32_t> offsets;
+    };
+
+    // U is laid out as [tile][C][K], like the FP32 filters.
+    Weights quantize_weights(const float* U, const int tiles,
+                             const int C, const int K);
+
+    // Quantizes V [tile][C][BP] to Vq [tile][C_pad / 4][BP_pad][4],
+    // with 1 / scales[tile] as multiplier. Padding holds quantized zeros.
+    using QuantizeInput = void (*)(const float* V, const int tiles,
+                                   const int C, const int BP,
+                                   const float* scales, std::uint8_t* Vq);
+    // Writes M [tile][K][BP] in FP32 from the quantized inputs.
+    using Gemm = void (*)(const Weights& U, const std::uint8_t* Vq,
+                          const float* scales, const int BP, float* M);
+
+    struct Kernels {
+        SIMD::Level level;
+        QuantizeInput quantize_input;
+        Gemm gemm;
+    };
+
+    // Kernels that run on this CPU, fastest first. The scalar kernels are
+    // always last.
+    std::vector<Kernels> get_available_kernels();
+
+    void quantize_input_scalar(const float* V, const int tiles,
+                               const int C, const int BP,
+                               const float* scales, std::uint8_t* Vq);
+    void gemm_scalar(const Weights& U, const std::uint8_t* Vq,
+                     const float* scales, const int BP, float* M);
+#ifdef SIMD_X86
+    void quantize_input_avx2(const float* V, const int tiles,
+                             const int C, const int BP,
+                             const float* scales, std::uint8_t* Vq);
+    void gemm_avx2(const Weights& U, const std::uint8_t* Vq,
+                   const float* scales, const int BP, float* M);
+    void quantize_input_avx512(const float* V, const int tiles,
+                               const int C, const int BP,
+                               const float* scales, std::uint8_t* Vq);
+    void gemm_avx512vnni(const Weights& U, const std::uint8_t* Vq,
+                         const float* scales, const int BP, float* M);
+#endif
+}
+
+#endif
@@ -45,6 +45,10 @@ bool KoState::superko(void) const {
     return (res != last);
 }
 
+const std::vector<std::uint64_t>& KoState::get_ko_hash_history() const {
+    return m_ko_hash_history;
+}
+
 void KoState::reset_game() {
     FastState::reset_game();
 
@@ -21,6 +21,7 @@
 
 #include "config.h"
 
+#include <cstdint>
 #include <vector>
 
 #include "FastState.h"
@@ -30,6 +31,8 @@ class KoState : public FastState {
 public:
     void init_game(int size, float komi);
     bool superko(void) const;
+    // Ko hashes of the positions of the game so far, the current one last.
+    const std::vector<std::uint64_t>& get_ko_hash_history() const;
     void reset_game();
 
     void play_move(int color, int vertex);
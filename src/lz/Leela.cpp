@@ -77,7 +77,36 @@ static void parse_commandline(int argc, char *argv[]) {
         ("seed,s", po::value<std::uint64_t>(),
                    "Random number generation seed.")
         ("dumbpass,d", "Don't use heuristics for smarter passing.")
+        ("graph", "Search a graph: transpositions of a position share\n"
+                  "their evaluation and search statistics.")
+        ("batchsize", po::value<int>()->default_value(cfg_batch_size),
+                      "Max positions evaluated together by the network.\n"
+                      "1 evaluates each position on its search thread.")
+        ("batchwait", po::value<int>()->default_value(cfg_batch_wait_us),
+                      "Max microseconds to wait for a batch to fill up.")
+        ("nnthreads", po::value<int>()->default_value(cfg_nn_threads),
+                      "Threads that split each network evaluation.\n"
+                      "0 picks one per core left over by the search threads.\n"
+                      "Ignored with --batchsize > 1.")
+        ("winograd", po::value<int>()->default_value(cfg_winograd_tile),
+                     "[2|4] Output tile size of the CPU Winograd convolution.\n"
+                     "4 needs fewer multiplications, 2 is more accurate.")
+        ("int8", "Run the CPU convolutions in INT8.")
+        ("calibration", po::value<std::string>(),
+                        "SGF file with positions to calibrate INT8 on.\n"
+                        "Default is games sampled from the network itself.")
+        ("weightformat", po::value<std::string>()->default_value("fp32"),
+                         "[fp32|fp16|bf16] Storage of the CPU convolution "
+                         "weights.\n16 bit formats halve the weight memory.")
         ("weights,w", po::value<std::string>(), "File with network weights.")
+        ("convert", po::value<std::string>(),
+                    "Write the weights to this binary file and exit.\n"
+                    "It loads faster and is shared between processes.")
+        ("cachefile", po::value<std::string>(),
+                      "File to keep network evaluations in across restarts.\n"
+                      "It can be shared by several processes.")
+        ("cachesymmetry", "Share cached network evaluations between mirrored\n"
+                          "and rotated positions.")
         ("logfile,l", po::value<std::string>(), "File to log input/output to.")
         ("quiet,q", "Disable all diagnostic output.")
         ("noponder", "Disable thinking on opponent's time.")
@@ -180,6 +209,49 @@ static void parse_commandline(int argc, char *argv[]) {
     }
     myprintf("Using %d thread(s).\n", cfg_num_threads);
 
+    cfg_winograd_tile = vm["winograd"].as<int>();
+    if (cfg_winograd_tile != 2 && cfg_winograd_tile != 4) {
+        printf("Invalid winograd value.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    if (vm.count("int8")) {
+        cfg_int8 = true;
+    }
+    if (vm.count("calibration")) {
+        cfg_int8_calibration = vm["calibration"].as<std::string>();
+    }
+
+    const auto weightformat = vm["weightformat"].as<std::string>();
+    if (weightformat == "fp32") {
+        cfg_weight_storage = Gemm::FP32;
+    } else if (weightformat == "fp16") {
+        cfg_weight_storage = Gemm::FP16;
+    } else if (weightformat == "bf16") {
+        cfg_weight_storage = Gemm::BF16;
+    } else {
+        printf("Invalid weightformat value.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    if (vm.count("convert")) {
+        const auto converted =
+            Network::convert_network(cfg_weightsfile,
+                                     vm["convert"].as<std::string>());
+        exit(converted ? EXIT_SUCCESS : EXIT_FAILURE);
+    }
+
+    if (vm.count("cachefile")) {
+        cfg_cache_file = vm["cachefile"].as<std::string>();
+    }
+    if (vm.count("cachesymmetry")) {
+        cfg_cache_symmetry = true;
+    }
+
+    cfg_batch_size = std::max(1, vm["batchsize"].as<int>());
+    cfg_batch_wait_us = std::max(0, vm["batchwait"].as<int>());
+    cfg_nn_threads = std::max(0, vm["nnthreads"].as<int>());
+
     if (vm.count("seed")) {
         cfg_rng_seed = vm["seed"].as<std::uint64_t>();
         if (cfg_num_threads > 1) {
@@ -201,6 +273,10 @@ static void parse_commandline(int argc, char *argv[]) {
         cfg_dumbpass = true;
     }
 
+    if (vm.count("graph")) {
+        cfg_search_graph = true;
+    }
+
     if (vm.count("playouts")) {
         cfg_max_playouts = vm["playouts"].as<int>();
         if (!vm.count("noponder")) {
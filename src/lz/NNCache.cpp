@@ -17,13 +17,60 @@
 */
 
 #include "config.h"
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <fstream>
 #include <functional>
+#include <iterator>
+#include <random>
+#include <thread>
+#include <vector>
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+#include <boost/interprocess/sync/file_lock.hpp>
+#include <boost/interprocess/sync/scoped_lock.hpp>
 
 #include "NNCache.h"
 #include "Utils.h"
 #include "UCTSearch.h"
 
-NNCache::NNCache(int size) : m_size(size) {}
+constexpr size_t NNCache::WAYS;
+constexpr size_t NNCache::MAX_BYTES;
+constexpr size_t NNCache::RECORD_BYTES;
+constexpr size_t NNCache::RECORD_WORDS;
+
+// Probabilities are coded as a tiny float with 4 exponent and 4 mantissa
+// bits covering [2^-16, 1], which is logarithmic to within 3% relative
+// error. Code 0 is reserved for zero; smaller values round to it.
+static constexpr auto POLICY_CODE_BIAS = (127u << 4) - 255u;
+
+static std::uint8_t encode_probability(const float p) {
+    if (!(p > 0.0f)) {
+        return 0;
+    }
+    auto bits = std::uint32_t{};
+    std::memcpy(&bits, &p, sizeof(bits));
+    // Round to the nearest code in the mantissa.
+    const auto code = int((bits + (1u << 18)) >> 19) - int(POLICY_CODE_BIAS);
+    return std::uint8_t(std::max(0, std::min(255, code)));
+}
+
+static const std::array<float, 256> probability_table = [] {
+    auto table = std::array<float, 256>{};
+    for (auto code = 1u; code < table.size(); code++) {
+        const auto bits = std::uint32_t((code + POLICY_CODE_BIAS) << 19);
+        std::memcpy(&table[code], &bits, sizeof(bits));
+    }
+    return table;
+}();
+
+NNCache::NNCache(size_t bytes) {
+    resize(bytes);
+}
 
 NNCache& NNCache::get_NNCache(void) {
     static NNCache cache;
@@ -31,65 +78,299 @@ NNCache& NNCache::get_NNCache(void) {
 }
 
 bool NNCache::lookup(std::uint64_t hash, Network::Netresult & result) {
-    std::lock_guard<std::mutex> lock(m_mutex);
-    ++m_lookups;
+    m_lookups.fetch_add(1, std::memory_order_relaxed);
 
-    auto iter = m_cache.find(hash);
-    if (iter == m_cache.end()) {
-        return false;  // Not found.
-    }
+    const auto key = hash ^ m_key_salt;
+    auto set = &m_slots[(key % m_sets) * WAYS];
+    for (auto way = size_t{0}; way < WAYS; way++) {
+        auto& slot = set[way];
+        const auto seq = slot.seq.load(std::memory_order_acquire);
+        if (seq == 0 || (seq & 1)
+            || slot.key.load(std::memory_order_relaxed) != key) {
+            continue;
+        }
+        std::uint64_t words[RECORD_WORDS];
+        for (auto i = size_t{0}; i < RECORD_WORDS; i++) {
+            words[i] = slot.data[i].load(std::memory_order_relaxed);
+        }
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (slot.seq.load(std::memory_order_relaxed) != seq) {
+            continue;  // Overwritten while copying.
+        }
 
-    const auto& entry = iter->second;
+        std::uint8_t record[RECORD_WORDS * 8];
+        std::memcpy(record, words, sizeof(record));
+        for (auto i = size_t{0}; i < BOARD_SQUARES; i++) {
+            result.policy[i] = probability_table[record[i]];
+        }
+        result.policy_pass = probability_table[record[BOARD_SQUARES]];
+        auto winrate = std::uint16_t{};
+        std::memcpy(&winrate, &record[BOARD_SQUARES + 1], sizeof(winrate));
+        result.winrate = winrate / 65535.0f;
 
-    // Found it.
-    ++m_hits;
-    result = entry->result;
-    return true;
+        // Avoid dirtying the cache line if the bit is already set.
+        if (!slot.referenced.load(std::memory_order_relaxed)) {
+            slot.referenced.store(1, std::memory_order_relaxed);
+        }
+        m_hits.fetch_add(1, std::memory_order_relaxed);
+        return true;
+    }
+    return false;  // Not found.
 }
 
 void NNCache::insert(std::uint64_t hash,
                      const Network::Netresult& result) {
-    std::lock_guard<std::mutex> lock(m_mutex);
+    const auto key = hash ^ m_key_salt;
+    auto set = &m_slots[(key % m_sets) * WAYS];
+    for (auto way = size_t{0}; way < WAYS; way++) {
+        if (set[way].seq.load(std::memory_order_relaxed) != 0
+            && set[way].key.load(std::memory_order_relaxed) == key) {
+            return;  // Already in the cache.
+        }
+    }
+
+    // Pick an empty slot or else the first one without its second chance
+    // bit, clearing the bits on the way. The hand starts at a different
+    // way every time so that no way is favored.
+    thread_local auto hand = size_t{0};
+    hand++;
+    auto victim = &set[hand % WAYS];
+    for (auto step = size_t{0}; step < 2 * WAYS; step++) {
+        auto& slot = set[(hand + step) % WAYS];
+        if (slot.seq.load(std::memory_order_relaxed) == 0
+            || !slot.referenced.load(std::memory_order_relaxed)) {
+            victim = &slot;
+            break;
+        }
+        slot.referenced.store(0, std::memory_order_relaxed);
+    }
+
+    std::uint8_t record[RECORD_WORDS * 8] = {};
+    for (auto i = size_t{0}; i < BOARD_SQUARES; i++) {
+        record[i] = encode_probability(result.policy[i]);
+    }
+    record[BOARD_SQUARES] = encode_probability(result.policy_pass);
+    const auto winrate = std::uint16_t(
+        std::lround(std::max(0.0f, std::min(1.0f, result.winrate)) * 65535.0f));
+    std::memcpy(&record[BOARD_SQUARES + 1], &winrate, sizeof(winrate));
+    std::uint64_t words[RECORD_WORDS];
+    std::memcpy(words, record, sizeof(words));
 
-    if (m_cache.find(hash) != m_cache.end()) {
-        return;  // Already in the cache.
+    // Claim the slot. If another thread is writing it, just drop this
+    // result: it is only a cache.
+    auto seq = victim->seq.load(std::memory_order_relaxed);
+    if ((seq & 1)
+        || !victim->seq.compare_exchange_strong(seq, seq + 1,
+                                                std::memory_order_acquire)) {
+        return;
     }
+    std::atomic_thread_fence(std::memory_order_release);
 
-    m_cache.emplace(hash, std::make_unique<Entry>(result));
-    m_order.push_back(hash);
-    ++m_inserts;
+    victim->key.store(key, std::memory_order_relaxed);
+    for (auto i = size_t{0}; i < RECORD_WORDS; i++) {
+        victim->data[i].store(words[i], std::memory_order_relaxed);
+    }
+    victim->referenced.store(1, std::memory_order_relaxed);
+    victim->seq.store(seq + 2, std::memory_order_release);
 
-    // If the cache is too large, remove the oldest entry.
-    if (m_order.size() > m_size) {
-        m_cache.erase(m_order.front());
-        m_order.pop_front();
+    m_inserts.fetch_add(1, std::memory_order_relaxed);
+    if (seq == 0) {
+        m_used.fetch_add(1, std::memory_order_relaxed);
     }
 }
 
-void NNCache::resize(int size) {
-    m_size = size;
-    while (m_order.size() > m_size) {
-        m_cache.erase(m_order.front());
-        m_order.pop_front();
+void NNCache::resize(size_t bytes) {
+    const auto sets = std::max(size_t{1}, bytes / (WAYS * sizeof(Slot)));
+    if (m_slots && sets == m_sets) {
+        return;
+    }
+
+    m_storage.reset();
+    m_slots = nullptr;
+    auto slots = static_cast<Slot*>(std::calloc(sets * WAYS, sizeof(Slot)));
+    if (slots == nullptr) {
+        throw std::bad_alloc();
+    }
+    m_storage.reset(slots, std::free);
+    m_slots = slots;
+    m_sets = sets;
+    m_used = 0;
+}
+
+// Layout of the cache file: this header padded to FILE_HEADER_BYTES,
+// then the slots. A file from another build is recreated.
+struct NNCacheFileHeader {
+    char magic[4];
+    std::uint32_t version;
+    std::uint32_t slot_bytes;
+    std::uint32_t ways;
+    std::uint64_t sets;
+};
+static constexpr char FILE_MAGIC[] = {'L', 'Z', 'N', 'C'};
+static constexpr auto FILE_VERSION = std::uint32_t{2};
+static constexpr auto FILE_HEADER_BYTES = size_t{64};
+
+// The splitmix64 finalizer. Network hashes of different precisions only
+// differ in their low bits, the salts mixed from them share no structure.
+static std::uint64_t mix_salt(std::uint64_t z) {
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111eb;
+    return z ^ (z >> 31);
+}
+
+bool NNCache::attach_file(const std::string& filename,
+                          std::uint64_t network_hash) {
+    namespace bip = boost::interprocess;
+    try {
+        // Make sure the file exists so that it can be locked, the lock
+        // keeps two processes from creating it at the same time.
+        std::ofstream{filename, std::ios::binary | std::ios::app};
+        auto file_lock = bip::file_lock{filename.c_str()};
+        auto guard = bip::scoped_lock<bip::file_lock>{file_lock};
+
+        auto header = NNCacheFileHeader{};
+        auto file = std::ifstream{filename, std::ios::binary | std::ios::ate};
+        const auto file_size = size_t(file.tellg());
+        file.seekg(0);
+        const auto valid = file.read(reinterpret_cast<char*>(&header),
+                                     sizeof(header))
+            && std::equal(std::begin(FILE_MAGIC), std::end(FILE_MAGIC),
+                          header.magic)
+            && header.version == FILE_VERSION
+            && header.slot_bytes == sizeof(Slot)
+            && header.ways == WAYS
+            && header.sets > 0
+            && file_size == FILE_HEADER_BYTES
+                            + header.sets * WAYS * sizeof(Slot);
+        file.close();
+
+        if (!valid) {
+            std::copy(std::begin(FILE_MAGIC), std::end(FILE_MAGIC),
+                      header.magic);
+            header.version = FILE_VERSION;
+            header.slot_bytes = sizeof(Slot);
+            header.ways = WAYS;
+            header.sets = m_sets;
+            // Truncating and then extending leaves all slots zero, that
+            // is empty.
+            auto out = std::ofstream{filename,
+                                     std::ios::binary | std::ios::trunc};
+            out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+            out.seekp(FILE_HEADER_BYTES + m_sets * WAYS * sizeof(Slot) - 1);
+            out.put(0);
+            if (!out) {
+                Utils::myprintf("Could not create cache file: %s\n",
+                                filename.c_str());
+                return false;
+            }
+        }
+
+        const auto mapping = bip::file_mapping{filename.c_str(),
+                                               bip::read_write};
+        auto region = std::make_shared<bip::mapped_region>(mapping,
+                                                           bip::read_write);
+        m_slots = reinterpret_cast<Slot*>(
+            static_cast<char*>(region->get_address()) + FILE_HEADER_BYTES);
+        m_storage = region;
+        m_sets = header.sets;
+        m_key_salt = mix_salt(network_hash);
+        m_used = 0;
+        Utils::myprintf("NNCache: %s file %s, %zu entries\n",
+                        valid ? "using" : "created", filename.c_str(),
+                        m_sets * WAYS);
+        return true;
+    } catch (const bip::interprocess_exception&) {
+        Utils::myprintf("Could not map cache file: %s\n", filename.c_str());
+        return false;
     }
 }
 
 void NNCache::set_size_from_playouts(int max_playouts) {
     // cache hits are generally from last several moves so setting cache
     // size based on playouts increases the hit rate while balancing memory
-    // usage for low playout instances. 150'000 cache entries is ~225 MB
+    // usage for low playout instances. 225 MB holds ~600'000 entries.
     constexpr auto num_cache_moves = 3;
     auto max_playouts_per_move =
         std::min(max_playouts,
                  UCTSearch::UNLIMITED_PLAYOUTS / num_cache_moves);
     auto max_size = num_cache_moves * max_playouts_per_move;
-    max_size = std::min(150'000, std::max(6'000, max_size));
-    NNCache::get_NNCache().resize(max_size);
+    max_size = std::max(6'000, max_size);
+    NNCache::get_NNCache().resize(std::min(MAX_BYTES,
+                                           max_size * sizeof(Slot)));
 }
 
 void NNCache::dump_stats() {
     Utils::myprintf(
-        "NNCache: %d/%d hits/lookups = %.1f%% hitrate, %d inserts, %u size\n",
-        m_hits, m_lookups, 100. * m_hits / (m_lookups + 1),
-        m_inserts, m_cache.size());
+        "NNCache: %d/%d hits/lookups = %.1f%% hitrate, %d inserts, %d size\n",
+        m_hits.load(), m_lookups.load(),
+        100. * m_hits.load() / (m_lookups.load() + 1),
+        m_inserts.load(), m_used.load());
+}
+
+void NNCache::benchmark(int threads) {
+    // Twice as many positions as fit, so that lookups both hit and miss
+    // and inserts keep evicting.
+    NNCache cache(size_t{32} * 1024 * 1024);
+    const auto capacity = cache.m_sets * WAYS;
+    const auto positions = 2 * capacity;
+    const auto ops_per_thread = size_t{200000};
+    const auto sample_every = size_t{16};
+
+    auto hashes = std::vector<std::uint64_t>(positions);
+    auto rng = std::mt19937_64{5489};
+    for (auto& hash : hashes) {
+        hash = rng();
+    }
+    auto result = Network::Netresult{};
+    for (auto i = size_t{0}; i < capacity; i++) {
+        cache.insert(hashes[i], result);
+    }
+
+    auto latencies = std::vector<std::vector<float>>(threads);
+    auto workers = std::vector<std::thread>{};
+    const auto start = std::chrono::steady_clock::now();
+    for (auto t = 0; t < threads; t++) {
+        workers.emplace_back([&, t]() {
+            auto rng = std::mt19937_64{std::uint64_t(t)};
+            auto result = Network::Netresult{};
+            auto& samples = latencies[t];
+            samples.reserve(ops_per_thread / sample_every);
+            for (auto i = size_t{0}; i < ops_per_thread; i++) {
+                const auto hash = hashes[rng() % positions];
+                if (i % sample_every == 0) {
+                    const auto begin = std::chrono::steady_clock::now();
+                    const auto hit = cache.lookup(hash, result);
+                    const auto end = std::chrono::steady_clock::now();
+                    samples.emplace_back(
+                        std::chrono::duration<float, std::nano>(end - begin).count());
+                    if (!hit) {
+                        cache.insert(hash, result);
+                    }
+                } else if (!cache.lookup(hash, result)) {
+                    cache.insert(hash, result);
+                }
+            }
+        });
+    }
+    for (auto& worker : workers) {
+        worker.join();
+    }
+    const auto elapsed = std::chrono::duration<double>(
+        std::chrono::steady_clock::now() - start).count();
+
+    auto all = std::vector<float>{};
+    for (const auto& samples : latencies) {
+        all.insert(end(all), begin(samples), end(samples));
+    }
+    std::sort(begin(all), end(all));
+    const auto percentile = [&all](const double p) {
+        return all[std::min(all.size() - 1, size_t(p * all.size()))];
+    };
+
+    const auto ops = double(ops_per_thread) * threads;
+    Utils::myprintf("NNCache %d threads: %.2f M ops/s, lookup latency "
+                    "p50 %.0f ns, p99 %.0f ns, p99.9 %.0f ns, hitrate %.1f%%\n",
+                    threads, ops / elapsed / 1e6,
+                    percentile(0.5), percentile(0.99), percentile(0.999),
+                    100. * cache.m_hits.load() / cache.m_lookups.load());
 }
@@ -21,22 +21,48 @@
 
 #include "config.h"
 
-#include <deque>
-#include <mutex>
-#include <unordered_map>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <memory>
+#include <string>
 
 #include "Network.h"
 
+// Fixed-size, set associative cache of network results. Each hash maps
+// to one set of WAYS slots. Slots are version stamped (a seqlock): a
+// writer claims a slot by making its sequence number odd, readers copy
+// the slot and retry elsewhere if the number changed under them. Victims
+// within a set are chosen by second chance (clock) replacement. Lookups
+// and inserts take no locks and never allocate. Results are stored
+// compactly: probabilities as 8-bit logarithmic codes, the winrate as
+// 16-bit fixed point.
+//
+// The slots can live in a memory mapped file instead, which keeps them
+// across restarts and shares them between processes on the same host.
 class NNCache {
 public:
+    static constexpr auto MAX_BYTES = size_t{225} * 1024 * 1024;
+
+    // Private caches are only used by the benchmark and the tests.
+    NNCache(size_t bytes = MAX_BYTES);  // ~ 600k entries
+
     // return the global NNCache
     static NNCache& get_NNCache(void);
 
     // Set a reasonable size gives max number of playouts
     void set_size_from_playouts(int max_playouts);
 
-    // Resize NNCache
-    void resize(int size);
+    // Resize NNCache to use at most this many bytes. Not safe to call
+    // while other threads use the cache.
+    void resize(size_t bytes);
+
+    // Move the cache into a file shared with other processes, creating
+    // it with the current size if needed. Positions are keyed together
+    // with network_hash so that results of other networks are ignored.
+    // Returns false and keeps the in-memory cache on failure.
+    bool attach_file(const std::string& filename, std::uint64_t network_hash);
 
     // Try and find an existing entry.
     bool lookup(std::uint64_t hash, Network::Netresult & result);
@@ -47,33 +73,44 @@ public:
 
     // Return the hit rate ratio.
     std::pair<int, int> hit_rate() const {
-        return {m_hits, m_lookups};
+        return {m_hits.load(), m_lookups.load()};
     }
 
     void dump_stats();
 
-private:
-    NNCache(int size = 150000);  // ~ 225MB
+    // Measure lookup latency with many threads hammering a private cache.
+    static void benchmark(int threads);
 
-    std::mutex m_mutex;
+private:
+    static constexpr auto WAYS = size_t{8};
+
+    // Policy codes for the board points and pass, then the winrate.
+    static constexpr auto RECORD_BYTES = size_t{BOARD_SQUARES + 1 + 2};
+    static constexpr auto RECORD_WORDS = (RECORD_BYTES + 7) / 8;
+
+    struct Slot {
+        // 0: never written, odd: being written
+        std::atomic<std::uint32_t> seq;
+        // Second chance bit for the clock replacement.
+        std::atomic<std::uint8_t> referenced;
+        std::atomic<std::uint64_t> key;
+        // Packed record, 384 bytes per slot in total
+        std::atomic<std::uint64_t> data[RECORD_WORDS];
+    };
 
-    size_t m_size;
+    // Either calloc'd memory, so that slots which are never used cost no
+    // memory, or the mapping of the cache file.
+    std::shared_ptr<void> m_storage;
+    Slot* m_slots{nullptr};
+    size_t m_sets{0};
+    // Mixed into every key, see attach_file.
+    std::uint64_t m_key_salt{0};
 
     // Statistics
-    int m_hits{0};
-    int m_lookups{0};
-    int m_inserts{0};
-
-    struct Entry {
-        Entry(const Network::Netresult& r)
-            : result(r) {}
-        Network::Netresult result;  // ~ 1.5KB
-    };
-
-    // Map from hash to {features, result}
-    std::unordered_map<std::uint64_t, std::unique_ptr<const Entry>> m_cache;
-    // Order entries were added to the map.
-    std::deque<size_t> m_order;
+    std::atomic<int> m_hits{0};
+    std::atomic<int> m_lookups{0};
+    std::atomic<int> m_inserts{0};
+    std::atomic<int> m_used{0};
 };
 
 #endif
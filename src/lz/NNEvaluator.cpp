@@ -0,0 +1,170 @@
+/*
+    This file is part of Leela Zero.
+    Copyright (C) 2017-2018 Gian-Carlo Pascutto and contributors
+
+    Leela Zero is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Leela Zero is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Leela Zero.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "config.h"
+
+#include <algorithm>
+#include <exception>
+#include <utility>
+#include <vector>
+
+#include "NNEvaluator.h"
+#include "GTP.h"
+#include "SMP.h"
+#include "Utils.h"
+
+using namespace Utils;
+
+NNEvaluator& NNEvaluator::get_NNEvaluator(void) {
+    static NNEvaluator evaluator;
+    return evaluator;
+}
+
+NNEvaluator::~NNEvaluator() {
+    stop();
+}
+
+void NNEvaluator::stop() {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_exit = true;
+    }
+    m_condvar.notify_all();
+    for (auto& thread : m_threads) {
+        thread.join();
+    }
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_threads.clear();
+    m_exit = false;
+}
+
+Network::Netresult NNEvaluator::evaluate(Network::NNPlanes&& planes,
+                                         const int symmetry) {
+    auto request = Request{std::move(planes), symmetry, Clock::now(), {}};
+    auto result = request.result.get_future();
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_threads.empty()) {
+            for (auto i = 0; i < thread_count(); i++) {
+                m_threads.emplace_back(&NNEvaluator::worker, this);
+            }
+        }
+        m_queue.emplace_back(std::move(request));
+    }
+    m_condvar.notify_one();
+    return result.get();
+}
+
+int NNEvaluator::thread_count() const {
+    // One evaluator thread for every batch the search threads can fill,
+    // but no more than there are cores.
+    const auto batch_size = std::max(1, cfg_batch_size);
+    const auto batches = (cfg_num_threads + batch_size - 1) / batch_size;
+    return std::max(1, std::min(batches, SMP::get_num_cpus()));
+}
+
+size_t NNEvaluator::flush_size() const {
+    // There are never more requests in flight than search threads, and
+    // they are shared by the evaluator threads, so don't wait for a batch
+    // that can't fill up.
+    const auto in_flight = cfg_num_threads / int(m_threads.size());
+    return size_t(std::max(1, std::min(cfg_batch_size, in_flight)));
+}
+
+void NNEvaluator::worker() {
+    for (;;) {
+        auto batch = std::vector<Request>{};
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_condvar.wait(lock, [this]{ return m_exit || !m_queue.empty(); });
+            if (m_exit && m_queue.empty()) {
+                return;
+            }
+            const auto deadline = m_queue.front().submitted
+                + std::chrono::microseconds(cfg_batch_wait_us);
+            m_condvar.wait_until(lock, deadline, [this]{
+                return m_exit || m_queue.size() >= flush_size();
+            });
+
+            const auto count = std::min(m_queue.size(),
+                                        size_t(std::max(1, cfg_batch_size)));
+            for (auto i = size_t{0}; i < count; i++) {
+                batch.emplace_back(std::move(m_queue.front()));
+                m_queue.pop_front();
+            }
+        }
+        // Another evaluator thread can take the requests while this one
+        // waits for its batch to fill up.
+        if (batch.empty()) {
+            continue;
+        }
+
+        auto planes = std::vector<Network::NNPlanes>{};
+        auto symmetries = std::vector<int>{};
+        planes.reserve(batch.size());
+        symmetries.reserve(batch.size());
+        for (auto& request : batch) {
+            planes.emplace_back(std::move(request.planes));
+            symmetries.emplace_back(request.symmetry);
+        }
+
+        try {
+            auto results = Network::get_scored_moves_internal(planes,
+                                                              symmetries);
+            const auto done = Clock::now();
+            for (auto i = size_t{0}; i < batch.size(); i++) {
+                const auto latency =
+                    std::chrono::duration_cast<std::chrono::microseconds>(
+                        done - batch[i].submitted).count();
+                m_latency_us += latency;
+                auto max_latency = m_max_latency_us.load();
+                while (latency > max_latency
+                       && !m_max_latency_us.compare_exchange_weak(max_latency,
+                                                                  latency)) {}
+                batch[i].result.set_value(std::move(results[i]));
+            }
+        } catch (...) {
+            for (auto& request : batch) {
+                request.result.set_exception(std::current_exception());
+            }
+        }
+        m_batches++;
+        m_evals += batch.size();
+    }
+}
+
+void NNEvaluator::reset_stats() {
+    m_batches = 0;
+    m_evals = 0;
+    m_latency_us = 0;
+    m_max_latency_us = 0;
+}
+
+void NNEvaluator::dump_stats() {
+    const auto batches = m_batches.load();
+    const auto evals = m_evals.load();
+    if (batches == 0) {
+        return;
+    }
+    myprintf("NNEvaluator: %lld evals in %lld batches, "
+             "avg batch %.2f, avg latency %lld us, max latency %lld us\n",
+             static_cast<long long>(evals), static_cast<long long>(batches),
+             double(evals) / batches,
+             static_cast<long long>(m_latency_us.load() / evals),
+             static_cast<long long>(m_max_latency_us.load()));
+}
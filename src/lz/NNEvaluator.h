@@ -0,0 +1,89 @@
+/*
+    This file is part of Leela Zero.
+    Copyright (C) 2017-2018 Gian-Carlo Pascutto and contributors
+
+    Leela Zero is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Leela Zero is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Leela Zero.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef NNEVALUATOR_H_INCLUDED
+#define NNEVALUATOR_H_INCLUDED
+
+#include "config.h"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <future>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "Network.h"
+
+// Collects evaluation requests from the search threads and runs them
+// through the network in batches. A batch is flushed as soon as it is
+// full or the oldest request has waited cfg_batch_wait_us microseconds.
+// Several evaluator threads take batches from the same queue, so the
+// batches of many search threads run on as many cores.
+class NNEvaluator {
+public:
+    // return the global NNEvaluator
+    static NNEvaluator& get_NNEvaluator(void);
+
+    // Queue a position and block until its batch has been evaluated.
+    Network::Netresult evaluate(Network::NNPlanes&& planes,
+                                const int symmetry);
+
+    // Stop the evaluator threads, they are restarted with the current
+    // settings by the next request. No requests may be in flight.
+    void stop();
+
+    // Start counting the batches of a new search.
+    void reset_stats();
+    void dump_stats();
+
+    ~NNEvaluator();
+
+private:
+    NNEvaluator() = default;
+
+    using Clock = std::chrono::steady_clock;
+
+    struct Request {
+        Network::NNPlanes planes;
+        int symmetry;
+        Clock::time_point submitted;
+        std::promise<Network::Netresult> result;
+    };
+
+    void worker();
+    int thread_count() const;
+    size_t flush_size() const;
+
+    std::mutex m_mutex;
+    std::condition_variable m_condvar;
+    std::deque<Request> m_queue;
+    std::vector<std::thread> m_threads;
+    bool m_exit{false};
+
+    // Statistics
+    std::atomic<std::int64_t> m_batches{0};
+    std::atomic<std::int64_t> m_evals{0};
+    std::atomic<std::int64_t> m_latency_us{0};
+    std::atomic<std::int64_t> m_max_latency_us{0};
+};
+
+#endif
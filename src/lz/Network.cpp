@@ -24,13 +24,20 @@
 #include <array>
 #include <cassert>
 #include <cmath>
+#include <cstring>
+#include <fstream>
 #include <iterator>
 #include <memory>
+#include <numeric>
+#include <random>
 #include <sstream>
 #include <string>
+#include <thread>
+#include <utility>
 #include <boost/utility.hpp>
 #include <boost/format.hpp>
-#include <boost/spirit/home/x3.hpp>
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
 
 #ifdef __APPLE__
 #include <Accelerate/Accelerate.h>
@@ -51,15 +58,22 @@
 #include "FastState.h"
 #include "FullBoard.h"
 #include "GameState.h"
+#include "Gemm.h"
+#include "Heads.h"
 #include "GTP.h"
 #include "Im2Col.h"
+#include "Int8.h"
 #include "NNCache.h"
+#include "NNEvaluator.h"
+#include "PlayoutState.h"
 #include "Random.h"
+#include "SGFParser.h"
+#include "SGFTree.h"
 #include "ThreadPool.h"
 #include "Timing.h"
 #include "Utils.h"
+#include "Winograd.h"
 
-namespace x3 = boost::spirit::x3;
 using namespace Utils;
 
 // Input + residual block tower
@@ -67,6 +81,81 @@ static std::vector<std::vector<float>> conv_weights;
 static std::vector<std::vector<float>> conv_biases;
 static std::vector<std::vector<float>> batchnorm_means;
 static std::vector<std::vector<float>> batchnorm_stddivs;
+// Winograd transformed filters of the tower, in conv_weights or in the
+// mapped binary weights file
+static std::vector<const float*> winograd_filters;
+// The same filters packed in FP32 panels for the Gemm kernels, only when
+// mapped from a binary weights file
+static std::vector<const float*> winograd_panels;
+static boost::interprocess::mapped_region weights_region;
+
+// Identifies the network contents for the shared NNCache file, from the
+// header of binary weights
+static std::uint64_t network_hash = 0;
+
+static std::uint64_t hash_bytes(const char* data, const size_t size) {
+    // FNV-1a over 64-bit words, then a final avalanche.
+    auto hash = std::uint64_t{0xcbf29ce484222325};
+    auto i = size_t{0};
+    for (; i + sizeof(std::uint64_t) <= size; i += sizeof(std::uint64_t)) {
+        auto word = std::uint64_t{};
+        std::memcpy(&word, data + i, sizeof(word));
+        hash = (hash ^ word) * 0x100000001b3;
+    }
+    for (; i < size; i++) {
+        hash = (hash ^ static_cast<unsigned char>(data[i])) * 0x100000001b3;
+    }
+    hash ^= hash >> 33;
+    hash *= 0xff51afd7ed558ccd;
+    hash ^= hash >> 33;
+    hash *= 0xc4ceb9fe1a85ec53;
+    hash ^= hash >> 33;
+    return hash;
+}
+
+// Hash of the text weights a network was loaded from, or of the text
+// weights binary weights were converted from. Text weights are read
+// again, only when the hash is needed.
+static std::uint64_t get_network_hash(const std::string& filename) {
+    if (weights_region.get_address() != nullptr) {
+        return network_hash;
+    }
+    auto gzhandle = gzopen(filename.c_str(), "rb");
+    if (gzhandle == nullptr) {
+        return 0;
+    }
+    constexpr auto chunkBufferSize = 1024 * 1024;
+    auto text = std::vector<char>{};
+    for (;;) {
+        const auto size = text.size();
+        text.resize(size + chunkBufferSize);
+        const auto bytesRead = gzread(gzhandle, text.data() + size,
+                                      chunkBufferSize);
+        text.resize(size + std::max(0, bytesRead));
+        if (bytesRead <= 0) break;
+    }
+    gzclose(gzhandle);
+    return hash_bytes(text.data(), text.size());
+}
+
+// Binary weights file: a header, then every array as a 64 bit length and
+// the values, each aligned so the filters can be used in place. Every
+// filter is followed by its Gemm panels, only the pages of the layout in
+// use are read. The header keeps the hash of the text weights, so the
+// file is never read as a whole.
+static constexpr char BINARY_MAGIC[] = {'L', 'Z', 'W', 'B'};
+static constexpr auto BINARY_VERSION = std::uint32_t{3};
+static constexpr auto BINARY_ALIGNMENT = size_t{64};
+
+struct BinaryHeader {
+    char magic[4];
+    std::uint32_t version;
+    std::uint32_t channels;
+    std::uint32_t residual_blocks;
+    std::uint32_t value_head_not_stm;
+    std::uint32_t winograd_m;
+    std::uint64_t network_hash;
+};
 
 // Policy head
 static std::vector<float> conv_pol_w;
@@ -92,52 +181,209 @@ static bool value_head_not_stm;
 
 // Symmetry helper
 static std::array<std::array<int, BOARD_SQUARES>, 8> symmetry_nn_idx_table;
+// The board vertex each input square is read from, per symmetry
+static std::array<std::array<int, BOARD_SQUARES>, 8> symmetry_vertex_table;
+
+struct Network::Workspace {
+    std::vector<net_t> input;
+    std::vector<float> policy_data;
+    std::vector<float> value_data;
+    std::vector<float> policy_out;
+    std::vector<float> winrate_data;
+    std::vector<float> winrate_out;
+#ifdef USE_BLAS
+    std::vector<float> conv_out;
+    std::vector<float> V;
+    std::vector<float> M;
+    std::vector<std::uint8_t> Vq;
+#endif
+};
+
+// Winograd variant F(m x m, 3x3) and transforms for the CPU forward
+// pass, picked at startup
+static int winograd_m = 2;
+static Winograd::Kernels winograd_kernels = {
+    SIMD::SCALAR, Winograd::transform_in_scalar, Winograd::transform_out_scalar
+};
+
+// INT8 Winograd multiplication, see initialize_int8()
+static constexpr auto CALIBRATION_POSITIONS = size_t{128};
+static bool int8_enabled = false;
+static bool int8_calibrating = false;
+static std::vector<Int8::Weights> int8_weights;
+// Per convolution and tile element, the largest input seen during
+// calibration and then the quantization scale
+static std::vector<std::vector<float>> int8_input_scales;
+static Int8::Kernels int8_kernels = {
+    SIMD::SCALAR, Int8::quantize_input_scalar, Int8::gemm_scalar
+};
+
+// Packed copies of winograd_filters, which are dropped when these are
+// used, or the mapped winograd_panels
+static std::vector<Gemm::Weights> packed_weights;
+static Gemm::Kernels gemm_kernels = {SIMD::SCALAR, Gemm::multiply_scalar};
+// 1x1 convolutions of the policy and value heads with their batchnorm
+static Heads::Weights head_weights;
+static Heads::Kernels head_kernels = {
+    SIMD::SCALAR, Heads::convolve_scalar, Heads::softmax_scalar
+};
+
+// In latency mode every search thread can take one of these groups to
+// split its evaluations across evaluation_threads threads. There are no
+// groups in throughput mode, where each evaluation runs on its caller.
+static std::vector<std::unique_ptr<SMP::WorkerGroup>> worker_groups;
+static int evaluation_groups = 0;
+static int evaluation_threads = 1;
+
+static void set_evaluation_threads(const int groups, const int threads) {
+    worker_groups.clear();
+    evaluation_groups = groups;
+    evaluation_threads = threads;
+    if (threads > 1) {
+        for (auto i = 0; i < groups; i++) {
+            worker_groups.emplace_back(
+                std::make_unique<SMP::WorkerGroup>(threads - 1));
+        }
+    }
+}
 
-void Network::benchmark(const GameState* const state, const int iterations) {
-    const auto cpus = cfg_num_threads;
+// Evaluates the position from all search threads, returns the number
+// of evaluations and the seconds they took.
+static std::pair<int, double> run_search_threads(const GameState* const state,
+                                                 const int iterations) {
     const Time start;
 
     ThreadGroup tg(thread_pool);
     std::atomic<int> runcount{0};
 
-    for (auto i = 0; i < cpus; i++) {
+    for (auto i = 0; i < cfg_num_threads; i++) {
         tg.add_task([&runcount, iterations, state]() {
             while (runcount < iterations) {
                 runcount++;
-                get_scored_moves(state, Ensemble::RANDOM_SYMMETRY, -1, true);
+                Network::get_scored_moves(state,
+                                          Network::Ensemble::RANDOM_SYMMETRY,
+                                          -1, true);
             }
         });
     }
     tg.wait_all();
 
     const Time end;
-    const auto elapsed = Time::timediff_seconds(start, end);
+    return {runcount.load(), Time::timediff_seconds(start, end)};
+}
+
+void Network::benchmark(const GameState* const state, const int iterations) {
+    NNEvaluator::get_NNEvaluator().reset_stats();
+    const auto run = run_search_threads(state, iterations);
     myprintf("%5d evaluations in %5.2f seconds -> %d n/s\n",
-             runcount.load(), elapsed, int(runcount.load() / elapsed));
+             run.first, run.second, int(run.first / run.second));
+    NNEvaluator::get_NNEvaluator().dump_stats();
+    benchmark_evaluator(state, iterations);
+
+    // Once the buffers of this thread have grown, evaluating a position
+    // shouldn't touch the heap.
+    const auto playout = PlayoutState{*state};
+    get_scored_moves_internal(&playout, 0);
+    const auto allocations = Utils::get_thread_allocations();
+    constexpr auto ALLOCATION_RUNS = 64;
+    for (auto i = 0; i < ALLOCATION_RUNS; i++) {
+        get_scored_moves_internal(&playout, i % 8);
+    }
+    myprintf("%.2f heap allocations per evaluation\n",
+             double(Utils::get_thread_allocations() - allocations)
+             / ALLOCATION_RUNS);
+
+#if defined(USE_BLAS) && !defined(USE_OPENCL)
+    benchmark_batch(state, iterations);
+    benchmark_winograd(iterations);
+    benchmark_gemm(iterations);
+    benchmark_gemm_shapes(iterations);
+    benchmark_heads(iterations);
+    benchmark_latency(state, iterations);
+#endif
 }
 
-void Network::process_bn_var(std::vector<float>& weights, const float epsilon) {
-    for (auto&& w : weights) {
-        w = 1.0f / std::sqrt(w + epsilon);
+void Network::benchmark_evaluator(const GameState* const state,
+                                  const int iterations) {
+    // The same search threads, with their requests batched by the
+    // evaluator threads. Throughput should grow with the batch size as
+    // long as there are cores for the evaluator threads.
+    auto& evaluator = NNEvaluator::get_NNEvaluator();
+    const auto batch_size = cfg_batch_size;
+    for (cfg_batch_size = 2; cfg_batch_size <= cfg_num_threads;
+         cfg_batch_size *= 2) {
+        evaluator.stop();
+        evaluator.reset_stats();
+        const auto run = run_search_threads(state, iterations);
+        myprintf("batchsize %2d: %5d evaluations in %5.2f seconds -> %d n/s\n",
+                 cfg_batch_size, run.first, run.second,
+                 int(run.first / run.second));
+        evaluator.dump_stats();
+    }
+    evaluator.stop();
+    cfg_batch_size = batch_size;
+}
+
+#ifdef USE_BLAS
+void Network::benchmark_batch(const GameState* const state,
+                              const int iterations) {
+    NNPlanes planes;
+    gather_features(state, planes);
+
+    for (auto batch_size = 1; batch_size <= 32; batch_size *= 2) {
+        auto batch_planes = std::vector<NNPlanes>(batch_size, planes);
+        auto symmetries = std::vector<int>(batch_size);
+        for (auto& symmetry : symmetries) {
+            symmetry = Random::get_Rng().randfix<8>();
+        }
+
+        auto runcount = 0;
+        const Time start;
+        while (runcount < iterations) {
+            get_scored_moves_internal(batch_planes, symmetries);
+            runcount += batch_size;
+        }
+        const Time end;
+        const auto elapsed = Time::timediff_seconds(start, end);
+        myprintf("batch %2d: %5d evaluations in %5.2f seconds -> %d n/s\n",
+                 batch_size, runcount, elapsed, int(runcount / elapsed));
+    }
+}
+#endif
+
+void Network::process_bn_var(float* weights, const size_t size,
+                             const float epsilon) {
+    for (auto i = size_t{0}; i < size; i++) {
+        weights[i] = 1.0f / std::sqrt(weights[i] + epsilon);
     }
 }
 
 std::vector<float> Network::winograd_transform_f(const std::vector<float>& f,
                                                  const int outputs,
-                                                 const int channels) {
-    // F(2x2, 3x3) Winograd filter transformation
+                                                 const int channels,
+                                                 const int m) {
+    // F(m x m, 3x3) Winograd filter transformation
     // transpose(G.dot(f).dot(G.transpose()))
     // U matrix is transposed for better memory layout in SGEMM
-    auto U = std::vector<float>(WINOGRAD_TILE * outputs * channels);
-    const auto G = std::array<float, WINOGRAD_TILE>{ 1.0,  0.0,  0.0,
-                                                     0.5,  0.5,  0.5,
-                                                     0.5, -0.5,  0.5,
-                                                     0.0,  0.0,  1.0};
-    auto temp = std::array<float, 12>{};
+    const auto alpha = Winograd::get_alpha(m);
+    auto U = std::vector<float>(alpha * alpha * outputs * channels);
+    const auto G2 = std::array<float, 4 * 3>{ 1.0,  0.0,  0.0,
+                                              0.5,  0.5,  0.5,
+                                              0.5, -0.5,  0.5,
+                                              0.0,  0.0,  1.0};
+    const auto G4 = std::array<float, 6 * 3>{
+         1.0f / 4,   0.0f,       0.0f,
+        -1.0f / 6,  -1.0f / 6,  -1.0f / 6,
+        -1.0f / 6,   1.0f / 6,  -1.0f / 6,
+         1.0f / 24,  1.0f / 12,  1.0f / 6,
+         1.0f / 24, -1.0f / 12,  1.0f / 6,
+         0.0f,       0.0f,       1.0f};
+    const auto G = (m == 4) ? G4.data() : G2.data();
+    auto temp = std::array<float, 6 * 3>{};
 
     for (auto o = 0; o < outputs; o++) {
         for (auto c = 0; c < channels; c++) {
-            for (auto i = 0; i < 4; i++){
+            for (auto i = 0; i < alpha; i++){
                 for (auto j = 0; j < 3; j++) {
                     auto acc = 0.0f;
                     for (auto k = 0; k < 3; k++) {
@@ -147,13 +393,13 @@ std::vector<float> Network::winograd_transform_f(const std::vector<float>& f,
                 }
             }
 
-            for (auto xi = 0; xi < 4; xi++) {
-                for (auto nu = 0; nu < 4; nu++) {
+            for (auto xi = 0; xi < alpha; xi++) {
+                for (auto nu = 0; nu < alpha; nu++) {
                     auto acc = 0.0f;
                     for (auto k = 0; k < 3; k++) {
                         acc += temp[xi*3 + k] * G[nu*3 + k];
                     }
-                    U[xi * (4 * outputs * channels)
+                    U[xi * (alpha * outputs * channels)
                       + nu * (outputs * channels)
                       + c * outputs
                       + o] = acc;
@@ -165,7 +411,7 @@ std::vector<float> Network::winograd_transform_f(const std::vector<float>& f,
     return U;
 }
 
-std::vector<float> Network::zeropad_U(const std::vector<float>& U,
+std::vector<float> Network::zeropad_U(const float* U,
                                       const int outputs, const int channels,
                                       const int outputs_pad,
                                       const int channels_pad) {
@@ -192,7 +438,59 @@ std::vector<float> Network::zeropad_U(const std::vector<float>& U,
     return Upad;
 }
 
-std::pair<int, int> Network::load_v1_network(std::istream& wtfile) {
+// Runs work(i) for every i in [0, count) on all cores.
+template <typename Work>
+static void parallel_for(const size_t count, Work work) {
+    std::atomic<size_t> next{0};
+    const auto worker = [&]() {
+        for (auto i = next++; i < count; i = next++) {
+            work(i);
+        }
+    };
+    const auto thread_count = std::min(
+        size_t(std::max(1u, std::thread::hardware_concurrency())), count);
+    auto threads = std::vector<std::thread>{};
+    for (auto i = size_t{1}; i < thread_count; i++) {
+        threads.emplace_back(worker);
+    }
+    worker();
+    for (auto& thread : threads) {
+        thread.join();
+    }
+}
+
+// Runs work(begin, end) over [0, count), split across group if there
+// is one.
+template <typename Work>
+static void split_work(SMP::WorkerGroup* const group, const size_t count,
+                       Work work) {
+    if (group) {
+        group->run(count, work);
+    } else {
+        work(size_t{0}, count);
+    }
+}
+
+// Parses a line that must hold exactly count floats.
+static bool parse_line(const char* p, const char* const end,
+                       float* out, const size_t count) {
+    auto parsed = size_t{0};
+    for (;;) {
+        while (p != end && is_blank(*p)) {
+            p++;
+        }
+        if (p == end) {
+            return parsed == count;
+        }
+        if (parsed == count || !parse_float(p, end, out[parsed])) {
+            return false;
+        }
+        parsed++;
+    }
+}
+
+std::pair<int, int> Network::load_v1_network(const std::vector<char>& text,
+                                             const TextLines& lines) {
     // Count size of the network
     myprintf("Detecting residual layers...");
     // We are version 1 or 2
@@ -201,26 +499,25 @@ std::pair<int, int> Network::load_v1_network(std::istream& wtfile) {
     } else {
         myprintf("v%d...", 1);
     }
-    // First line was the version number
-    auto linecount = size_t{1};
-    auto channels = 0;
-    auto line = std::string{};
-    while (std::getline(wtfile, line)) {
-        auto iss = std::stringstream{line};
-        // Third line of parameters are the convolution layer biases,
-        // so this tells us the amount of channels in the residual layers.
-        // We are assuming all layers have the same amount of filters.
-        if (linecount == 2) {
-            auto count = std::distance(std::istream_iterator<std::string>(iss),
-                                       std::istream_iterator<std::string>());
-            myprintf("%d channels...", count);
-            channels = count;
-        }
-        linecount++;
-    }
     // 1 format id, 1 input layer (4 x weights), 14 ending weights,
     // the rest are residuals, every residual has 8 x weight lines
-    auto residual_blocks = linecount - (1 + 4 + 14);
+    if (lines.size() < 1 + 4 + 14) {
+        myprintf("\nInconsistent number of weights in the file.\n");
+        return {0, 0};
+    }
+    // Third line of parameters are the convolution layer biases,
+    // so this tells us the amount of channels in the residual layers.
+    // We are assuming all layers have the same amount of filters.
+    auto channels = 0;
+    auto in_number = false;
+    for (auto i = lines[2].first; i < lines[2].second; i++) {
+        if (!is_blank(text[i]) && !in_number) {
+            channels++;
+        }
+        in_number = !is_blank(text[i]);
+    }
+    myprintf("%d channels...", channels);
+    auto residual_blocks = lines.size() - (1 + 4 + 14);
     if (residual_blocks % 8 != 0) {
         myprintf("\nInconsistent number of weights in the file.\n");
         return {0, 0};
@@ -228,73 +525,82 @@ std::pair<int, int> Network::load_v1_network(std::istream& wtfile) {
     residual_blocks /= 8;
     myprintf("%d blocks.\n", residual_blocks);
 
-    // Re-read file and process
-    wtfile.clear();
-    wtfile.seekg(0, std::ios::beg);
-
-    // Get the file format id out of the way
-    std::getline(wtfile, line);
-
+    // Size every layer up front, so the lines can be parsed in place by
+    // several threads.
     const auto plain_conv_layers = 1 + (residual_blocks * 2);
     const auto plain_conv_wts = plain_conv_layers * 4;
-    linecount = 0;
-    while (std::getline(wtfile, line)) {
-        std::vector<float> weights;
-        auto it_line = line.cbegin();
-        const auto ok = phrase_parse(it_line, line.cend(),
-                                     *x3::float_, x3::space, weights);
-        if (!ok || it_line != line.cend()) {
-            myprintf("\nFailed to parse weight file. Error on line %d.\n",
-                    linecount + 2); //+1 from version line, +1 from 0-indexing
-            return {0,0};
-        }
-        if (linecount < plain_conv_wts) {
-            if (linecount % 4 == 0) {
-                conv_weights.emplace_back(weights);
-            } else if (linecount % 4 == 1) {
-                // Redundant in our model, but they encode the
-                // number of outputs so we have to read them in.
-                conv_biases.emplace_back(weights);
-            } else if (linecount % 4 == 2) {
-                batchnorm_means.emplace_back(weights);
-            } else if (linecount % 4 == 3) {
-                process_bn_var(weights);
-                batchnorm_stddivs.emplace_back(weights);
-            }
-        } else if (linecount == plain_conv_wts) {
-            conv_pol_w = std::move(weights);
-        } else if (linecount == plain_conv_wts + 1) {
-            conv_pol_b = std::move(weights);
-        } else if (linecount == plain_conv_wts + 2) {
-            std::copy(cbegin(weights), cend(weights), begin(bn_pol_w1));
-        } else if (linecount == plain_conv_wts + 3) {
-            process_bn_var(weights);
-            std::copy(cbegin(weights), cend(weights), begin(bn_pol_w2));
-        } else if (linecount == plain_conv_wts + 4) {
-            std::copy(cbegin(weights), cend(weights), begin(ip_pol_w));
-        } else if (linecount == plain_conv_wts + 5) {
-            std::copy(cbegin(weights), cend(weights), begin(ip_pol_b));
-        } else if (linecount == plain_conv_wts + 6) {
-            conv_val_w = std::move(weights);
-        } else if (linecount == plain_conv_wts + 7) {
-            conv_val_b = std::move(weights);
-        } else if (linecount == plain_conv_wts + 8) {
-            std::copy(cbegin(weights), cend(weights), begin(bn_val_w1));
-        } else if (linecount == plain_conv_wts + 9) {
-            process_bn_var(weights);
-            std::copy(cbegin(weights), cend(weights), begin(bn_val_w2));
-        } else if (linecount == plain_conv_wts + 10) {
-            std::copy(cbegin(weights), cend(weights), begin(ip1_val_w));
-        } else if (linecount == plain_conv_wts + 11) {
-            std::copy(cbegin(weights), cend(weights), begin(ip1_val_b));
-        } else if (linecount == plain_conv_wts + 12) {
-            std::copy(cbegin(weights), cend(weights), begin(ip2_val_w));
-        } else if (linecount == plain_conv_wts + 13) {
-            std::copy(cbegin(weights), cend(weights), begin(ip2_val_b));
-        }
-        linecount++;
+    auto targets = std::vector<std::pair<float*, size_t>>{};
+    const auto add_vector = [&targets](std::vector<float>& weights,
+                                       const size_t size) {
+        weights.resize(size);
+        targets.emplace_back(weights.data(), size);
+    };
+    conv_weights.resize(plain_conv_layers);
+    conv_biases.resize(plain_conv_layers);
+    batchnorm_means.resize(plain_conv_layers);
+    batchnorm_stddivs.resize(plain_conv_layers);
+    for (auto i = size_t{0}; i < plain_conv_layers; i++) {
+        const auto inputs = i == 0 ? INPUT_CHANNELS : channels;
+        add_vector(conv_weights[i], channels * inputs * 9);
+        // Redundant in our model, but they encode the
+        // number of outputs so we have to read them in.
+        add_vector(conv_biases[i], channels);
+        add_vector(batchnorm_means[i], channels);
+        add_vector(batchnorm_stddivs[i], channels);
     }
+    add_vector(conv_pol_w, OUTPUTS_POLICY * channels);
+    add_vector(conv_pol_b, OUTPUTS_POLICY);
+    targets.emplace_back(bn_pol_w1.data(), bn_pol_w1.size());
+    targets.emplace_back(bn_pol_w2.data(), bn_pol_w2.size());
+    targets.emplace_back(ip_pol_w.data(), ip_pol_w.size());
+    targets.emplace_back(ip_pol_b.data(), ip_pol_b.size());
+    add_vector(conv_val_w, OUTPUTS_VALUE * channels);
+    add_vector(conv_val_b, OUTPUTS_VALUE);
+    targets.emplace_back(bn_val_w1.data(), bn_val_w1.size());
+    targets.emplace_back(bn_val_w2.data(), bn_val_w2.size());
+    targets.emplace_back(ip1_val_w.data(), ip1_val_w.size());
+    targets.emplace_back(ip1_val_b.data(), ip1_val_b.size());
+    targets.emplace_back(ip2_val_w.data(), ip2_val_w.size());
+    targets.emplace_back(ip2_val_b.data(), ip2_val_b.size());
+    assert(targets.size() + 1 == lines.size());
+
+    // Batchnorm variances are replaced by 1 / sqrt(var + eps).
+    const auto is_variance = [plain_conv_wts](const size_t target) {
+        return target < plain_conv_wts ? target % 4 == 3
+             : target == plain_conv_wts + 3 || target == plain_conv_wts + 9;
+    };
+
+    // Longest lines first, they dominate the time.
+    auto order = std::vector<size_t>(targets.size());
+    std::iota(begin(order), end(order), size_t{0});
+    std::stable_sort(begin(order), end(order),
+        [&targets](const size_t a, const size_t b) {
+            return targets[a].second > targets[b].second;
+        });
 
+    std::atomic<size_t> error_line{lines.size()};
+    parallel_for(order.size(), [&](const size_t i) {
+        const auto target = order[i];
+        const auto& line = lines[target + 1];
+        auto& out = targets[target];
+        if (!parse_line(text.data() + line.first, text.data() + line.second,
+                        out.first, out.second)) {
+            auto first_error = error_line.load();
+            while (target + 1 < first_error
+                   && !error_line.compare_exchange_weak(first_error,
+                                                        target + 1)) {}
+            return;
+        }
+        if (is_variance(target)) {
+            process_bn_var(out.first, out.second);
+        }
+    });
+
+    if (error_line < lines.size()) {
+        myprintf("\nFailed to parse weight file. Error on line %d.\n",
+                 int(error_line + 1));
+        return {0, 0};
+    }
     return {channels, static_cast<int>(residual_blocks)};
 }
 
@@ -306,29 +612,51 @@ std::pair<int, int> Network::load_network_file(const std::string& filename) {
         myprintf("Could not open weights file: %s\n", filename.c_str());
         return {0, 0};
     }
-    // Stream the gz file in to a memory buffer stream.
-    auto buffer = std::stringstream{};
-    constexpr auto chunkBufferSize = 64 * 1024;
-    std::vector<char> chunkBuffer(chunkBufferSize);
+    // Stream the file into one buffer and find the lines as the chunks
+    // arrive, so nothing has to be scanned again.
+    constexpr auto chunkBufferSize = 1024 * 1024;
+    auto text = std::vector<char>{};
+    auto lines = TextLines{};
+    auto line_begin = size_t{0};
+    // The decompressed size is at least the file size.
+    auto file = std::ifstream{filename, std::ios::binary | std::ios::ate};
+    if (file) {
+        text.reserve(size_t(file.tellg()) + chunkBufferSize);
+    }
+    file.close();
     while (true) {
-        auto bytesRead = gzread(gzhandle, chunkBuffer.data(), chunkBufferSize);
-        if (bytesRead == 0) break;
+        const auto size = text.size();
+        text.resize(size + chunkBufferSize);
+        auto bytesRead = gzread(gzhandle, text.data() + size, chunkBufferSize);
         if (bytesRead < 0) {
             myprintf("Failed to decompress or read: %s\n", filename.c_str());
             gzclose(gzhandle);
             return {0, 0};
         }
         assert(bytesRead <= chunkBufferSize);
-        buffer.write(chunkBuffer.data(), bytesRead);
+        text.resize(size + bytesRead);
+        if (bytesRead == 0) break;
+        const auto end = text.data() + text.size();
+        for (auto p = text.data() + size;
+             (p = static_cast<char*>(std::memchr(p, '\n', end - p)));
+             p++) {
+            const auto i = size_t(p - text.data());
+            lines.emplace_back(line_begin, i);
+            line_begin = i + 1;
+        }
     }
     gzclose(gzhandle);
+    if (line_begin < text.size()) {
+        lines.emplace_back(line_begin, text.size());
+    }
 
     // Read format version
-    auto line = std::string{};
-    auto format_version = -1;
-    if (std::getline(buffer, line)) {
-        auto iss = std::stringstream{line};
+    if (!lines.empty()) {
         // First line is the file format version id
+        const auto version = std::string(text.data() + lines[0].first,
+                                         text.data() + lines[0].second);
+        auto iss = std::stringstream{version};
+        auto format_version = -1;
         iss >> format_version;
         if (iss.fail() || (format_version != 1 && format_version != 2)) {
             myprintf("Weights file is the wrong version.\n");
@@ -342,42 +670,23 @@ std::pair<int, int> Network::load_network_file(const std::string& filename) {
             } else {
                 value_head_not_stm = false;
             }
-            return load_v1_network(buffer);
+            return load_v1_network(text, lines);
         }
     }
     return {0, 0};
 }
 
-void Network::initialize() {
-    // Prepare symmetry table
-    for (auto s = 0; s < 8; s++) {
-        for (auto v = 0; v < BOARD_SQUARES; v++) {
-            symmetry_nn_idx_table[s][v] = get_nn_idx_symmetry(v, s);
-        }
-    }
-
-    // Load network from file
-    size_t channels, residual_blocks;
-    std::tie(channels, residual_blocks) = load_network_file(cfg_weightsfile);
-    if (channels == 0) {
-        exit(EXIT_FAILURE);
-    }
-
-    auto weight_index = size_t{0};
-    // Input convolution
-    // Winograd transform convolution weights
-    conv_weights[weight_index] =
-        winograd_transform_f(conv_weights[weight_index],
-                             channels, INPUT_CHANNELS);
-    weight_index++;
-
-    // Residual block convolutions
-    for (auto i = size_t{0}; i < residual_blocks * 2; i++) {
-        conv_weights[weight_index] =
-            winograd_transform_f(conv_weights[weight_index],
-                                 channels, channels);
-        weight_index++;
-    }
+void Network::prepare_network(const int channels,
+                              const int residual_blocks) {
+    // Winograd transform convolution weights, the input convolution
+    // followed by the residual block convolutions
+    assert(conv_weights.size() == size_t(1 + residual_blocks * 2));
+    (void)residual_blocks;
+    parallel_for(conv_weights.size(), [channels](const size_t i) {
+        const auto inputs = i == 0 ? INPUT_CHANNELS : channels;
+        conv_weights[i] = winograd_transform_f(conv_weights[i],
+                                               channels, inputs, winograd_m);
+    });
 
     // Biases are not calculated and are typically zero but some networks might
     // still have non-zero biases.
@@ -400,6 +709,232 @@ void Network::initialize() {
         conv_pol_b[i] = 0.0f;
     }
 
+
+    for (const auto& U : conv_weights) {
+        winograd_filters.emplace_back(U.data());
+    }
+}
+
+std::pair<int, int> Network::load_network(const std::string& filename) {
+    auto magic = std::array<char, 4>{};
+    auto file = std::ifstream{filename, std::ios::binary};
+    if (file.read(magic.data(), magic.size())
+        && std::equal(cbegin(magic), cend(magic), BINARY_MAGIC)) {
+        file.close();
+        return load_binary_network(filename);
+    }
+    file.close();
+
+    const auto shape = load_network_file(filename);
+    if (shape.first != 0) {
+        prepare_network(shape.first, shape.second);
+    }
+    return shape;
+}
+
+std::pair<int, int> Network::load_binary_network(const std::string& filename) {
+    namespace bip = boost::interprocess;
+    try {
+        const auto mapping = bip::file_mapping{filename.c_str(), bip::read_only};
+        weights_region = bip::mapped_region{mapping, bip::read_only};
+    } catch (const bip::interprocess_exception&) {
+        myprintf("Could not map weights file: %s\n", filename.c_str());
+        return {0, 0};
+    }
+    const auto base = static_cast<const char*>(weights_region.get_address());
+    const auto size = weights_region.get_size();
+
+    auto header = BinaryHeader{};
+    if (size < sizeof(header)) {
+        myprintf("Binary weights file is truncated.\n");
+        return {0, 0};
+    }
+    std::memcpy(&header, base, sizeof(header));
+    if (header.version != BINARY_VERSION) {
+        myprintf("Binary weights file is the wrong version.\n");
+        return {0, 0};
+    }
+    network_hash = header.network_hash;
+#ifdef USE_OPENCL
+    if (header.winograd_m != 2) {
+#else
+    if (header.winograd_m != 2 && header.winograd_m != 4) {
+#endif
+        myprintf("Binary weights file has unsupported F(%dx%d,3x3) filters.\n",
+                 header.winograd_m, header.winograd_m);
+        return {0, 0};
+    }
+    const auto channels = int(header.channels);
+    const auto residual_blocks = int(header.residual_blocks);
+    value_head_not_stm = header.value_head_not_stm != 0;
+    winograd_m = header.winograd_m;
+    myprintf("Binary weights v%d...%d channels...%d blocks...F(%dx%d,3x3).\n",
+             header.value_head_not_stm ? 2 : 1, channels, residual_blocks,
+             winograd_m, winograd_m);
+
+    // Returns the next array if it has the expected length.
+    auto offset = sizeof(header);
+    auto corrupt = false;
+    const auto next_array = [&](const size_t length) -> const float* {
+        auto count = std::uint64_t{};
+        offset = ceilMultiple(offset, BINARY_ALIGNMENT);
+        if (!corrupt && offset + sizeof(count) <= size) {
+            std::memcpy(&count, base + offset, sizeof(count));
+            offset = ceilMultiple(offset + sizeof(count), BINARY_ALIGNMENT);
+        }
+        if (corrupt || count != length
+            || offset + length * sizeof(float) > size) {
+            corrupt = true;
+            return nullptr;
+        }
+        const auto data = reinterpret_cast<const float*>(base + offset);
+        offset += length * sizeof(float);
+        return data;
+    };
+    const auto read_vector = [&](std::vector<float>& weights,
+                                 const size_t length) {
+        const auto data = next_array(length);
+        if (data) {
+            weights.assign(data, data + length);
+        }
+    };
+    const auto read_array = [&](auto& weights) {
+        const auto data = next_array(weights.size());
+        if (data) {
+            std::copy_n(data, weights.size(), begin(weights));
+        }
+    };
+
+    // The filters are used in place, the rest is small enough to copy.
+    const auto tiles = Winograd::get_alpha(winograd_m)
+                       * Winograd::get_alpha(winograd_m);
+    for (auto i = 0; i < 1 + residual_blocks * 2; i++) {
+        const auto C = i == 0 ? INPUT_CHANNELS : channels;
+        winograd_filters.emplace_back(next_array(tiles * C * channels));
+        winograd_panels.emplace_back(
+            next_array(Gemm::get_packed_size(tiles, C, channels)));
+        conv_biases.emplace_back(channels, 0.0f);
+        batchnorm_means.emplace_back();
+        read_vector(batchnorm_means.back(), channels);
+        batchnorm_stddivs.emplace_back();
+        read_vector(batchnorm_stddivs.back(), channels);
+    }
+    read_vector(conv_pol_w, OUTPUTS_POLICY * channels);
+    conv_pol_b.assign(OUTPUTS_POLICY, 0.0f);
+    read_array(bn_pol_w1);
+    read_array(bn_pol_w2);
+    read_array(ip_pol_w);
+    read_array(ip_pol_b);
+    read_vector(conv_val_w, OUTPUTS_VALUE * channels);
+    conv_val_b.assign(OUTPUTS_VALUE, 0.0f);
+    read_array(bn_val_w1);
+    read_array(bn_val_w2);
+    read_array(ip1_val_w);
+    read_array(ip1_val_b);
+    read_array(ip2_val_w);
+    read_array(ip2_val_b);
+
+    if (corrupt) {
+        myprintf("Binary weights file is corrupt.\n");
+        return {0, 0};
+    }
+    return {channels, residual_blocks};
+}
+
+bool Network::convert_network(const std::string& filename,
+                              const std::string& binary_filename) {
+#ifndef USE_OPENCL
+    winograd_m = cfg_winograd_tile;
+#endif
+    const auto shape = load_network(filename);
+    if (shape.first == 0) {
+        return false;
+    }
+    const auto channels = shape.first;
+
+    auto file = std::ofstream{binary_filename, std::ios::binary};
+    const auto pad = [&file]() {
+        while (size_t(file.tellp()) % BINARY_ALIGNMENT != 0) {
+            file.put(0);
+        }
+    };
+    const auto write_array = [&](const float* data, const size_t length) {
+        const auto count = std::uint64_t{length};
+        pad();
+        file.write(reinterpret_cast<const char*>(&count), sizeof(count));
+        pad();
+        file.write(reinterpret_cast<const char*>(data),
+                   length * sizeof(float));
+    };
+
+    auto header = BinaryHeader{};
+    std::copy_n(BINARY_MAGIC, sizeof(header.magic), header.magic);
+    header.version = BINARY_VERSION;
+    header.channels = channels;
+    header.residual_blocks = shape.second;
+    header.value_head_not_stm = value_head_not_stm;
+    header.winograd_m = winograd_m;
+    header.network_hash = get_network_hash(filename);
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+    const auto tiles = Winograd::get_alpha(winograd_m)
+                       * Winograd::get_alpha(winograd_m);
+    for (auto i = size_t{0}; i < winograd_filters.size(); i++) {
+        const auto C = i == 0 ? INPUT_CHANNELS : channels;
+        write_array(winograd_filters[i], tiles * C * channels);
+        const auto panels = Gemm::pack_weights(winograd_filters[i], tiles, C,
+                                               channels, Gemm::FP32);
+        write_array(panels.data_fp32.data(), panels.data_fp32.size());
+        write_array(batchnorm_means[i].data(), batchnorm_means[i].size());
+        write_array(batchnorm_stddivs[i].data(), batchnorm_stddivs[i].size());
+    }
+    write_array(conv_pol_w.data(), conv_pol_w.size());
+    write_array(bn_pol_w1.data(), bn_pol_w1.size());
+    write_array(bn_pol_w2.data(), bn_pol_w2.size());
+    write_array(ip_pol_w.data(), ip_pol_w.size());
+    write_array(ip_pol_b.data(), ip_pol_b.size());
+    write_array(conv_val_w.data(), conv_val_w.size());
+    write_array(bn_val_w1.data(), bn_val_w1.size());
+    write_array(bn_val_w2.data(), bn_val_w2.size());
+    write_array(ip1_val_w.data(), ip1_val_w.size());
+    write_array(ip1_val_b.data(), ip1_val_b.size());
+    write_array(ip2_val_w.data(), ip2_val_w.size());
+    write_array(ip2_val_b.data(), ip2_val_b.size());
+
+    file.close();
+    if (!file) {
+        myprintf("Failed to write %s\n", binary_filename.c_str());
+        return false;
+    }
+    myprintf("Wrote %s\n", binary_filename.c_str());
+    return true;
+}
+
+void Network::initialize() {
+    // Prepare symmetry table
+    auto board = FastBoard{};
+    board.reset_board(BOARD_SIZE);
+    for (auto s = 0; s < 8; s++) {
+        for (auto v = 0; v < BOARD_SQUARES; v++) {
+            const auto idx = get_nn_idx_symmetry(v, s);
+            symmetry_nn_idx_table[s][v] = idx;
+            symmetry_vertex_table[s][v] =
+                board.get_vertex(idx % BOARD_SIZE, idx / BOARD_SIZE);
+        }
+    }
+
+#ifndef USE_OPENCL
+    // The OpenCL kernels only implement F(2x2, 3x3).
+    winograd_m = cfg_winograd_tile;
+#endif
+
+    // Load network from file
+    size_t channels, residual_blocks;
+    std::tie(channels, residual_blocks) = load_network(cfg_weightsfile);
+    if (channels == 0) {
+        exit(EXIT_FAILURE);
+    }
+
 #ifdef USE_OPENCL
     myprintf("Initializing OpenCL.\n");
     opencl.initialize(channels);
@@ -416,7 +951,7 @@ void Network::initialize() {
         const auto m_ceil = ceilMultiple(ceilMultiple(channels, mwg), vwm);
         const auto k_ceil = ceilMultiple(ceilMultiple(INPUT_CHANNELS, kwg), vwm);
 
-        const auto Upad = zeropad_U(conv_weights[weight_index],
+        const auto Upad = zeropad_U(winograd_filters[weight_index],
                                     channels, INPUT_CHANNELS,
                                     m_ceil, k_ceil);
 
@@ -428,10 +963,10 @@ void Network::initialize() {
 
         // residual blocks
         for (auto i = size_t{0}; i < residual_blocks; i++) {
-            const auto Upad1 = zeropad_U(conv_weights[weight_index],
+            const auto Upad1 = zeropad_U(winograd_filters[weight_index],
                                          channels, channels,
                                          m_ceil, m_ceil);
-            const auto Upad2 = zeropad_U(conv_weights[weight_index + 1],
+            const auto Upad2 = zeropad_U(winograd_filters[weight_index + 1],
                                          channels, channels,
                                          m_ceil, m_ceil);
             opencl_net->push_residual(WINOGRAD_ALPHA, channels, channels,
@@ -462,199 +997,195 @@ void Network::initialize() {
     mkl_get_version(&Version);
     myprintf("BLAS core: MKL %s\n", Version.Processor);
 #endif
+#endif
+    winograd_kernels = Winograd::get_available_kernels(winograd_m).front();
+    myprintf("Winograd F(%dx%d,3x3) transforms: %s\n",
+             winograd_m, winograd_m, SIMD::get_name(winograd_kernels.level));
+    head_weights = Heads::fold_batchnorm(
+        channels,
+        OUTPUTS_POLICY, conv_pol_w.data(), bn_pol_w1.data(), bn_pol_w2.data(),
+        OUTPUTS_VALUE, conv_val_w.data(), bn_val_w1.data(), bn_val_w2.data());
+    head_kernels = Heads::get_available_kernels().front();
+    myprintf("Policy and value heads: %s\n",
+             SIMD::get_name(head_kernels.level));
+#ifndef USE_OPENCL
+    // Latency mode when the search threads leave cores idle, each search
+    // thread then splits its evaluations across its own group of threads.
+    // The batch evaluator threads already keep the cores busy, the two
+    // don't mix.
+    auto threads = cfg_nn_threads > 0
+        ? cfg_nn_threads
+        : std::max(1, SMP::get_num_cpus() / std::max(1, cfg_num_threads));
+    if (threads > 1 && cfg_batch_size > 1) {
+        if (cfg_nn_threads > 1) {
+            myprintf("Ignoring --nnthreads with --batchsize > 1.\n");
+        }
+        threads = 1;
+    }
+    set_evaluation_threads(cfg_num_threads, threads);
+    if (threads > 1) {
+        myprintf("Latency mode: %d threads per evaluation.\n", threads);
+    } else {
+        myprintf("Throughput mode: one thread per evaluation.\n");
+    }
+    gemm_kernels = Gemm::get_available_kernels().front();
+    if (cfg_int8) {
+        initialize_int8();
+    } else if (cfg_weight_storage == Gemm::FP32
+               && gemm_kernels.level != SIMD::SCALAR
+               && !winograd_panels.empty()) {
+        // The panels of a binary weights file are used in place, so
+        // engines that map the same file share them.
+        const auto tiles = Winograd::get_alpha(winograd_m)
+                           * Winograd::get_alpha(winograd_m);
+        for (auto i = size_t{0}; i < winograd_panels.size(); i++) {
+            const auto C = i == 0 ? INPUT_CHANNELS : int(channels);
+            packed_weights.emplace_back(
+                Gemm::map_weights(winograd_panels[i], tiles, C, channels));
+        }
+        myprintf("Convolution weights: %s, mapped, %s\n",
+                 Gemm::get_name(cfg_weight_storage),
+                 SIMD::get_name(gemm_kernels.level));
+    } else if (cfg_weight_storage != Gemm::FP32
+               || gemm_kernels.level != SIMD::SCALAR) {
+        // Without SIMD, FP32 filters are left to the BLAS sgemm.
+        const auto tiles = Winograd::get_alpha(winograd_m)
+                           * Winograd::get_alpha(winograd_m);
+        auto bytes = size_t{0};
+        for (auto i = size_t{0}; i < winograd_filters.size(); i++) {
+            const auto C = i == 0 ? INPUT_CHANNELS : int(channels);
+            packed_weights.emplace_back(
+                Gemm::pack_weights(winograd_filters[i], tiles, C, channels,
+                                   cfg_weight_storage));
+            const auto& packed = packed_weights.back();
+            bytes += packed.data.size() * sizeof(std::uint16_t)
+                     + packed.data_fp32.size() * sizeof(float);
+            winograd_filters[i] = nullptr;
+        }
+        conv_weights.clear();
+        myprintf("Convolution weights: %s, %.1f MB, %s\n",
+                 Gemm::get_name(cfg_weight_storage), bytes / (1024.0 * 1024.0),
+                 SIMD::get_name(gemm_kernels.level));
+    }
 #endif
 #endif
+
+    if (!cfg_cache_file.empty()) {
+        // Quantized weights and the Winograd tile change the results, keep
+        // them apart.
+        const auto precision = std::uint64_t(cfg_int8 ? 3 : cfg_weight_storage);
+        const auto key = get_network_hash(cfg_weightsfile)
+                         + (precision << 8 | std::uint64_t(winograd_m));
+        NNCache::get_NNCache().attach_file(cfg_cache_file, key);
+    }
 }
 
 #ifdef USE_BLAS
 void Network::winograd_transform_in(const std::vector<float>& in,
                                     std::vector<float>& V,
-                                    const int C) {
-    constexpr auto W = BOARD_SIZE;
-    constexpr auto H = BOARD_SIZE;
-    constexpr auto WTILES = (W + 1) / 2;
-    constexpr auto P = WTILES * WTILES;
-
-    std::array<std::array<float, WTILES * 2 + 2>, WTILES * 2 + 2> in_pad;
-    for (auto xin = size_t{0}; xin < in_pad.size(); xin++) {
-        in_pad[0][xin]     = 0.0f;
-        in_pad[H + 1][xin] = 0.0f;
-        in_pad[H + 2][xin] = 0.0f;
-    }
-    for (auto yin = size_t{1}; yin < in_pad[0].size() - 2; yin++) {
-        in_pad[yin][0]     = 0.0f;
-        in_pad[yin][W + 1] = 0.0f;
-        in_pad[yin][W + 2] = 0.0f;
-    }
-
-    for (auto ch = 0; ch < C; ch++) {
-        for (auto yin = 0; yin < H; yin++) {
-            for (auto xin = 0; xin < W; xin++) {
-                in_pad[yin + 1][xin + 1] = in[ch*(W*H) + yin*W + xin];
-            }
-        }
-        for (auto block_y = 0; block_y < WTILES; block_y++) {
-            // Tiles overlap by 2
-            const auto yin = 2 * block_y;
-            for (auto block_x = 0; block_x < WTILES; block_x++) {
-                const auto xin = 2 * block_x;
-
-                // Calculates transpose(B).x.B
-                // B = [[ 1.0,  0.0,  0.0,  0.0],
-                //      [ 0.0,  1.0, -1.0,  1.0],
-                //      [-1.0,  1.0,  1.0,  0.0],
-                //      [ 0.0,  0.0,  0.0, -1.0]]
-
-                using WinogradTile =
-                    std::array<std::array<float, WINOGRAD_ALPHA>, WINOGRAD_ALPHA>;
-                WinogradTile T1, T2;
-
-                T1[0][0] = in_pad[yin + 0][xin + 0] - in_pad[yin + 2][xin + 0];
-                T1[0][1] = in_pad[yin + 0][xin + 1] - in_pad[yin + 2][xin + 1];
-                T1[0][2] = in_pad[yin + 0][xin + 2] - in_pad[yin + 2][xin + 2];
-                T1[0][3] = in_pad[yin + 0][xin + 3] - in_pad[yin + 2][xin + 3];
-                T1[1][0] = in_pad[yin + 1][xin + 0] + in_pad[yin + 2][xin + 0];
-                T1[1][1] = in_pad[yin + 1][xin + 1] + in_pad[yin + 2][xin + 1];
-                T1[1][2] = in_pad[yin + 1][xin + 2] + in_pad[yin + 2][xin + 2];
-                T1[1][3] = in_pad[yin + 1][xin + 3] + in_pad[yin + 2][xin + 3];
-                T1[2][0] = in_pad[yin + 2][xin + 0] - in_pad[yin + 1][xin + 0];
-                T1[2][1] = in_pad[yin + 2][xin + 1] - in_pad[yin + 1][xin + 1];
-                T1[2][2] = in_pad[yin + 2][xin + 2] - in_pad[yin + 1][xin + 2];
-                T1[2][3] = in_pad[yin + 2][xin + 3] - in_pad[yin + 1][xin + 3];
-                T1[3][0] = in_pad[yin + 1][xin + 0] - in_pad[yin + 3][xin + 0];
-                T1[3][1] = in_pad[yin + 1][xin + 1] - in_pad[yin + 3][xin + 1];
-                T1[3][2] = in_pad[yin + 1][xin + 2] - in_pad[yin + 3][xin + 2];
-                T1[3][3] = in_pad[yin + 1][xin + 3] - in_pad[yin + 3][xin + 3];
-
-                T2[0][0] = T1[0][0] - T1[0][2];
-                T2[0][1] = T1[0][1] + T1[0][2];
-                T2[0][2] = T1[0][2] - T1[0][1];
-                T2[0][3] = T1[0][1] - T1[0][3];
-                T2[1][0] = T1[1][0] - T1[1][2];
-                T2[1][1] = T1[1][1] + T1[1][2];
-                T2[1][2] = T1[1][2] - T1[1][1];
-                T2[1][3] = T1[1][1] - T1[1][3];
-                T2[2][0] = T1[2][0] - T1[2][2];
-                T2[2][1] = T1[2][1] + T1[2][2];
-                T2[2][2] = T1[2][2] - T1[2][1];
-                T2[2][3] = T1[2][1] - T1[2][3];
-                T2[3][0] = T1[3][0] - T1[3][2];
-                T2[3][1] = T1[3][1] + T1[3][2];
-                T2[3][2] = T1[3][2] - T1[3][1];
-                T2[3][3] = T1[3][1] - T1[3][3];
-
-                const auto offset = ch * P + block_y * WTILES + block_x;
-                for (auto i = 0; i < WINOGRAD_ALPHA; i++) {
-                    for (auto j = 0; j < WINOGRAD_ALPHA; j++) {
-                        V[(i*WINOGRAD_ALPHA + j)*C*P + offset] = T2[i][j];
-                    }
-                }
-            }
-        }
-    }
+                                    const int C, const int batch_size,
+                                    SMP::WorkerGroup* const group) {
+    split_work(group, C, [&](const size_t begin, const size_t end) {
+        winograd_kernels.transform_in(in.data(), V.data(), C, batch_size,
+                                      int(begin), int(end));
+    });
 }
 
-void Network::winograd_sgemm(const std::vector<float>& U,
+void Network::winograd_sgemm(const float* U,
                              const std::vector<float>& V,
                              std::vector<float>& M,
-                             const int C, const int K) {
-    constexpr auto P = (BOARD_SIZE + 1) * (BOARD_SIZE + 1) / WINOGRAD_ALPHA;
-
-    for (auto b = 0; b < WINOGRAD_TILE; b++) {
-        const auto offset_u = b * K * C;
-        const auto offset_v = b * C * P;
-        const auto offset_m = b * K * P;
-
-        cblas_sgemm(CblasRowMajor, CblasTrans, CblasNoTrans,
-                    K, P, C,
-                    1.0f,
-                    &U[offset_u], K,
-                    &V[offset_v], P,
-                    0.0f,
-                    &M[offset_m], P);
-    }
+                             const int C, const int K,
+                             const int batch_size, const int m,
+                             SMP::WorkerGroup* const group) {
+    const auto alpha = Winograd::get_alpha(m);
+    const auto BP = batch_size * Winograd::get_tiles(m);
+    const auto tiles = alpha * alpha;
+
+    // With more threads than tiles, the multiplications are also split
+    // into blocks of output channels.
+    const auto threads = group ? int(group->size()) : 1;
+    const auto splits = std::max(1, std::min((2 * threads - 1) / tiles + 1,
+                                             K / 16));
+
+    split_work(group, tiles * splits, [&](const size_t begin,
+                                          const size_t end) {
+        for (auto i = int(begin); i < int(end); i++) {
+            const auto b = i / splits;
+            const auto k_begin = K * (i % splits) / splits;
+            const auto k_end = K * (i % splits + 1) / splits;
+            const auto offset_u = b * K * C + k_begin;
+            const auto offset_v = b * C * BP;
+            const auto offset_m = (b * K + k_begin) * BP;
+
+            cblas_sgemm(CblasRowMajor, CblasTrans, CblasNoTrans,
+                        k_end - k_begin, BP, C,
+                        1.0f,
+                        &U[offset_u], K,
+                        &V[offset_v], BP,
+                        0.0f,
+                        &M[offset_m], BP);
+        }
+    });
 }
 
-void Network::winograd_transform_out(const std::vector<float>& M,
-                                     std::vector<float>& Y,
-                                     const int K) {
-    constexpr auto W = BOARD_SIZE;
-    constexpr auto H = BOARD_SIZE;
-    constexpr auto WTILES = (W + 1) / 2;
-    constexpr auto P = WTILES * WTILES;
-
-    for (auto k = 0; k < K; k++) {
-        const auto kHW = k * W * H;
-        for (auto block_x = 0; block_x < WTILES; block_x++) {
-            const auto x = 2 * block_x;
-            for (auto block_y = 0; block_y < WTILES; block_y++) {
-                const auto y = 2 * block_y;
-
-                const auto b = block_y * WTILES + block_x;
-                using WinogradTile =
-                    std::array<std::array<float, WINOGRAD_ALPHA>, WINOGRAD_ALPHA>;
-                WinogradTile temp_m;
-                for (auto xi = 0; xi < WINOGRAD_ALPHA; xi++) {
-                    for (auto nu = 0; nu < WINOGRAD_ALPHA; nu++) {
-                        temp_m[xi][nu] =
-                            M[xi*(WINOGRAD_ALPHA*K*P) + nu*(K*P)+ k*P + b];
-                    }
-                }
+void Network::winograd_multiply(const size_t layer,
+                                const std::vector<float>& V,
+                                std::vector<std::uint8_t>& Vq,
+                                std::vector<float>& M,
+                                const int C, const int K,
+                                const int batch_size,
+                                SMP::WorkerGroup* const group) {
+    const auto tiles = Winograd::get_alpha(winograd_m)
+                       * Winograd::get_alpha(winograd_m);
+    const auto BP = batch_size * Winograd::get_tiles(winograd_m);
+
+    if (int8_enabled) {
+        const auto scales = int8_input_scales[layer].data();
+        int8_kernels.quantize_input(V.data(), tiles, C, BP,
+                                    scales, Vq.data());
+        int8_kernels.gemm(int8_weights[layer], Vq.data(), scales, BP, M.data());
+        return;
+    }
+    if (!packed_weights.empty()) {
+        const auto& U = packed_weights[layer];
+        split_work(group, Gemm::get_blocks(U), [&](const size_t begin,
+                                                   const size_t end) {
+            gemm_kernels.multiply(U, V.data(), BP, M.data(),
+                                  int(begin), int(end));
+        });
+        return;
+    }
 
-                // Calculates transpose(A).temp_m.A
-                //    A = [1.0,  0.0],
-                //        [1.0,  1.0],
-                //        [1.0, -1.0],
-                //        [0.0, -1.0]]
-
-                const std::array<std::array<float, 2>, 2> o = {
-                    temp_m[0][0] + temp_m[0][1] + temp_m[0][2] +
-                    temp_m[1][0] + temp_m[1][1] + temp_m[1][2] +
-                    temp_m[2][0] + temp_m[2][1] + temp_m[2][2],
-                    temp_m[0][1] - temp_m[0][2] - temp_m[0][3] +
-                    temp_m[1][1] - temp_m[1][2] - temp_m[1][3] +
-                    temp_m[2][1] - temp_m[2][2] - temp_m[2][3],
-                    temp_m[1][0] + temp_m[1][1] + temp_m[1][2] -
-                    temp_m[2][0] - temp_m[2][1] - temp_m[2][2] -
-                    temp_m[3][0] - temp_m[3][1] - temp_m[3][2],
-                    temp_m[1][1] - temp_m[1][2] - temp_m[1][3] -
-                    temp_m[2][1] + temp_m[2][2] + temp_m[2][3] -
-                    temp_m[3][1] + temp_m[3][2] + temp_m[3][3]
-                };
-
-                const auto y_ind = kHW + (y)*W + (x);
-                Y[y_ind] = o[0][0];
-                if (x + 1 < W) {
-                    Y[y_ind + 1] = o[0][1];
-                }
-                if (y + 1 < H) {
-                    Y[y_ind + W] = o[1][0];
-                    if (x + 1 < W) {
-                        Y[y_ind + W + 1] = o[1][1];
-                    }
-                }
+    if (int8_calibrating) {
+        auto& max_abs = int8_input_scales[layer];
+        for (auto b = 0; b < tiles; b++) {
+            const auto Vb = cbegin(V) + b * C * BP;
+            for (auto i = 0; i < C * BP; i++) {
+                max_abs[b] = std::max(max_abs[b], std::abs(Vb[i]));
             }
         }
     }
+    winograd_sgemm(winograd_filters[layer], V, M, C, K, batch_size,
+                   winograd_m, group);
 }
 
-void Network::winograd_convolve3(const int outputs,
-                                 const std::vector<float>& input,
-                                 const std::vector<float>& U,
-                                 std::vector<float>& V,
-                                 std::vector<float>& M,
-                                 std::vector<float>& output) {
-
-    constexpr unsigned int filter_len = WINOGRAD_ALPHA * WINOGRAD_ALPHA;
-    const auto input_channels = U.size() / (outputs * filter_len);
-
-    winograd_transform_in(input, V, input_channels);
-    winograd_sgemm(U, V, M, input_channels, outputs);
-    winograd_transform_out(M, output, outputs);
+void Network::winograd_transform_out(const std::vector<float>& M,
+                                     const int K, const int batch_size,
+                                     const std::vector<float>& means,
+                                     const std::vector<float>& stddivs,
+                                     const float* residual,
+                                     float* Y, float* V,
+                                     SMP::WorkerGroup* const group) {
+    split_work(group, K, [&](const size_t begin, const size_t end) {
+        winograd_kernels.transform_out(M.data(), K, batch_size,
+                                       means.data(), stddivs.data(),
+                                       residual, Y, V, int(begin), int(end));
+    });
 }
 
 template<unsigned int filter_size>
-void convolve(const size_t outputs,
+void convolve(const size_t batch_size,
+              const size_t outputs,
               const std::vector<float>& input,
               const std::vector<float>& weights,
               const std::vector<float>& biases,
@@ -666,33 +1197,43 @@ void convolve(const size_t outputs,
     constexpr auto filter_len = filter_size * filter_size;
     const auto input_channels = weights.size() / (biases.size() * filter_len);
     const auto filter_dim = filter_len * input_channels;
-    assert(outputs * board_squares == output.size());
-
-    std::vector<float> col(filter_dim * width * height);
-    im2col<filter_size>(input_channels, input, col);
-
-    // Weight shape (output, input, filter_size, filter_size)
-    // 96 18 3 3
-    // C←αAB + βC
-    // outputs[96,19x19] = weights[96,18x3x3] x col[18x3x3,19x19]
-    // M Number of rows in matrices A and C.
-    // N Number of columns in matrices B and C.
-    // K Number of columns in matrix A; number of rows in matrix B.
-    // lda The size of the first dimention of matrix A; if you are
-    // passing a matrix A[m][n], the value should be m.
-    //    cblas_sgemm(CblasRowMajor, TransA, TransB, M, N, K, alpha, A, lda, B,
-    //                ldb, beta, C, N);
-
-    cblas_sgemm(CblasRowMajor, CblasNoTrans, CblasNoTrans,
-                // M        N            K
-                outputs, board_squares, filter_dim,
-                1.0f, &weights[0], filter_dim,
-                &col[0], board_squares,
-                0.0f, &output[0], board_squares);
-
-    for (unsigned int o = 0; o < outputs; o++) {
-        for (unsigned int b = 0; b < board_squares; b++) {
-            output[(o * board_squares) + b] += biases[o];
+    assert(batch_size * outputs * board_squares == output.size());
+
+    // A 1x1 filter reads the input as it is.
+    std::vector<float> col(filter_size == 1 ? 0 : filter_dim * width * height);
+
+    for (auto n = size_t{0}; n < batch_size; n++) {
+        const auto in_offset = n * input_channels * board_squares;
+        const auto out_offset = n * outputs * board_squares;
+        auto cols = &input[in_offset];
+        if (filter_size != 1) {
+            im2col<filter_size>(input_channels, &input[in_offset], col);
+            cols = col.data();
+        }
+
+        // Weight shape (output, input, filter_size, filter_size)
+        // 96 18 3 3
+        // C←αAB + βC
+        // outputs[96,19x19] = weights[96,18x3x3] x col[18x3x3,19x19]
+        // M Number of rows in matrices A and C.
+        // N Number of columns in matrices B and C.
+        // K Number of columns in matrix A; number of rows in matrix B.
+        // lda The size of the first dimention of matrix A; if you are
+        // passing a matrix A[m][n], the value should be m.
+        //    cblas_sgemm(CblasRowMajor, TransA, TransB, M, N, K, alpha, A, lda, B,
+        //                ldb, beta, C, N);
+
+        cblas_sgemm(CblasRowMajor, CblasNoTrans, CblasNoTrans,
+                    // M        N            K
+                    outputs, board_squares, filter_dim,
+                    1.0f, &weights[0], filter_dim,
+                    cols, board_squares,
+                    0.0f, &output[out_offset], board_squares);
+
+        for (unsigned int o = 0; o < outputs; o++) {
+            for (unsigned int b = 0; b < board_squares; b++) {
+                output[out_offset + (o * board_squares) + b] += biases[o];
+            }
         }
     }
 }
@@ -701,33 +1242,44 @@ template<unsigned int inputs,
          unsigned int outputs,
          bool ReLU,
          size_t W>
-std::vector<float> innerproduct(const std::vector<float>& input,
-                                const std::array<float, W>& weights,
-                                const std::array<float, outputs>& biases) {
-    std::vector<float> output(outputs);
-
-    cblas_sgemv(CblasRowMajor, CblasNoTrans,
-                // M     K
-                outputs, inputs,
-                1.0f, &weights[0], inputs,
-                &input[0], 1,
-                0.0f, &output[0], 1);
+void innerproduct(const size_t batch_size,
+                  const std::vector<float>& input,
+                  const std::array<float, W>& weights,
+                  const std::array<float, outputs>& biases,
+                  std::vector<float>& output) {
+    output.resize(batch_size * outputs);
+    // The products are added to the biases.
+    for (auto n = size_t{0}; n < batch_size; n++) {
+        std::copy(cbegin(biases), cend(biases), begin(output) + n * outputs);
+    }
 
-    const auto lambda_ReLU = [](const auto val) { return (val > 0.0f) ?
-                                                          val : 0.0f; };
-    for (unsigned int o = 0; o < outputs; o++) {
-        auto val = biases[o] + output[o];
-        if (ReLU) {
-            val = lambda_ReLU(val);
-        }
-        output[o] = val;
+    if (batch_size == 1) {
+        cblas_sgemv(CblasRowMajor, CblasNoTrans,
+                    // M     K
+                    outputs, inputs,
+                    1.0f, &weights[0], inputs,
+                    &input[0], 1,
+                    1.0f, &output[0], 1);
+    } else {
+        // output[batch, outputs] = input[batch, inputs] x weights^T
+        cblas_sgemm(CblasRowMajor, CblasNoTrans, CblasTrans,
+                    // M          N        K
+                    batch_size, outputs, inputs,
+                    1.0f, &input[0], inputs,
+                    &weights[0], inputs,
+                    1.0f, &output[0], outputs);
     }
 
-    return output;
+    if (ReLU) {
+        for (auto& val : output) {
+            val = std::max(0.0f, val);
+        }
+    }
 }
 
 template <size_t spatial_size>
-void batchnorm(const size_t channels,
+void batchnorm(const size_t batch_size,
+               const size_t channels,
                std::vector<float>& data,
                const float* const means,
                const float* const stddivs,
@@ -735,20 +1287,21 @@ void batchnorm(const size_t channels,
 {
     const auto lambda_ReLU = [](const auto val) { return (val > 0.0f) ?
                                                           val : 0.0f; };
-    for (auto c = size_t{0}; c < channels; ++c) {
+    for (auto nc = size_t{0}; nc < batch_size * channels; ++nc) {
+        const auto c = nc % channels;
         const auto mean = means[c];
         const auto scale_stddiv = stddivs[c];
 
         if (eltwise == nullptr) {
             // Classical BN
-            const auto arr = &data[c * spatial_size];
+            const auto arr = &data[nc * spatial_size];
             for (auto b = size_t{0}; b < spatial_size; b++) {
                 arr[b] = lambda_ReLU(scale_stddiv * (arr[b] - mean));
             }
         } else {
             // BN + residual add
-            const auto arr = &data[c * spatial_size];
-            const auto res = &eltwise[c * spatial_size];
+            const auto arr = &data[nc * spatial_size];
+            const auto res = &eltwise[nc * spatial_size];
             for (auto b = size_t{0}; b < spatial_size; b++) {
                 arr[b] = lambda_ReLU((scale_stddiv * (arr[b] - mean)) + res[b]);
             }
@@ -756,13 +1309,50 @@ void batchnorm(const size_t channels,
     }
 }
 
+// Inner product and softmax of the policy head, from the outputs of the
+// head convolution. Writes BOARD_SQUARES + 1 probabilities per board.
+static void policy_head(const size_t batch_size,
+                        const std::vector<float>& policy_data,
+                        std::vector<float>& policy_out) {
+    constexpr auto outputs = BOARD_SQUARES + 1;
+    innerproduct<Network::OUTPUTS_POLICY * BOARD_SQUARES, outputs, false>(
+        batch_size, policy_data, ip_pol_w, ip_pol_b, policy_out);
+    for (auto n = size_t{0}; n < batch_size; n++) {
+        const auto logits = &policy_out[n * outputs];
+        head_kernels.softmax(logits, logits, outputs, cfg_softmax_temp);
+    }
+}
+
+// Inner products of the value head, from the outputs of the head
+// convolution. Writes one winrate per board, tanh rescaled to [0, 1].
+static void value_head(const size_t batch_size,
+                       const std::vector<float>& value_data,
+                       std::vector<float>& hidden,
+                       std::vector<float>& winrate_out) {
+    innerproduct<BOARD_SQUARES, 256, true>(batch_size, value_data,
+                                           ip1_val_w, ip1_val_b, hidden);
+    innerproduct<256, 1, false>(batch_size, hidden,
+                                ip2_val_w, ip2_val_b, winrate_out);
+    for (auto& winrate : winrate_out) {
+        winrate = (1.0f + std::tanh(winrate)) / 2.0f;
+    }
+}
+
 void Network::forward_cpu(const std::vector<float>& input,
                           std::vector<float>& output_pol,
                           std::vector<float>& output_val) {
+    forward_cpu_batch(1, input, output_pol, output_val);
+}
+
+void Network::forward_cpu_batch(const int batch_size,
+                                const std::vector<float>& input,
+                                std::vector<float>& output_pol,
+                                std::vector<float>& output_val) {
     // Input convolution
     constexpr auto width = BOARD_SIZE;
     constexpr auto height = BOARD_SIZE;
-    constexpr auto tiles = (width + 1) * (height + 1) / 4;
+    const auto alpha = Winograd::get_alpha(winograd_m);
+    const auto tiles = Winograd::get_tiles(winograd_m);
     // Calculate output channels
     const auto output_channels = conv_biases[0].size();
     // input_channels is the maximum number of input channels of any
@@ -770,40 +1360,613 @@ void Network::forward_cpu(const std::vector<float>& input,
     // might be bigger when the network has very few filters
     const auto input_channels = std::max(static_cast<size_t>(output_channels),
                                          static_cast<size_t>(INPUT_CHANNELS));
-    auto conv_out = std::vector<float>(output_channels * width * height);
+    auto& workspace = get_workspace();
+    auto& conv_out = workspace.conv_out;
+    conv_out.resize(batch_size * output_channels * width * height);
+
+    auto& V = workspace.V;
+    V.resize(batch_size * alpha * alpha * input_channels * tiles);
+    auto& M = workspace.M;
+    M.resize(batch_size * alpha * alpha * output_channels * tiles);
+    auto& Vq = workspace.Vq;
+    if (int8_enabled) {
+        Vq.resize(alpha * alpha * Int8::get_padded_channels(input_channels)
+                  * Int8::get_padded_tiles(batch_size * tiles));
+    }
 
-    auto V = std::vector<float>(WINOGRAD_TILE * input_channels * tiles);
-    auto M = std::vector<float>(WINOGRAD_TILE * output_channels * tiles);
+    // In latency mode, split the evaluation across a free worker group.
+    auto group = static_cast<SMP::WorkerGroup*>(nullptr);
+    auto group_lock = std::unique_lock<SMP::WorkerGroup>{};
+    for (const auto& candidate : worker_groups) {
+        group_lock = std::unique_lock<SMP::WorkerGroup>(*candidate,
+                                                        std::try_to_lock);
+        if (group_lock.owns_lock()) {
+            group = candidate.get();
+            break;
+        }
+    }
 
-    winograd_convolve3(output_channels, input, conv_weights[0], V, M, conv_out);
-    batchnorm<BOARD_SQUARES>(output_channels, conv_out,
-                             batchnorm_means[0].data(),
-                             batchnorm_stddivs[0].data());
+    // The output transforms apply batchnorm, the residual add and ReLU,
+    // and write the input tiles of the next convolution directly. Only
+    // the outputs of the residual blocks are stored in conv_out.
+    const auto has_tower = winograd_filters.size() > 1;
+    winograd_transform_in(input, V, INPUT_CHANNELS, batch_size, group);
+    winograd_multiply(0, V, Vq, M,
+                      INPUT_CHANNELS, output_channels, batch_size, group);
+    winograd_transform_out(M, output_channels, batch_size,
+                           batchnorm_means[0], batchnorm_stddivs[0],
+                           nullptr, conv_out.data(),
+                           has_tower ? V.data() : nullptr, group);
 
     // Residual tower
-    auto conv_in = std::vector<float>(output_channels * width * height);
-    auto res = std::vector<float>(output_channels * width * height);
-    for (auto i = size_t{1}; i < conv_weights.size(); i += 2) {
-        auto output_channels = conv_biases[i].size();
-        std::swap(conv_out, conv_in);
-        winograd_convolve3(output_channels, conv_in,
-                           conv_weights[i], V, M, conv_out);
-        batchnorm<BOARD_SQUARES>(output_channels, conv_out,
-                                 batchnorm_means[i].data(),
-                                 batchnorm_stddivs[i].data());
-
-        output_channels = conv_biases[i + 1].size();
-        std::swap(conv_in, res);
-        std::swap(conv_out, conv_in);
-        winograd_convolve3(output_channels, conv_in,
-                           conv_weights[i + 1], V, M, conv_out);
-        batchnorm<BOARD_SQUARES>(output_channels, conv_out,
-                                 batchnorm_means[i + 1].data(),
-                                 batchnorm_stddivs[i + 1].data(),
-                                 res.data());
-    }
-    convolve<1>(OUTPUTS_POLICY, conv_out, conv_pol_w, conv_pol_b, output_pol);
-    convolve<1>(OUTPUTS_VALUE, conv_out, conv_val_w, conv_val_b, output_val);
+    for (auto i = size_t{1}; i < winograd_filters.size(); i += 2) {
+        const auto last_block = i + 2 >= winograd_filters.size();
+        winograd_multiply(i, V, Vq, M,
+                          output_channels, output_channels, batch_size, group);
+        winograd_transform_out(M, output_channels, batch_size,
+                               batchnorm_means[i], batchnorm_stddivs[i],
+                               nullptr, nullptr, V.data(), group);
+
+        winograd_multiply(i + 1, V, Vq, M,
+                          output_channels, output_channels, batch_size, group);
+        winograd_transform_out(M, output_channels, batch_size,
+                               batchnorm_means[i + 1],
+                               batchnorm_stddivs[i + 1],
+                               conv_out.data(), conv_out.data(),
+                               last_block ? nullptr : V.data(), group);
+    }
+    // Both head convolutions, with their batchnorm and ReLU
+    split_work(group, batch_size, [&](const size_t begin, const size_t end) {
+        for (auto n = begin; n < end; n++) {
+            head_kernels.convolve(
+                head_weights, &conv_out[n * output_channels * BOARD_SQUARES],
+                &output_pol[n * OUTPUTS_POLICY * BOARD_SQUARES],
+                &output_val[n * OUTPUTS_VALUE * BOARD_SQUARES]);
+        }
+    });
+}
+
+void Network::benchmark_winograd(const int iterations) {
+    const auto channels = int(batchnorm_means[0].size());
+
+    auto dist = std::uniform_real_distribution<float>{-1.0f, 1.0f};
+    auto in = std::vector<float>(channels * BOARD_SQUARES);
+    for (auto& val : in) {
+        val = dist(Random::get_Rng());
+    }
+    auto f = std::vector<float>(channels * channels * 9);
+    for (auto& val : f) {
+        val = dist(Random::get_Rng());
+    }
+
+    // The output transform is run as at the end of a residual block,
+    // with the input as residual and an identity batchnorm. The direct
+    // convolution is the reference for every variant.
+    const auto means = std::vector<float>(channels, 0.0f);
+    const auto stddivs = std::vector<float>(channels, 1.0f);
+    const auto biases = std::vector<float>(channels, 0.0f);
+    auto Y_ref = std::vector<float>(in.size());
+    convolve<3>(1, channels, in, f, biases, Y_ref);
+    for (auto i = size_t{0}; i < Y_ref.size(); i++) {
+        Y_ref[i] = std::max(0.0f, Y_ref[i] + in[i]);
+    }
+
+    for (const auto m : {2, 4}) {
+        const auto alpha = Winograd::get_alpha(m);
+        const auto U = winograd_transform_f(f, channels, channels, m);
+        const auto tiles_size = alpha * alpha * channels
+                                * Winograd::get_tiles(m);
+
+        for (const auto& kernels : Winograd::get_available_kernels(m)) {
+            auto V = std::vector<float>(tiles_size);
+            auto M = std::vector<float>(tiles_size);
+            auto V_next = std::vector<float>(tiles_size);
+            auto Y = std::vector<float>(in.size());
+
+            const Time start;
+            for (auto i = 0; i < iterations; i++) {
+                kernels.transform_in(in.data(), V.data(), channels, 1,
+                                     0, channels);
+            }
+            const Time transformed_in;
+            for (auto i = 0; i < iterations; i++) {
+                winograd_sgemm(U.data(), V, M, channels, channels, 1, m);
+            }
+            const Time multiplied;
+            for (auto i = 0; i < iterations; i++) {
+                kernels.transform_out(M.data(), channels, 1,
+                                      means.data(), stddivs.data(),
+                                      in.data(), Y.data(), V_next.data(),
+                                      0, channels);
+            }
+            const Time end;
+
+            auto max_error = 0.0f;
+            for (auto i = size_t{0}; i < Y.size(); i++) {
+                max_error = std::max(max_error, std::abs(Y[i] - Y_ref[i]));
+            }
+
+            const auto us = 1e6 / iterations;
+            myprintf("winograd F(%dx%d) %-6s: in %7.1f us, sgemm %7.1f us, "
+                     "out %7.1f us, max error %g\n",
+                     m, m, SIMD::get_name(kernels.level),
+                     Time::timediff_seconds(start, transformed_in) * us,
+                     Time::timediff_seconds(transformed_in, multiplied) * us,
+                     Time::timediff_seconds(multiplied, end) * us,
+                     max_error);
+        }
+    }
+
+    // INT8 and 16 bit weight multiplications for F(2x2). The INT8 inputs
+    // are calibrated on the input itself. The errors are relative to the
+    // largest FP32 output.
+    const auto tiles = Winograd::get_alpha(2) * Winograd::get_alpha(2);
+    const auto BP = Winograd::get_tiles(2);
+    const auto U = winograd_transform_f(f, channels, channels, 2);
+    auto V = std::vector<float>(tiles * channels * BP);
+    auto M_ref = std::vector<float>(tiles * channels * BP);
+    Winograd::transform_in_scalar(in.data(), V.data(), channels, 1,
+                                  0, channels);
+    winograd_sgemm(U.data(), V, M_ref, channels, channels, 1, 2);
+
+    auto scales = std::vector<float>(tiles, 0.0f);
+    for (auto b = 0; b < tiles; b++) {
+        for (auto i = 0; i < channels * BP; i++) {
+            scales[b] = std::max(scales[b], std::abs(V[b * channels * BP + i]));
+        }
+        scales[b] /= 127.0f;
+    }
+    const auto Uq = Int8::quantize_weights(U.data(), tiles, channels, channels);
+    auto Vq = std::vector<std::uint8_t>(
+        tiles * Int8::get_padded_channels(channels) * Int8::get_padded_tiles(BP));
+    auto max_ref = 0.0f;
+    for (const auto val : M_ref) {
+        max_ref = std::max(max_ref, std::abs(val));
+    }
+
+    for (const auto& kernels : Int8::get_available_kernels()) {
+        auto M = std::vector<float>(M_ref.size());
+        const Time start;
+        for (auto i = 0; i < iterations; i++) {
+            kernels.quantize_input(V.data(), tiles, channels, BP,
+                                   scales.data(), Vq.data());
+        }
+        const Time quantized;
+        for (auto i = 0; i < iterations; i++) {
+            kernels.gemm(Uq, Vq.data(), scales.data(), BP, M.data());
+        }
+        const Time end;
+
+        auto max_error = 0.0f;
+        for (auto i = size_t{0}; i < M.size(); i++) {
+            max_error = std::max(max_error, std::abs(M[i] - M_ref[i]));
+        }
+
+        const auto us = 1e6 / iterations;
+        myprintf("winograd F(2x2) int8 %-10s: quantize %7.1f us, "
+                 "gemm %7.1f us, max error %g\n",
+                 SIMD::get_name(kernels.level),
+                 Time::timediff_seconds(start, quantized) * us,
+                 Time::timediff_seconds(quantized, end) * us,
+                 max_error / max_ref);
+    }
+
+    for (const auto storage : {Gemm::FP16, Gemm::BF16}) {
+        const auto W = Gemm::pack_weights(U.data(), tiles, channels, channels,
+                                          storage);
+        for (const auto& kernels : Gemm::get_available_kernels()) {
+            auto M = std::vector<float>(M_ref.size());
+            const Time start;
+            for (auto i = 0; i < iterations; i++) {
+                kernels.multiply(W, V.data(), BP, M.data(),
+                                 0, Gemm::get_blocks(W));
+            }
+            const Time end;
+
+            auto max_error = 0.0f;
+            for (auto i = size_t{0}; i < M.size(); i++) {
+                max_error = std::max(max_error, std::abs(M[i] - M_ref[i]));
+            }
+            myprintf("winograd F(2x2) %s %-10s: gemm %7.1f us, max error %g\n",
+                     Gemm::get_name(storage), SIMD::get_name(kernels.level),
+                     Time::timediff_seconds(start, end) * 1e6 / iterations,
+                     max_error / max_ref);
+        }
+    }
+}
+
+std::vector<Network::NNPlanes> Network::get_calibration_positions() {
+    auto positions = std::vector<NNPlanes>{};
+    if (!cfg_int8_calibration.empty()) {
+        const auto games = SGFParser::chop_all(cfg_int8_calibration);
+        for (const auto& game : games) {
+            auto sgftree = std::make_unique<SGFTree>();
+            try {
+                sgftree->load_from_string(game);
+            } catch (...) {
+                continue;
+            }
+            auto state = sgftree->follow_mainline_state();
+            if (state.board.get_boardsize() != BOARD_SIZE) {
+                continue;
+            }
+            state.rewind();
+            do {
+                if (positions.size() >= CALIBRATION_POSITIONS) {
+                    return positions;
+                }
+                auto planes = NNPlanes{};
+                gather_features(&state, planes);
+                positions.emplace_back(std::move(planes));
+            } while (state.forward_move());
+        }
+        if (positions.empty()) {
+            myprintf("No positions found in %s.\n",
+                     cfg_int8_calibration.c_str());
+        } else {
+            return positions;
+        }
+    }
+
+    // Sample games from the FP32 policy.
+    auto state = GameState{};
+    state.init_game(BOARD_SIZE, 7.5f);
+    while (positions.size() < CALIBRATION_POSITIONS) {
+        auto planes = NNPlanes{};
+        gather_features(&state, planes);
+        const auto result = get_scored_moves_internal(planes, 0);
+        positions.emplace_back(std::move(planes));
+
+        const auto to_move = state.get_to_move();
+        auto moves = std::vector<int>{FastBoard::PASS};
+        auto weights = std::vector<float>{result.policy_pass};
+        for (auto idx = 0; idx < BOARD_SQUARES; idx++) {
+            const auto vertex = state.board.get_vertex(idx % BOARD_SIZE,
+                                                       idx / BOARD_SIZE);
+            if (state.is_move_legal(to_move, vertex)) {
+                moves.emplace_back(vertex);
+                weights.emplace_back(result.policy[idx]);
+            }
+        }
+        auto dist = std::discrete_distribution<size_t>(cbegin(weights),
+                                                       cend(weights));
+        const auto move = moves[dist(Random::get_Rng())];
+        if (move == FastBoard::PASS || state.get_movenum() >= 300) {
+            state.init_game(BOARD_SIZE, 7.5f);
+        } else {
+            state.play_move(move);
+        }
+    }
+    return positions;
+}
+
+void Network::benchmark_gemm(const int iterations) {
+    const auto channels = int(batchnorm_means[0].size());
+    const auto tiles = Winograd::get_alpha(winograd_m)
+                       * Winograd::get_alpha(winograd_m);
+
+    auto dist = std::uniform_real_distribution<float>{-1.0f, 1.0f};
+    auto U = std::vector<float>(tiles * channels * channels);
+    for (auto& val : U) {
+        val = dist(Random::get_Rng());
+    }
+    const auto W = Gemm::pack_weights(U.data(), tiles, channels, channels,
+                                      Gemm::FP32);
+
+    // The tile multiplications of one convolution, in BLAS and in the
+    // packed kernels. The errors are relative to the largest output.
+    for (auto batch_size = 1; batch_size <= 32; batch_size *= 2) {
+        const auto BP = batch_size * Winograd::get_tiles(winograd_m);
+        auto V = std::vector<float>(tiles * channels * BP);
+        for (auto& val : V) {
+            val = dist(Random::get_Rng());
+        }
+        auto M_ref = std::vector<float>(tiles * channels * BP);
+        const auto runs = std::max(1, iterations / batch_size);
+        const auto flops = 2.0 * tiles * channels * channels * BP * runs;
+
+        const Time start;
+        for (auto i = 0; i < runs; i++) {
+            winograd_sgemm(U.data(), V, M_ref, channels, channels,
+                           batch_size, winograd_m);
+        }
+        const Time end;
+        auto line = boost::str(boost::format("gemm batch %2d: blas %6.1f")
+            % batch_size % (flops / Time::timediff_seconds(start, end) / 1e9));
+
+        auto max_ref = 0.0f;
+        for (const auto val : M_ref) {
+            max_ref = std::max(max_ref, std::abs(val));
+        }
+        for (const auto& kernels : Gemm::get_available_kernels()) {
+            auto M = std::vector<float>(M_ref.size());
+            const Time kernel_start;
+            for (auto i = 0; i < runs; i++) {
+                kernels.multiply(W, V.data(), BP, M.data(),
+                                 0, Gemm::get_blocks(W));
+            }
+            const Time kernel_end;
+
+            auto max_error = 0.0f;
+            for (auto i = size_t{0}; i < M.size(); i++) {
+                max_error = std::max(max_error, std::abs(M[i] - M_ref[i]));
+            }
+            line += boost::str(boost::format(", %s %6.1f (error %.1e)")
+                % SIMD::get_name(kernels.level)
+                % (flops / Time::timediff_seconds(kernel_start, kernel_end)
+                   / 1e9)
+                % (max_error / max_ref));
+        }
+        myprintf("%s GFLOP/s\n", line.c_str());
+    }
+}
+
+void Network::benchmark_gemm_shapes(const int iterations) {
+    // The standard network shapes, whatever network is loaded, to compare
+    // the kernels across tower widths. The time is that of the tile
+    // multiplications of the residual tower for one position. The scalar
+    // kernel is left out when there are SIMD ones.
+    constexpr std::array<std::pair<int, int>, 5> SHAPES = {{
+        {64, 6}, {128, 10}, {192, 15}, {256, 20}, {256, 40}
+    }};
+    const auto tiles = Winograd::get_alpha(winograd_m)
+                       * Winograd::get_alpha(winograd_m);
+    auto dist = std::uniform_real_distribution<float>{-1.0f, 1.0f};
+
+    for (const auto& shape : SHAPES) {
+        const auto channels = shape.first;
+        const auto convolutions = 2 * shape.second;
+        auto U = std::vector<float>(tiles * channels * channels);
+        for (auto& val : U) {
+            val = dist(Random::get_Rng());
+        }
+        const auto W = Gemm::pack_weights(U.data(), tiles, channels, channels,
+                                          Gemm::FP32);
+
+        for (const auto batch_size : {1, 8}) {
+            const auto BP = batch_size * Winograd::get_tiles(winograd_m);
+            auto V = std::vector<float>(tiles * channels * BP);
+            for (auto& val : V) {
+                val = dist(Random::get_Rng());
+            }
+            auto M = std::vector<float>(tiles * channels * BP);
+            // The same work for every width.
+            const auto runs = std::max(1, iterations * 32 * 32
+                                          / (channels * channels * batch_size));
+            const auto flops = 2.0 * tiles * channels * channels * BP * runs;
+
+            auto line = boost::str(boost::format("gemm %3dx%-2d batch %d:")
+                % channels % shape.second % batch_size);
+            const auto available = Gemm::get_available_kernels();
+            for (const auto& kernels : available) {
+                if (kernels.level == SIMD::SCALAR && available.size() > 1) {
+                    continue;
+                }
+                const Time start;
+                for (auto i = 0; i < runs; i++) {
+                    kernels.multiply(W, V.data(), BP, M.data(),
+                                     0, Gemm::get_blocks(W));
+                }
+                const Time end;
+                const auto seconds = Time::timediff_seconds(start, end);
+                line += boost::str(boost::format(" %s %6.1f GFLOP/s %6.2f ms,")
+                    % SIMD::get_name(kernels.level) % (flops / seconds / 1e9)
+                    % (seconds * 1e3 * convolutions / (runs * batch_size)));
+            }
+            line.pop_back();
+            myprintf("%s\n", line.c_str());
+        }
+    }
+}
+
+void Network::benchmark_heads(const int iterations) {
+    constexpr auto BATCH_SIZE = 8;
+    const auto channels = head_weights.channels;
+
+    auto dist = std::uniform_real_distribution<float>{0.0f, 1.0f};
+    auto in = std::vector<float>(BATCH_SIZE * channels * BOARD_SQUARES);
+    for (auto& val : in) {
+        val = dist(Random::get_Rng());
+    }
+
+    // The scalar kernels are the reference for the others.
+    const auto policy_size = OUTPUTS_POLICY * BOARD_SQUARES;
+    const auto value_size = OUTPUTS_VALUE * BOARD_SQUARES;
+    auto policy_ref = std::vector<float>(BATCH_SIZE * policy_size);
+    auto value_ref = std::vector<float>(BATCH_SIZE * value_size);
+    for (auto n = 0; n < BATCH_SIZE; n++) {
+        Heads::convolve_scalar(head_weights,
+                               &in[n * channels * BOARD_SQUARES],
+                               &policy_ref[n * policy_size],
+                               &value_ref[n * value_size]);
+    }
+    auto logits = std::vector<float>{};
+    innerproduct<OUTPUTS_POLICY * BOARD_SQUARES, BOARD_SQUARES + 1, false>(
+        BATCH_SIZE, policy_ref, ip_pol_w, ip_pol_b, logits);
+    auto probabilities_ref = std::vector<float>(logits.size());
+    for (auto n = 0; n < BATCH_SIZE; n++) {
+        const auto offset = n * (BOARD_SQUARES + 1);
+        Heads::softmax_scalar(&logits[offset], &probabilities_ref[offset],
+                              BOARD_SQUARES + 1, cfg_softmax_temp);
+    }
+
+    for (const auto& kernels : Heads::get_available_kernels()) {
+        auto policy = std::vector<float>(policy_ref.size());
+        auto value = std::vector<float>(value_ref.size());
+        auto policy_out = std::vector<float>{};
+        auto probabilities = std::vector<float>(logits.size());
+        auto hidden = std::vector<float>{};
+        auto winrate = std::vector<float>{};
+
+        const Time start;
+        for (auto i = 0; i < iterations; i++) {
+            for (auto n = 0; n < BATCH_SIZE; n++) {
+                kernels.convolve(head_weights,
+                                 &in[n * channels * BOARD_SQUARES],
+                                 &policy[n * policy_size],
+                                 &value[n * value_size]);
+            }
+        }
+        const Time convolved;
+        for (auto i = 0; i < iterations; i++) {
+            innerproduct<OUTPUTS_POLICY * BOARD_SQUARES, BOARD_SQUARES + 1,
+                         false>(BATCH_SIZE, policy, ip_pol_w, ip_pol_b,
+                                policy_out);
+            for (auto n = 0; n < BATCH_SIZE; n++) {
+                const auto offset = n * (BOARD_SQUARES + 1);
+                kernels.softmax(&policy_out[offset], &probabilities[offset],
+                                BOARD_SQUARES + 1, cfg_softmax_temp);
+            }
+        }
+        const Time policy_done;
+        for (auto i = 0; i < iterations; i++) {
+            value_head(BATCH_SIZE, value, hidden, winrate);
+        }
+        const Time end;
+
+        auto max_error = 0.0f;
+        for (auto i = size_t{0}; i < policy.size(); i++) {
+            max_error = std::max(max_error,
+                                 std::abs(policy[i] - policy_ref[i]));
+        }
+        for (auto i = size_t{0}; i < value.size(); i++) {
+            max_error = std::max(max_error, std::abs(value[i] - value_ref[i]));
+        }
+        for (auto i = size_t{0}; i < probabilities.size(); i++) {
+            max_error = std::max(max_error, std::abs(probabilities[i]
+                                                     - probabilities_ref[i]));
+        }
+
+        const auto us = 1e6 / (iterations * BATCH_SIZE);
+        myprintf("heads %-6s: convolution %6.2f us, policy %6.2f us, "
+                 "value %6.2f us per position, max error %g\n",
+                 SIMD::get_name(kernels.level),
+                 Time::timediff_seconds(start, convolved) * us,
+                 Time::timediff_seconds(convolved, policy_done) * us,
+                 Time::timediff_seconds(policy_done, end) * us,
+                 max_error);
+    }
+}
+
+void Network::benchmark_latency(const GameState* const state,
+                                const int iterations) {
+    const auto cpus = std::max(1, SMP::get_num_cpus());
+    const auto playout = PlayoutState{*state};
+    const auto groups = evaluation_groups;
+    const auto threads = evaluation_threads;
+
+    // Throughput mode runs a single threaded evaluation on every core,
+    // latency mode one evaluation at a time split across all cores.
+    for (const auto latency_mode : {false, true}) {
+        const auto searchers = latency_mode ? 1 : cpus;
+        set_evaluation_threads(searchers, latency_mode ? cpus : 1);
+
+        auto latencies = std::vector<std::vector<double>>(searchers);
+        const auto search = [&](const int searcher) {
+            for (auto i = searcher; i < iterations; i += searchers) {
+                const Time before;
+                get_scored_moves_internal(&playout, i % 8);
+                const Time after;
+                latencies[searcher].emplace_back(
+                    Time::timediff_seconds(before, after) * 1e6);
+            }
+        };
+        const Time started;
+        auto search_threads = std::vector<std::thread>{};
+        for (auto i = 1; i < searchers; i++) {
+            search_threads.emplace_back(search, i);
+        }
+        search(0);
+        for (auto& thread : search_threads) {
+            thread.join();
+        }
+        const Time finished;
+
+        auto all = std::vector<double>{};
+        for (const auto& samples : latencies) {
+            all.insert(end(all), cbegin(samples), cend(samples));
+        }
+        std::sort(begin(all), end(all));
+        const auto percentile = [&all](const int p) {
+            return all[std::min(all.size() - 1, all.size() * p / 100)];
+        };
+        const auto elapsed = Time::timediff_seconds(started, finished);
+        myprintf("%s mode, %d x %d threads: %d n/s, latency p50 %.0f us, "
+                 "p90 %.0f us, p99 %.0f us\n",
+                 latency_mode ? "latency" : "throughput",
+                 searchers, latency_mode ? cpus : 1,
+                 int(all.size() / elapsed),
+                 percentile(50), percentile(90), percentile(99));
+    }
+    set_evaluation_threads(groups, threads);
+}
+
+void Network::initialize_int8() {
+    const auto tiles = Winograd::get_alpha(winograd_m)
+                       * Winograd::get_alpha(winograd_m);
+    const auto channels = int(batchnorm_means[0].size());
+    const auto positions = get_calibration_positions();
+
+    const auto evaluate = [&positions]() {
+        constexpr auto batch_size = size_t{16};
+        auto results = std::vector<Netresult>{};
+        for (auto i = size_t{0}; i < positions.size(); i += batch_size) {
+            const auto last = std::min(positions.size(), i + batch_size);
+            const auto batch = get_scored_moves_internal(
+                std::vector<NNPlanes>(cbegin(positions) + i,
+                                      cbegin(positions) + last),
+                std::vector<int>(last - i, 0));
+            results.insert(end(results), cbegin(batch), cend(batch));
+        }
+        return results;
+    };
+
+    myprintf("Calibrating INT8 on %d positions.\n", int(positions.size()));
+    int8_input_scales.assign(winograd_filters.size(),
+                             std::vector<float>(tiles, 0.0f));
+    int8_calibrating = true;
+    const auto reference = evaluate();
+    int8_calibrating = false;
+
+    int8_weights.clear();
+    for (auto i = size_t{0}; i < winograd_filters.size(); i++) {
+        const auto C = i == 0 ? INPUT_CHANNELS : channels;
+        int8_weights.emplace_back(
+            Int8::quantize_weights(winograd_filters[i], tiles, C, channels));
+        for (auto& scale : int8_input_scales[i]) {
+            // Inputs that were always zero can use any scale.
+            scale = scale > 0.0f ? scale / 127.0f : 1.0f;
+        }
+    }
+    int8_kernels = Int8::get_available_kernels().front();
+    int8_enabled = true;
+    const auto quantized = evaluate();
+
+    const auto best_move = [](const Netresult& result) {
+        const auto best = std::max_element(cbegin(result.policy),
+                                           cend(result.policy));
+        if (result.policy_pass > *best) {
+            return BOARD_SQUARES;
+        }
+        return int(std::distance(cbegin(result.policy), best));
+    };
+    auto agree = 0;
+    auto value_error = 0.0f;
+    auto max_value_error = 0.0f;
+    for (auto i = size_t{0}; i < reference.size(); i++) {
+        if (best_move(reference[i]) == best_move(quantized[i])) {
+            agree++;
+        }
+        const auto error = std::abs(reference[i].winrate
+                                    - quantized[i].winrate);
+        value_error += error;
+        max_value_error = std::max(max_value_error, error);
+    }
+    myprintf("INT8 %s: policy top-1 agreement %.1f%%, "
+             "value error avg %.4f max %.4f\n",
+             SIMD::get_name(int8_kernels.level),
+             100.0f * agree / reference.size(),
+             value_error / reference.size(), max_value_error);
 }
 
 template<typename T>
@@ -849,53 +2012,58 @@ void compare_net_outputs(std::vector<float>& data,
 }
 #endif
 
-std::vector<float> softmax(const std::vector<float>& input,
-                           const float temperature = 1.0f) {
-    auto output = std::vector<float>{};
-    output.reserve(input.size());
 
-    const auto alpha = *std::max_element(cbegin(input), cend(input));
-    auto denom = 0.0f;
-
-    for (const auto in_val : input) {
-        auto val = std::exp((in_val - alpha) / temperature);
-        denom += val;
-        output.push_back(val);
-    }
-
-    for (auto& out : output) {
-        out /= denom;
-    }
-
-    return output;
+Network::Netresult Network::get_scored_moves(
+    const GameState* const state, const Ensemble ensemble,
+    const int symmetry, const bool skip_cache) {
+    const auto playout = PlayoutState{*state};
+    return get_scored_moves(&playout, ensemble, symmetry, skip_cache);
 }
 
 Network::Netresult Network::get_scored_moves(
-    const GameState* const state, const Ensemble ensemble,
+    const PlayoutState* const state, const Ensemble ensemble,
     const int symmetry, const bool skip_cache) {
     Netresult result;
     if (state->board.get_boardsize() != BOARD_SIZE) {
         return result;
     }
 
+    // Mirrored and rotated positions can share one cache entry, which is
+    // kept in the orientation with the smallest hash.
+    const auto cache_symmetry =
+        cfg_cache_symmetry ? state->board.get_canonical_symmetry() : 0;
+    const auto cache_hash = state->board.get_symmetry_hash(cache_symmetry);
+    const auto& cache_idx = symmetry_nn_idx_table[cache_symmetry];
+
     if (!skip_cache) {
         // See if we already have this in the cache.
-        if (NNCache::get_NNCache().lookup(state->board.get_hash(), result)) {
+        if (NNCache::get_NNCache().lookup(cache_hash, result)) {
+            if (cache_symmetry != 0) {
+                const auto policy = result.policy;
+                for (auto idx = 0; idx < BOARD_SQUARES; idx++) {
+                    result.policy[idx] = policy[cache_idx[idx]];
+                }
+            }
             return result;
         }
     }
 
-    NNPlanes planes;
-    gather_features(state, planes);
-
+    auto sym = symmetry;
     if (ensemble == DIRECT) {
         assert(symmetry >= 0 && symmetry <= 7);
-        result = get_scored_moves_internal(planes, symmetry);
     } else {
         assert(ensemble == RANDOM_SYMMETRY);
         assert(symmetry == -1);
-        const auto rand_sym = Random::get_Rng().randfix<8>();
-        result = get_scored_moves_internal(planes, rand_sym);
+        sym = Random::get_Rng().randfix<8>();
+    }
+
+    if (cfg_batch_size > 1) {
+        NNPlanes planes;
+        gather_features(state, planes);
+        result = NNEvaluator::get_NNEvaluator().evaluate(std::move(planes),
+                                                         sym);
+    } else {
+        result = get_scored_moves_internal(state, sym);
     }
 
     // v2 format (ELF Open Go) returns black value, not stm
@@ -906,44 +2074,133 @@ Network::Netresult Network::get_scored_moves(
     }
 
     // Insert result into cache.
-    NNCache::get_NNCache().insert(state->board.get_hash(), result);
+    if (cache_symmetry != 0) {
+        auto canonical = result;
+        for (auto idx = 0; idx < BOARD_SQUARES; idx++) {
+            canonical.policy[cache_idx[idx]] = result.policy[idx];
+        }
+        NNCache::get_NNCache().insert(cache_hash, canonical);
+    } else {
+        NNCache::get_NNCache().insert(cache_hash, result);
+    }
 
     return result;
 }
 
 Network::Netresult Network::get_scored_moves_internal(
     const NNPlanes& planes, const int symmetry) {
+    return get_scored_moves_internal(std::vector<NNPlanes>{planes},
+                                     std::vector<int>{symmetry})[0];
+}
+
+Network::Netresult Network::get_scored_moves_internal(
+    const PlayoutState* const state, const int symmetry) {
     assert(symmetry >= 0 && symmetry <= 7);
+    auto& workspace = get_workspace();
+    workspace.input.resize(INPUT_CHANNELS * BOARD_SQUARES);
+    encode_input(state, symmetry, workspace.input.data());
+
+    auto result = Netresult{};
+    forward(workspace, 1, &symmetry, &result);
+    return result;
+}
+
+std::vector<Network::Netresult> Network::get_scored_moves_internal(
+    const std::vector<NNPlanes>& planes, const std::vector<int>& symmetries) {
+    assert(planes.size() == symmetries.size());
+    constexpr auto input_size = INPUT_CHANNELS * BOARD_SQUARES;
+    const auto batch_size = planes.size();
+    auto& workspace = get_workspace();
+    // Data layout is input[((n * INPUT_CHANNELS + c) * height + h) * width + w]
+    workspace.input.resize(batch_size * input_size);
+    for (auto n = size_t{0}; n < batch_size; n++) {
+        assert(symmetries[n] >= 0 && symmetries[n] <= 7);
+        encode_planes(planes[n], symmetries[n],
+                      workspace.input.data() + n * input_size);
+    }
+
+    auto results = std::vector<Netresult>(batch_size);
+    forward(workspace, batch_size, symmetries.data(), results.data());
+    return results;
+}
+
+Network::Workspace& Network::get_workspace() {
+    thread_local auto workspace = Workspace{};
+    return workspace;
+}
+
+void Network::encode_planes(const NNPlanes& planes, const int symmetry,
+                            net_t* input) {
     assert(INPUT_CHANNELS == planes.size());
-    constexpr auto width = BOARD_SIZE;
-    constexpr auto height = BOARD_SIZE;
-    std::vector<net_t> input_data;
-    std::vector<float> policy_data(OUTPUTS_POLICY * width * height);
-    std::vector<float> value_data(OUTPUTS_VALUE * width * height);
-#ifdef USE_HALF
-    std::vector<net_t> policy_data_n(OUTPUTS_POLICY * width * height);
-    std::vector<net_t> value_data_n(OUTPUTS_VALUE * width * height);
-#endif
-    // Data layout is input_data[(c * height + h) * width + w]
-    input_data.reserve(INPUT_CHANNELS * width * height);
+    const auto& sym_idx = symmetry_nn_idx_table[symmetry];
     for (auto c = 0; c < INPUT_CHANNELS; ++c) {
-        for (auto h = 0; h < height; ++h) {
-            for (auto w = 0; w < width; ++w) {
-                const auto sym_idx = symmetry_nn_idx_table[symmetry][h * width + w];
-                input_data.emplace_back(net_t(planes[c][sym_idx]));
+        for (auto idx = 0; idx < BOARD_SQUARES; ++idx) {
+            *input++ = net_t(planes[c][sym_idx[idx]]);
+        }
+    }
+}
+
+void Network::encode_input(const PlayoutState* const state,
+                           const int symmetry, net_t* input) {
+    const auto& vertices = symmetry_vertex_table[symmetry];
+    const auto blacks_move = state->get_to_move() == FastBoard::BLACK;
+    const auto black_offset = blacks_move ? 0 : INPUT_MOVES;
+    const auto white_offset = blacks_move ? INPUT_MOVES : 0;
+
+    std::fill(input, input + INPUT_CHANNELS * BOARD_SQUARES, net_t(0.0f));
+    const auto moves = std::min<size_t>(state->get_movenum() + 1, INPUT_MOVES);
+    for (auto h = size_t{0}; h < moves; h++) {
+        const auto& board = state->get_past_board(h);
+        const auto black = input + (black_offset + h) * BOARD_SQUARES;
+        const auto white = input + (white_offset + h) * BOARD_SQUARES;
+        for (auto idx = 0; idx < BOARD_SQUARES; idx++) {
+            const auto color = board.get_square(vertices[idx]);
+            if (color == FastBoard::BLACK) {
+                black[idx] = net_t(1.0f);
+            } else if (color == FastBoard::WHITE) {
+                white[idx] = net_t(1.0f);
             }
         }
     }
+
+    const auto to_move = input
+        + (2 * INPUT_MOVES + (blacks_move ? 0 : 1)) * BOARD_SQUARES;
+    std::fill(to_move, to_move + BOARD_SQUARES, net_t(1.0f));
+}
+
+void Network::forward(Workspace& workspace, const size_t batch_size,
+                      const int* symmetries, Netresult* results) {
+    constexpr auto width = BOARD_SIZE;
+    constexpr auto height = BOARD_SIZE;
+    constexpr auto policy_size = OUTPUTS_POLICY * width * height;
+    constexpr auto value_size = OUTPUTS_VALUE * width * height;
+    const auto& input_data = workspace.input;
+    auto& policy_data = workspace.policy_data;
+    auto& value_data = workspace.value_data;
+    policy_data.resize(batch_size * policy_size);
+    value_data.resize(batch_size * value_size);
+    assert(input_data.size() == batch_size * INPUT_CHANNELS * width * height);
 #ifdef USE_OPENCL
-#ifdef USE_HALF
-    opencl.forward(input_data, policy_data_n, value_data_n);
-    std::copy(begin(policy_data_n), end(policy_data_n), begin(policy_data));
-    std::copy(begin(value_data_n), end(value_data_n), begin(value_data));
-#else
-    opencl.forward(input_data, policy_data, value_data);
-#endif
+    constexpr auto input_size = INPUT_CHANNELS * width * height;
+    // The OpenCL pipeline evaluates one position at a time.
+    std::vector<net_t> input_data_n(input_size);
+    std::vector<net_t> policy_data_n(policy_size);
+    std::vector<net_t> value_data_n(value_size);
+    for (auto n = size_t{0}; n < batch_size; n++) {
+        std::copy_n(begin(input_data) + n * input_size, input_size,
+                    begin(input_data_n));
+        opencl.forward(input_data_n, policy_data_n, value_data_n);
+        std::copy(begin(policy_data_n), end(policy_data_n),
+                  begin(policy_data) + n * policy_size);
+        std::copy(begin(value_data_n), end(value_data_n),
+                  begin(value_data) + n * value_size);
+    }
+    batchnorm<BOARD_SQUARES>(batch_size, OUTPUTS_POLICY, policy_data,
+        bn_pol_w1.data(), bn_pol_w2.data());
+    batchnorm<BOARD_SQUARES>(batch_size, OUTPUTS_VALUE, value_data,
+        bn_val_w1.data(), bn_val_w2.data());
 #elif defined(USE_BLAS) && !defined(USE_OPENCL)
-    forward_cpu(input_data, policy_data, value_data);
+    forward_cpu_batch(batch_size, input_data, policy_data, value_data);
 #endif
 #ifdef USE_OPENCL_SELFCHECK
     // Both implementations are available, self-check the OpenCL driver by
@@ -951,42 +2208,32 @@ Network::Netresult Network::get_scored_moves_internal(
     if (Random::get_Rng().randfix<SELFCHECK_PROBABILITY>() == 0) {
         auto cpu_policy_data = std::vector<float>(policy_data.size());
         auto cpu_value_data = std::vector<float>(value_data.size());
-        forward_cpu(input_data, cpu_policy_data, cpu_value_data);
+        forward_cpu_batch(batch_size, input_data,
+                          cpu_policy_data, cpu_value_data);
         compare_net_outputs(policy_data, cpu_policy_data);
         compare_net_outputs(value_data, cpu_value_data);
     }
 #endif
 
     // Get the moves
-    batchnorm<BOARD_SQUARES>(OUTPUTS_POLICY, policy_data,
-        bn_pol_w1.data(), bn_pol_w2.data());
-    const auto policy_out =
-        innerproduct<OUTPUTS_POLICY * BOARD_SQUARES, BOARD_SQUARES + 1, false>(
-            policy_data, ip_pol_w, ip_pol_b);
-    const auto outputs = softmax(policy_out, cfg_softmax_temp);
+    auto& policy_out = workspace.policy_out;
+    policy_head(batch_size, policy_data, policy_out);
 
     // Now get the score
-    batchnorm<BOARD_SQUARES>(OUTPUTS_VALUE, value_data,
-        bn_val_w1.data(), bn_val_w2.data());
-    const auto winrate_data =
-        innerproduct<BOARD_SQUARES, 256, true>(value_data, ip1_val_w, ip1_val_b);
-    const auto winrate_out =
-        innerproduct<256, 1, false>(winrate_data, ip2_val_w, ip2_val_b);
-
-    // Sigmoid
-    const auto winrate_sig = (1.0f + std::tanh(winrate_out[0])) / 2.0f;
-
-    Netresult result;
+    auto& winrate_out = workspace.winrate_out;
+    value_head(batch_size, value_data, workspace.winrate_data, winrate_out);
+
+    for (auto n = size_t{0}; n < batch_size; n++) {
+        const auto outputs = &policy_out[n * (BOARD_SQUARES + 1)];
+        auto& result = results[n];
+        for (auto idx = size_t{0}; idx < BOARD_SQUARES; idx++) {
+            const auto sym_idx = symmetry_nn_idx_table[symmetries[n]][idx];
+            result.policy[sym_idx] = outputs[idx];
+        }
 
-    for (auto idx = size_t{0}; idx < BOARD_SQUARES; idx++) {
-        const auto sym_idx = symmetry_nn_idx_table[symmetry][idx];
-        result.policy[sym_idx] = outputs[idx];
+        result.policy_pass = outputs[BOARD_SQUARES];
+        result.winrate = winrate_out[n];
     }
-
-    result.policy_pass = outputs[BOARD_SQUARES];
-    result.winrate = winrate_sig;
-
-    return result;
 }
 
 void Network::show_heatmap(const FastState* const state,
@@ -1064,6 +2311,14 @@ void Network::fill_input_plane_pair(const FullBoard& board,
 }
 
 void Network::gather_features(const GameState* const state, NNPlanes & planes) {
+    const auto playout = PlayoutState{*state};
+    gather_features(&playout, planes);
+}
+
+void Network::gather_features(const PlayoutState* const state,
+                              NNPlanes & planes) {
+    static_assert(INPUT_MOVES <= PlayoutState::HISTORY_BOARDS,
+                  "Playouts keep too few boards for the input planes.");
     planes.resize(INPUT_CHANNELS);
     auto& black_to_move = planes[2 * INPUT_MOVES];
     auto& white_to_move = planes[2 * INPUT_MOVES + 1];
@@ -1093,32 +2348,10 @@ void Network::gather_features(const GameState* const state, NNPlanes & planes) {
 int Network::get_nn_idx_symmetry(const int vertex, int symmetry) {
     assert(vertex >= 0 && vertex < BOARD_SQUARES);
     assert(symmetry >= 0 && symmetry < 8);
-    auto x = vertex % BOARD_SIZE;
-    auto y = vertex / BOARD_SIZE;
-    int newx;
-    int newy;
-
-    if (symmetry >= 4) {
-        std::swap(x, y);
-        symmetry -= 4;
-    }
-
-    if (symmetry == 0) {
-        newx = x;
-        newy = y;
-    } else if (symmetry == 1) {
-        newx = x;
-        newy = BOARD_SIZE - y - 1;
-    } else if (symmetry == 2) {
-        newx = BOARD_SIZE - x - 1;
-        newy = y;
-    } else {
-        assert(symmetry == 3);
-        newx = BOARD_SIZE - x - 1;
-        newy = BOARD_SIZE - y - 1;
-    }
+    const auto xy = std::make_pair(vertex % BOARD_SIZE, vertex / BOARD_SIZE);
+    const auto newxy = FastBoard::get_symmetry(xy, symmetry, BOARD_SIZE);
 
-    const auto newvtx = (newy * BOARD_SIZE) + newx;
+    const auto newvtx = (newxy.second * BOARD_SIZE) + newxy.first;
     assert(newvtx >= 0 && newvtx < BOARD_SQUARES);
     return newvtx;
 }
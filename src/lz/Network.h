@@ -23,6 +23,7 @@
 
 #include <array>
 #include <bitset>
+#include <cstdint>
 #include <memory>
 #include <string>
 #include <utility>
@@ -31,6 +32,8 @@
 
 #include "FastState.h"
 #include "GameState.h"
+#include "PlayoutState.h"
+#include "SMP.h"
 
 class Network {
 public:
@@ -43,7 +46,7 @@ public:
 
     struct Netresult {
         // 19x19 board positions
-        std::vector<float> policy;
+        std::array<float, BOARD_SQUARES> policy;
 
         // pass
         float policy_pass;
@@ -51,13 +54,21 @@ public:
         // winrate
         float winrate;
 
-        Netresult() : policy(BOARD_SQUARES), policy_pass(0.0f), winrate(0.0f) {}
+        Netresult() : policy{}, policy_pass(0.0f), winrate(0.0f) {}
     };
 
     static Netresult get_scored_moves(const GameState* const state,
                                       const Ensemble ensemble,
                                       const int symmetry = -1,
                                       const bool skip_cache = false);
+    static Netresult get_scored_moves(const PlayoutState* const state,
+                                      const Ensemble ensemble,
+                                      const int symmetry = -1,
+                                      const bool skip_cache = false);
+    // Evaluates several positions in one forward pass. Results are not
+    // cached and not adjusted for the value head convention.
+    static std::vector<Netresult> get_scored_moves_internal(
+      const std::vector<NNPlanes>& planes, const std::vector<int>& symmetries);
     // File format version
     static constexpr auto INPUT_MOVES = 8;
     static constexpr auto INPUT_CHANNELS = 2 * INPUT_MOVES + 2;
@@ -69,48 +80,109 @@ public:
     static constexpr auto WINOGRAD_TILE = WINOGRAD_ALPHA * WINOGRAD_ALPHA;
 
     static void initialize();
+    // Writes the weights file as a binary file, with the filters
+    // transformed for F(cfg_winograd_tile x cfg_winograd_tile, 3x3).
+    static bool convert_network(const std::string& filename,
+                                const std::string& binary_filename);
     static void benchmark(const GameState * const state,
                           const int iterations = 1600);
     static void show_heatmap(const FastState * const state,
                              const Netresult & netres, const bool topmoves);
 
     static void gather_features(const GameState* const state, NNPlanes& planes);
+    static void gather_features(const PlayoutState* const state,
+                                NNPlanes& planes);
+    // Network input of one position, transformed by the symmetry, from
+    // its planes or straight from the state. Both must give the same
+    // input.
+    static void encode_planes(const NNPlanes& planes, const int symmetry,
+                              net_t* input);
+    static void encode_input(const PlayoutState* const state,
+                             const int symmetry, net_t* input);
 private:
-    static std::pair<int, int> load_v1_network(std::istream& wtfile);
+    // Lines of a text weights file, as [begin, end) offsets into the text
+    using TextLines = std::vector<std::pair<size_t, size_t>>;
+    static std::pair<int, int> load_v1_network(const std::vector<char>& text,
+                                               const TextLines& lines);
     static std::pair<int, int> load_network_file(const std::string& filename);
-    static void process_bn_var(std::vector<float>& weights,
+    // Loads a text or binary weights file, ready for the forward pass.
+    static std::pair<int, int> load_network(const std::string& filename);
+    static std::pair<int, int> load_binary_network(const std::string& filename);
+    // Transforms the filters of a text network and folds the biases
+    // into the batchnorm means.
+    static void prepare_network(const int channels, const int residual_blocks);
+    static void process_bn_var(float* weights, const size_t size,
                                const float epsilon = 1e-5f);
 
     static std::vector<float> winograd_transform_f(const std::vector<float>& f,
-        const int outputs, const int channels);
-    static std::vector<float> zeropad_U(const std::vector<float>& U,
+        const int outputs, const int channels, const int m = 2);
+    static std::vector<float> zeropad_U(const float* U,
         const int outputs, const int channels,
         const int outputs_pad, const int channels_pad);
+    // The Winograd steps are split across group when it is not null.
     static void winograd_transform_in(const std::vector<float>& in,
                                       std::vector<float>& V,
-                                      const int C);
+                                      const int C, const int batch_size = 1,
+                                      SMP::WorkerGroup* group = nullptr);
+    // Output transform fused with batchnorm, the optional residual add
+    // and ReLU. Y and V may be null, see Winograd::TransformOut.
     static void winograd_transform_out(const std::vector<float>& M,
-                                       std::vector<float>& Y,
-                                       const int K);
-    static void winograd_convolve3(const int outputs,
-                                   const std::vector<float>& input,
-                                   const std::vector<float>& U,
-                                   std::vector<float>& V,
-                                   std::vector<float>& M,
-                                   std::vector<float>& output);
-    static void winograd_sgemm(const std::vector<float>& U,
+                                       const int K, const int batch_size,
+                                       const std::vector<float>& means,
+                                       const std::vector<float>& stddivs,
+                                       const float* residual,
+                                       float* Y, float* V,
+                                       SMP::WorkerGroup* group = nullptr);
+    static void winograd_sgemm(const float* U,
                                const std::vector<float>& V,
-                               std::vector<float>& M, const int C, const int K);
+                               std::vector<float>& M, const int C, const int K,
+                               const int batch_size, const int m,
+                               SMP::WorkerGroup* group = nullptr);
+    // M = U^T V for convolution number layer, in INT8 when enabled.
+    static void winograd_multiply(const size_t layer,
+                                  const std::vector<float>& V,
+                                  std::vector<std::uint8_t>& Vq,
+                                  std::vector<float>& M,
+                                  const int C, const int K,
+                                  const int batch_size,
+                                  SMP::WorkerGroup* group = nullptr);
     static int get_nn_idx_symmetry(const int vertex, int symmetry);
     static void fill_input_plane_pair(
       const FullBoard& board, BoardPlane& black, BoardPlane& white);
     static Netresult get_scored_moves_internal(
       const NNPlanes& planes, const int symmetry);
+    static Netresult get_scored_moves_internal(
+      const PlayoutState* const state, const int symmetry);
+
+    // Buffers of the forward pass, kept by each thread so that an
+    // evaluation doesn't allocate once they have grown to the batch.
+    struct Workspace;
+    static Workspace& get_workspace();
+    // Evaluates the first batch_size inputs of the workspace.
+    static void forward(Workspace& workspace, const size_t batch_size,
+                        const int* symmetries, Netresult* results);
+    static void benchmark_evaluator(const GameState* const state,
+                                    const int iterations);
 #if defined(USE_BLAS)
     static void forward_cpu(const std::vector<float>& input,
                             std::vector<float>& output_pol,
                             std::vector<float>& output_val);
-
+    // Evaluates batch_size positions at once. The input and outputs hold
+    // the positions back to back, each in the same layout as forward_cpu.
+    static void forward_cpu_batch(const int batch_size,
+                                  const std::vector<float>& input,
+                                  std::vector<float>& output_pol,
+                                  std::vector<float>& output_val);
+    static void benchmark_batch(const GameState * const state,
+                                const int iterations);
+    static void benchmark_winograd(const int iterations);
+    static void benchmark_gemm(const int iterations);
+    static void benchmark_gemm_shapes(const int iterations);
+    static void benchmark_heads(const int iterations);
+    static void benchmark_latency(const GameState * const state,
+                                  const int iterations);
+    static std::vector<NNPlanes> get_calibration_positions();
+    static void initialize_int8();
 #endif
 };
 
@@ -0,0 +1,126 @@
+/*
+    This file is part of Leela Zero.
+    Copyright (C) 2018 Gian-Carlo Pascutto
+
+    Leela Zero is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Leela Zero is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Leela Zero.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "config.h"
+#include "PlayoutState.h"
+
+#include <algorithm>
+#include <cassert>
+#include <utility>
+
+void KoHashSet::clear() {
+    m_table.assign(INITIAL_SIZE, 0);
+    m_inserted.clear();
+}
+
+size_t KoHashSet::slot(std::uint64_t key) const {
+    // Ko hashes are random, so the low bits are as good as any.
+    const auto mask = m_table.size() - 1;
+    auto i = size_t(key) & mask;
+    while (m_table[i] != 0 && m_table[i] != key) {
+        i = (i + 1) & mask;
+    }
+    return i;
+}
+
+bool KoHashSet::insert(std::uint64_t ko_hash) {
+    // Zero marks an empty slot, fold it in with one.
+    const auto key = std::max(ko_hash, std::uint64_t{1});
+    if (2 * (m_inserted.size() + 1) > m_table.size()) {
+        grow();
+    }
+    const auto i = slot(key);
+    if (m_table[i] == key) {
+        return false;
+    }
+    m_table[i] = key;
+    m_inserted.emplace_back(key);
+    return true;
+}
+
+void KoHashSet::grow() {
+    auto table = std::vector<std::uint64_t>(
+        std::max(2 * m_table.size(), INITIAL_SIZE), 0);
+    std::swap(m_table, table);
+    for (const auto key : m_inserted) {
+        m_table[slot(key)] = key;
+    }
+}
+
+size_t KoHashSet::mark() const {
+    return m_inserted.size();
+}
+
+void KoHashSet::rollback(size_t mark) {
+    // Removing the newest keys first leaves no holes in the probe
+    // sequences of the keys that stay.
+    while (m_inserted.size() > mark) {
+        m_table[slot(m_inserted.back())] = 0;
+        m_inserted.pop_back();
+    }
+}
+
+PlayoutState::PlayoutState(const GameState& root) {
+    reset(root);
+}
+
+void PlayoutState::reset(const GameState& root) {
+    *static_cast<FastState*>(this) = root;
+    m_root = &root;
+    m_moves = 0;
+    m_superko = false;
+    if (m_positions_root == m_root
+        && m_positions_movenum == root.get_movenum()
+        && m_positions_hash == root.board.get_hash()) {
+        m_positions.rollback(m_positions_mark);
+    } else {
+        m_positions_root = nullptr;
+    }
+}
+
+void PlayoutState::play_move(int vertex) {
+    if (m_positions_root != m_root) {
+        m_positions.clear();
+        for (const auto ko_hash : m_root->get_ko_hash_history()) {
+            m_positions.insert(ko_hash);
+        }
+        m_positions_root = m_root;
+        m_positions_movenum = m_root->get_movenum();
+        m_positions_hash = m_root->board.get_hash();
+        m_positions_mark = m_positions.mark();
+    }
+    m_past_boards[m_moves % m_past_boards.size()] = board;
+    m_moves++;
+    FastState::play_move(get_to_move(), vertex);
+    m_superko = !m_positions.insert(board.get_ko_hash());
+}
+
+bool PlayoutState::superko(void) const {
+    return m_superko;
+}
+
+const FullBoard& PlayoutState::get_past_board(int moves_ago) const {
+    assert(moves_ago >= 0 && (unsigned)moves_ago <= m_movenum);
+    if (moves_ago == 0) {
+        return board;
+    } else if ((unsigned)moves_ago > m_moves) {
+        return m_root->get_past_board(moves_ago - int(m_moves));
+    }
+    assert(moves_ago < HISTORY_BOARDS);
+    return m_past_boards[(m_moves - moves_ago) % m_past_boards.size()];
+}
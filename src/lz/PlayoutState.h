@@ -0,0 +1,94 @@
+/*
+    This file is part of Leela Zero.
+    Copyright (C) 2018 Gian-Carlo Pascutto
+
+    Leela Zero is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Leela Zero is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Leela Zero.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef PLAYOUTSTATE_H_INCLUDED
+#define PLAYOUTSTATE_H_INCLUDED
+
+#include "config.h"
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "FastState.h"
+#include "FullBoard.h"
+#include "GameState.h"
+
+// An open-addressed set of ko hashes, for positional superko. The
+// insertions can be rolled back in reverse order, so a playout only
+// removes the positions along its own path.
+class KoHashSet {
+public:
+    void clear();
+    // Returns false if the hash was already in the set.
+    bool insert(std::uint64_t ko_hash);
+    // The insertions so far, to roll back to later.
+    size_t mark() const;
+    void rollback(size_t mark);
+
+private:
+    static constexpr size_t INITIAL_SIZE = 1024;
+
+    size_t slot(std::uint64_t key) const;
+    void grow();
+
+    // Zero marks an empty slot.
+    std::vector<std::uint64_t> m_table;
+    std::vector<std::uint64_t> m_inserted;
+};
+
+// The position of a single playout, played out from the root of the
+// search. Resetting it copies only the root board: the boards before
+// the last few moves of the playout are kept in a ring for the network
+// input, and anything older comes from the root state, which must
+// outlive the playout. Nothing is allocated per playout once the
+// position set has grown to the length of the game plus the depth
+// of the tree.
+class PlayoutState : public FastState {
+public:
+    // Boards back in time that can be asked for, the current one included.
+    static constexpr auto HISTORY_BOARDS = 8;
+
+    PlayoutState() = default;
+    explicit PlayoutState(const GameState& root);
+
+    void reset(const GameState& root);
+
+    void play_move(int vertex);
+    // Whether the last move repeated a position of the game or playout.
+    bool superko(void) const;
+    const FullBoard& get_past_board(int moves_ago) const;
+
+private:
+    const GameState* m_root{nullptr};
+    size_t m_moves{0};
+    bool m_superko{false};
+
+    // The positions of the game and of the playout so far. Filled in
+    // on the first move after the root changed.
+    KoHashSet m_positions;
+    const GameState* m_positions_root{nullptr};
+    size_t m_positions_movenum{0};
+    std::uint64_t m_positions_hash{0};
+    size_t m_positions_mark{0};
+    // Boards before each of the last moves, indexed by move number.
+    std::array<FullBoard, HISTORY_BOARDS - 1> m_past_boards;
+};
+
+#endif
@@ -0,0 +1,102 @@
+/*
+    This file is part of Leela Zero.
+    Copyright (C) 2017-2018 Gian-Carlo Pascutto and contributors
+
+    Leela Zero is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Leela Zero is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Leela Zero.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "SIMD.h"
+
+#if defined(_MSC_VER) && defined(SIMD_X86)
+#include <intrin.h>
+#endif
+
+#ifdef SIMD_X86
+static SIMD::Level detect_level() {
+#if defined(_MSC_VER)
+    int regs[4];
+    __cpuid(regs, 0);
+    if (regs[0] < 7) {
+        return SIMD::SCALAR;
+    }
+    __cpuid(regs, 1);
+    const auto fma = (regs[2] & (1 << 12)) != 0;
+    const auto f16c = (regs[2] & (1 << 29)) != 0;
+    const auto osxsave = (regs[2] & (1 << 27)) != 0;
+    if (!osxsave) {
+        return SIMD::SCALAR;
+    }
+    __cpuidex(regs, 7, 0);
+    const auto avx2 = (regs[1] & (1 << 5)) != 0;
+    const auto avx512f = (regs[1] & (1 << 16)) != 0;
+    const auto avx512vnni = (regs[2] & (1 << 11)) != 0;
+    // The OS must save the YMM (and for AVX-512 the ZMM/opmask) state.
+    const auto xcr0 = _xgetbv(0);
+    const auto ymm_state = (xcr0 & 0x06) == 0x06;
+    const auto zmm_state = (xcr0 & 0xe6) == 0xe6;
+    // The levels build on each other, the AVX-512 kernels also call the
+    // AVX2/F16C helpers.
+    const auto avx2_level = avx2 && fma && f16c && ymm_state;
+    if (avx2_level && avx512f && avx512vnni && zmm_state) {
+        return SIMD::AVX512VNNI;
+    }
+    if (avx2_level && avx512f && zmm_state) {
+        return SIMD::AVX512;
+    }
+    if (avx2_level) {
+        return SIMD::AVX2;
+    }
+    return SIMD::SCALAR;
+#else
+    __builtin_cpu_init();
+    // The levels build on each other, the AVX-512 kernels also call the
+    // AVX2/F16C helpers.
+    const auto avx2_level = __builtin_cpu_supports("avx2")
+                            && __builtin_cpu_supports("fma")
+                            && __builtin_cpu_supports("f16c");
+    if (avx2_level && __builtin_cpu_supports("avx512f")) {
+        if (__builtin_cpu_supports("avx512vnni")) {
+            return SIMD::AVX512VNNI;
+        }
+        return SIMD::AVX512;
+    }
+    if (avx2_level) {
+        return SIMD::AVX2;
+    }
+    return SIMD::SCALAR;
+#endif
+}
+#endif
+
+SIMD::Level SIMD::get_level() {
+#ifdef SIMD_X86
+    static const auto level = detect_level();
+    return level;
+#else
+    return SCALAR;
+#endif
+}
+
+const char* SIMD::get_name(const Level level) {
+    switch (level) {
+    case AVX512VNNI:
+        return "avx512vnni";
+    case AVX512:
+        return "avx512";
+    case AVX2:
+        return "avx2";
+    default:
+        return "scalar";
+    }
+}
@@ -0,0 +1,52 @@
+/*
+    This file is part of Leela Zero.
+    Copyright (C) 2017-2018 Gian-Carlo Pascutto and contributors
+
+    Leela Zero is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Leela Zero is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Leela Zero.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef SIMD_H_INCLUDED
+#define SIMD_H_INCLUDED
+
+#include "config.h"
+
+// SIMD_X86 is defined when vector kernels can be compiled for x86.
+// Functions containing intrinsics are marked with SIMD_TARGET so they
+// build without -march flags and are only called after get_level()
+// confirmed the instruction set is present.
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define SIMD_X86
+#define SIMD_TARGET(isa) __attribute__((target(isa)))
+#elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#define SIMD_X86
+#define SIMD_TARGET(isa)
+#else
+#define SIMD_TARGET(isa)
+#endif
+
+#ifdef SIMD_X86
+#include <immintrin.h>
+#endif
+
+namespace SIMD {
+    enum Level {
+        SCALAR, AVX2, AVX512, AVX512VNNI
+    };
+
+    // Best instruction set supported by both the CPU and the OS.
+    Level get_level();
+    const char* get_name(Level level);
+}
+
+#endif
@@ -19,10 +19,86 @@
 #include "SMP.h"
 
 #include <cassert>
+#include <memory>
+#include <mutex>
 #include <thread>
+#include <vector>
+
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#include "SIMD.h"
+#include "Utils.h"
+
+namespace {
+    // Spin for 1, 2, 4 ... MAX_BACKOFF pause instructions between
+    // attempts, then go to sleep.
+    constexpr auto MAX_BACKOFF = 128;
+
+    // Pause instructions a WorkerGroup helper spins for the next loop
+    // before it goes to sleep, some tens of microseconds.
+    constexpr auto WORKER_SPINS = 20000;
+
+    // Each thread counts in its own block, so the counters don't add
+    // contention of their own. Blocks outlive their threads.
+    struct ThreadLockStats {
+        std::atomic<std::uint64_t> acquisitions{0};
+        std::atomic<std::uint64_t> contended{0};
+        std::atomic<std::uint64_t> spins{0};
+        std::atomic<std::uint64_t> sleeps{0};
+    };
+
+    std::mutex stats_mutex;
+    std::vector<std::unique_ptr<ThreadLockStats>> all_stats;
+
+    ThreadLockStats& thread_stats() {
+        thread_local ThreadLockStats* stats = nullptr;
+        if (stats == nullptr) {
+            std::lock_guard<std::mutex> lock(stats_mutex);
+            all_stats.emplace_back(std::make_unique<ThreadLockStats>());
+            stats = all_stats.back().get();
+        }
+        return *stats;
+    }
+
+    // Only the owning thread writes, no need for a locked add.
+    void count(std::atomic<std::uint64_t>& counter, std::uint64_t n = 1) {
+        counter.store(counter.load(std::memory_order_relaxed) + n,
+                      std::memory_order_relaxed);
+    }
+
+    void cpu_relax() {
+#ifdef SIMD_X86
+        _mm_pause();
+#endif
+    }
+
+    void wait_while_equal(std::atomic<int>& value, int expected) {
+#ifdef __linux__
+        syscall(SYS_futex, reinterpret_cast<int*>(&value),
+                FUTEX_WAIT_PRIVATE, expected, nullptr, nullptr, 0);
+#else
+        (void)value;
+        (void)expected;
+        std::this_thread::yield();
+#endif
+    }
+
+    void wake_one(std::atomic<int>& value) {
+#ifdef __linux__
+        syscall(SYS_futex, reinterpret_cast<int*>(&value),
+                FUTEX_WAKE_PRIVATE, 1, nullptr, nullptr, 0);
+#else
+        (void)value;
+#endif
+    }
+}
 
 SMP::Mutex::Mutex() {
-    m_lock = false;
+    m_lock = 0;
 }
 
 SMP::Lock::Lock(Mutex & m) {
@@ -32,20 +108,57 @@ SMP::Lock::Lock(Mutex & m) {
 
 void SMP::Lock::lock() {
     assert(!m_owns_lock);
-    while (m_mutex->m_lock.exchange(true, std::memory_order_acquire) == true);
+    count(thread_stats().acquisitions);
+    auto expected = 0;
+    if (!m_mutex->m_lock.compare_exchange_strong(expected, 1,
+                                                 std::memory_order_acquire,
+                                                 std::memory_order_relaxed)) {
+        lock_contended();
+    }
     m_owns_lock = true;
 }
 
+void SMP::Lock::lock_contended() {
+    auto& stats = thread_stats();
+    auto& state = m_mutex->m_lock;
+    count(stats.contended);
+
+    // Only try the exchange when the lock looks free, so waiting
+    // threads don't keep stealing the cache line from the holder.
+    auto spins = 0;
+    for (auto backoff = 1; backoff <= MAX_BACKOFF; backoff *= 2) {
+        for (auto i = 0; i < backoff; i++) {
+            cpu_relax();
+        }
+        spins += backoff;
+        auto expected = 0;
+        if (state.load(std::memory_order_relaxed) == 0
+            && state.compare_exchange_strong(expected, 1,
+                                             std::memory_order_acquire,
+                                             std::memory_order_relaxed)) {
+            count(stats.spins, spins);
+            return;
+        }
+    }
+    count(stats.spins, spins);
+
+    // Mark the lock as having sleepers, so unlock() wakes us. We may
+    // take it in state 2 without sleepers, that only costs a wake.
+    while (state.exchange(2, std::memory_order_acquire) != 0) {
+        count(stats.sleeps);
+        wait_while_equal(state, 2);
+    }
+}
+
 void SMP::Lock::unlock() {
     assert(m_owns_lock);
-    auto lock_held = m_mutex->m_lock.exchange(false, std::memory_order_release);
+    auto lock_held = m_mutex->m_lock.exchange(0, std::memory_order_release);
 
     // If this fails it means we are unlocking an unlocked lock
-#ifdef NDEBUG
-    (void)lock_held;
-#else
-    assert(lock_held);
-#endif
+    assert(lock_held != 0);
+    if (lock_held == 2) {
+        wake_one(m_mutex->m_lock);
+    }
     m_owns_lock = false;
 }
 
@@ -60,3 +173,110 @@ SMP::Lock::~Lock() {
 int SMP::get_num_cpus() {
     return std::thread::hardware_concurrency();
 }
+
+SMP::LockStats SMP::get_lock_stats() {
+    auto total = LockStats{};
+    std::lock_guard<std::mutex> lock(stats_mutex);
+    for (const auto& stats : all_stats) {
+        total.acquisitions += stats->acquisitions.load();
+        total.contended += stats->contended.load();
+        total.spins += stats->spins.load();
+        total.sleeps += stats->sleeps.load();
+    }
+    return total;
+}
+
+void SMP::dump_lock_stats() {
+    const auto stats = get_lock_stats();
+    if (stats.acquisitions == 0) {
+        return;
+    }
+    Utils::myprintf("SMP: %llu lock acquisitions, %.3f%% contended, "
+                    "%llu pause spins, %llu sleeps\n",
+                    static_cast<unsigned long long>(stats.acquisitions),
+                    100.0 * stats.contended / stats.acquisitions,
+                    static_cast<unsigned long long>(stats.spins),
+                    static_cast<unsigned long long>(stats.sleeps));
+}
+
+SMP::WorkerGroup::WorkerGroup(const size_t helpers) {
+    for (auto i = size_t{0}; i < helpers; i++) {
+        m_threads.emplace_back(&WorkerGroup::worker, this, i + 1);
+    }
+}
+
+SMP::WorkerGroup::~WorkerGroup() {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_exit = true;
+    }
+    m_condvar.notify_all();
+    for (auto& thread : m_threads) {
+        thread.join();
+    }
+}
+
+void SMP::WorkerGroup::run(const size_t count, const Call call,
+                           void* const context) {
+    const auto threads = size();
+    if (threads == 1 || count < 2) {
+        call(context, 0, count);
+        return;
+    }
+
+    m_call = call;
+    m_context = context;
+    m_count = count;
+    m_pending.store(threads - 1, std::memory_order_relaxed);
+    auto wake = false;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_generation.fetch_add(1, std::memory_order_release);
+        wake = m_sleeping > 0;
+    }
+    if (wake) {
+        m_condvar.notify_all();
+    }
+
+    call(context, 0, count / threads);
+    for (auto spins = 0; m_pending.load(std::memory_order_acquire) != 0;
+         spins++) {
+        if (spins < WORKER_SPINS) {
+            cpu_relax();
+        } else {
+            std::this_thread::yield();
+        }
+    }
+}
+
+void SMP::WorkerGroup::worker(const size_t index) {
+    auto seen = std::uint64_t{0};
+    for (;;) {
+        auto spins = 0;
+        while (m_generation.load(std::memory_order_acquire) == seen
+               && spins < WORKER_SPINS) {
+            cpu_relax();
+            spins++;
+        }
+        if (m_generation.load(std::memory_order_acquire) == seen) {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_sleeping++;
+            m_condvar.wait(lock, [this, seen] {
+                return m_exit || m_generation.load() != seen;
+            });
+            m_sleeping--;
+            if (m_exit) {
+                return;
+            }
+        }
+        seen = m_generation.load(std::memory_order_acquire);
+
+        const auto threads = size();
+        const auto begin = m_count * index / threads;
+        const auto end = m_count * (index + 1) / threads;
+        if (begin < end) {
+            m_call(m_context, begin, end);
+        }
+        m_pending.fetch_sub(1, std::memory_order_release);
+    }
+}
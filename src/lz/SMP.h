@@ -22,17 +22,27 @@
 #include "config.h"
 
 #include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <vector>
 
 namespace SMP {
     int get_num_cpus();
 
+    // Test-and-test-and-set lock. Contended acquires spin with
+    // exponential backoff first, then sleep until the holder wakes
+    // them (futex on Linux, yield elsewhere).
     class Mutex {
     public:
         Mutex();
         ~Mutex() = default;
         friend class Lock;
     private:
-        std::atomic<bool> m_lock;
+        // 0: unlocked, 1: locked, 2: locked and there may be sleepers
+        std::atomic<int> m_lock;
     };
 
     class Lock {
@@ -42,9 +52,68 @@ namespace SMP {
         void lock();
         void unlock();
     private:
+        void lock_contended();
+
         Mutex * m_mutex;
         bool m_owns_lock{false};
     };
+
+    // Contention counters of all Mutexes, summed over threads.
+    struct LockStats {
+        std::uint64_t acquisitions{0};
+        std::uint64_t contended{0};
+        std::uint64_t spins{0};
+        std::uint64_t sleeps{0};
+    };
+    LockStats get_lock_stats();
+    void dump_lock_stats();
+
+    // A fixed set of helper threads that split loops with the thread
+    // that runs them, one loop at a time. Between loops the helpers
+    // spin for a while before they sleep, so the many short loops of a
+    // network evaluation don't pay a wakeup each. Owners take the group
+    // through lock()/try_lock() before running loops on it.
+    class WorkerGroup {
+    public:
+        explicit WorkerGroup(size_t helpers);
+        ~WorkerGroup();
+
+        // Threads that work on a loop, the caller included.
+        size_t size() const { return m_threads.size() + 1; }
+
+        // Calls work(begin, end) on consecutive ranges that cover
+        // [0, count), one per thread, and returns when all are done.
+        template<typename Work>
+        void run(size_t count, Work& work) {
+            run(count, [](void* context, size_t begin, size_t end) {
+                (*static_cast<Work*>(context))(begin, end);
+            }, &work);
+        }
+
+        void lock() { m_owner.lock(); }
+        bool try_lock() { return m_owner.try_lock(); }
+        void unlock() { m_owner.unlock(); }
+
+    private:
+        using Call = void (*)(void* context, size_t begin, size_t end);
+        void run(size_t count, Call call, void* context);
+        void worker(size_t index);
+
+        std::vector<std::thread> m_threads;
+        std::mutex m_owner;
+
+        // The current loop, published by bumping m_generation.
+        Call m_call{nullptr};
+        void* m_context{nullptr};
+        size_t m_count{0};
+        std::atomic<std::uint64_t> m_generation{0};
+        std::atomic<size_t> m_pending{0};
+
+        std::mutex m_mutex;
+        std::condition_variable m_condvar;
+        int m_sleeping{0};
+        bool m_exit{false};
+    };
 }
 
 // Avoids accidentally creating a temporary
@@ -20,6 +20,7 @@
 #define TIMECONTROL_H_INCLUDED
 
 #include <array>
+#include <string>
 
 #include "config.h"
 #include "Timing.h"
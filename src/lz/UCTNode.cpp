@@ -36,15 +36,24 @@
 #include "GTP.h"
 #include "GameState.h"
 #include "Network.h"
+#include "SIMD.h"
 #include "Utils.h"
 
 using namespace Utils;
 
-UCTNode::UCTNode(int vertex, float score) : m_move(vertex), m_score(score) {
+UCTNode::UCTNode(UCTNodeStats* stats, size_t stats_index)
+    : m_stats(stats), m_stats_index(static_cast<std::uint16_t>(stats_index)) {
+}
+
+UCTNode* UCTNode::create_root(UCTNodeArena& arena) {
+    auto root = arena.make<UCTNodeChildren>();
+    root->reserve(1);
+    root->emplace_back(FastBoard::PASS, 0.0f);
+    return root->inflate(0);
 }
 
 bool UCTNode::first_visit() const {
-    return m_visits == 0;
+    return get_visits() == 0;
 }
 
 SMP::Mutex& UCTNode::get_mutex() {
@@ -52,7 +61,7 @@ SMP::Mutex& UCTNode::get_mutex() {
 }
 
 bool UCTNode::create_children(std::atomic<int>& nodecount,
-                              GameState& state,
+                              PlayoutState& state,
                               float& eval,
                               float min_psa_ratio) {
     // check whether somebody beat us to it (atomic)
@@ -138,15 +147,9 @@ void UCTNode::link_nodelist(std::atomic<int>& nodecount,
     const auto max_psa = nodelist[0].first;
     const auto old_min_psa = max_psa * m_min_psa_ratio_children;
     const auto new_min_psa = max_psa * min_psa_ratio;
-    if (new_min_psa > 0.0f) {
-        m_children.reserve(
-            std::count_if(cbegin(nodelist), cend(nodelist),
-                [=](const auto& node) { return node.first >= new_min_psa; }
-            )
-        );
-    } else {
-        m_children.reserve(nodelist.size());
-    }
+    // Room for all moves up front, later expansions must not move
+    // the entries.
+    m_children.reserve(nodelist.size());
 
     auto skipped_children = false;
     for (const auto& node : nodelist) {
@@ -162,26 +165,43 @@ void UCTNode::link_nodelist(std::atomic<int>& nodecount,
     m_is_expanding = false;
 }
 
-const std::vector<UCTNodePointer>& UCTNode::get_children() const {
+const UCTNodeChildren& UCTNode::get_children() const {
     return m_children;
 }
 
 
 int UCTNode::get_move() const {
-    return m_move;
+    return m_stats->get_move(m_stats_index);
 }
 
 void UCTNode::virtual_loss() {
-    m_virtual_loss += VIRTUAL_LOSS_COUNT;
+    m_stats->virtual_loss(m_stats_index);
 }
 
 void UCTNode::virtual_loss_undo() {
-    m_virtual_loss -= VIRTUAL_LOSS_COUNT;
+    m_stats->virtual_loss_undo(m_stats_index);
 }
 
 void UCTNode::update(float eval) {
-    m_visits++;
-    accumulate_eval(eval);
+    m_stats->update(m_stats_index, eval);
+}
+
+UCTNode* UCTNode::join_graph(UCTNodeGraph& graph, std::uint64_t hash) {
+    if (!m_in_graph.load(std::memory_order_acquire)) {
+        const auto node = graph.find_or_insert(hash, this);
+        // A node that has children of its own, from before the tree
+        // was copied to a new graph, keeps them.
+        if (node != this && !has_children()) {
+            m_transposition.store(node, std::memory_order_release);
+        }
+        m_in_graph.store(true, std::memory_order_release);
+    }
+    return get_transposition();
+}
+
+UCTNode* UCTNode::get_transposition() const {
+    const auto node = m_transposition.load(std::memory_order_acquire);
+    return node != nullptr ? node : const_cast<UCTNode*>(this);
 }
 
 bool UCTNode::has_children() const {
@@ -193,33 +213,19 @@ bool UCTNode::expandable(const float min_psa_ratio) const {
 }
 
 float UCTNode::get_score() const {
-    return m_score;
+    return m_stats->get_score(m_stats_index);
 }
 
 void UCTNode::set_score(float score) {
-    m_score = score;
+    m_stats->set_score(m_stats_index, score);
 }
 
 int UCTNode::get_visits() const {
-    return m_visits;
+    return m_stats->get_visits(m_stats_index);
 }
 
 float UCTNode::get_eval(int tomove) const {
-    // Due to the use of atomic updates and virtual losses, it is
-    // possible for the visit count to change underneath us. Make sure
-    // to return a consistent result to the caller by caching the values.
-    auto virtual_loss = int{m_virtual_loss};
-    auto visits = get_visits() + virtual_loss;
-    assert(visits > 0);
-    auto blackeval = get_blackevals();
-    if (tomove == FastBoard::WHITE) {
-        blackeval += static_cast<double>(virtual_loss);
-    }
-    auto score = static_cast<float>(blackeval / double(visits));
-    if (tomove == FastBoard::WHITE) {
-        score = 1.0f - score;
-    }
-    return score;
+    return m_stats->get_eval(m_stats_index, tomove);
 }
 
 float UCTNode::get_net_eval(int tomove) const {
@@ -229,28 +235,247 @@ float UCTNode::get_net_eval(int tomove) const {
     return m_net_eval;
 }
 
-double UCTNode::get_blackevals() const {
-    return m_blackevals;
+namespace {
+    // The PUCT inputs of the inflated children, copied out of their
+    // statistics so that the values can be computed several children at
+    // a time, and the values of all children.
+    // Padded to a whole number of AVX-512 registers.
+    constexpr auto MAX_CHILDREN = (BOARD_SQUARES + 1 + 7) & ~7;
+    struct SelectBatch {
+        alignas(64) double visits[MAX_CHILDREN];
+        alignas(64) double virtual_loss[MAX_CHILDREN];
+        alignas(64) double blackevals[MAX_CHILDREN];
+        // cfg_puct * psa, or -infinity for children that can't be picked
+        alignas(64) double puct_scale[MAX_CHILDREN];
+        alignas(64) double values[MAX_CHILDREN];
+        int entries[MAX_CHILDREN];
+        UCTNode* nodes[MAX_CHILDREN];
+        // Indexed by child, not by inflated child like the above.
+        alignas(64) double child_values[MAX_CHILDREN];
+    };
+
+    using PuctKernel = void (*)(SelectBatch& batch, size_t count,
+                                bool white, float fpu_eval, double numerator);
+    using PriorKernel = void (*)(SelectBatch& batch, const float* scores,
+                                 size_t count, float fpu_eval,
+                                 double numerator);
 }
 
-void UCTNode::accumulate_eval(float eval) {
-    atomic_add(m_blackevals, double(eval));
+// The kernels compute the same operations in the same precision as
+// UCTNodeStats::get_eval, so all of them pick the same child.
+static void puct_values_scalar(SelectBatch& batch, const size_t count,
+                               const bool white, const float fpu_eval,
+                               const double numerator) {
+    for (auto i = size_t{0}; i < count; i++) {
+        auto winrate = fpu_eval;
+        if (batch.visits[i] > 0.0) {
+            auto blackeval = batch.blackevals[i];
+            if (white) {
+                blackeval += batch.virtual_loss[i];
+            }
+            auto score = static_cast<float>(
+                blackeval / (batch.visits[i] + batch.virtual_loss[i]));
+            if (white) {
+                score = 1.0f - score;
+            }
+            winrate = score;
+        }
+        const auto denom = 1.0 + batch.visits[i];
+        batch.values[i] = winrate + batch.puct_scale[i] * (numerator / denom);
+    }
+}
+
+// Children without statistics have no visits, so their value only
+// depends on the prior: fpu_eval + cfg_puct * psa * numerator / 1.0.
+static void prior_values_scalar(SelectBatch& batch, const float* scores,
+                                const size_t count, const float fpu_eval,
+                                const double numerator) {
+    for (auto i = size_t{0}; i < count; i++) {
+        const auto puct = double(cfg_puct * scores[i]) * numerator;
+        batch.child_values[i] = fpu_eval + puct;
+    }
+}
+
+#ifdef SIMD_X86
+SIMD_TARGET("avx2")
+static void puct_values_avx2(SelectBatch& batch, const size_t count,
+                             const bool white, const float fpu_eval,
+                             const double numerator) {
+    const auto zero = _mm256_setzero_pd();
+    const auto one = _mm256_set1_pd(1.0);
+    const auto fpu = _mm256_set1_pd(fpu_eval);
+    const auto num = _mm256_set1_pd(numerator);
+    const auto white_lanes = _mm256_castsi256_pd(
+        _mm256_set1_epi64x(white ? -1 : 0));
+    for (auto i = size_t{0}; i < count; i += 4) {
+        const auto visits = _mm256_load_pd(batch.visits + i);
+        const auto virtual_loss = _mm256_load_pd(batch.virtual_loss + i);
+        const auto blackeval = _mm256_add_pd(
+            _mm256_load_pd(batch.blackevals + i),
+            _mm256_and_pd(virtual_loss, white_lanes));
+        auto score = _mm256_cvtpd_ps(
+            _mm256_div_pd(blackeval, _mm256_add_pd(visits, virtual_loss)));
+        if (white) {
+            score = _mm_sub_ps(_mm_set1_ps(1.0f), score);
+        }
+        const auto winrate = _mm256_blendv_pd(
+            fpu, _mm256_cvtps_pd(score),
+            _mm256_cmp_pd(visits, zero, _CMP_GT_OQ));
+        const auto puct = _mm256_mul_pd(
+            _mm256_load_pd(batch.puct_scale + i),
+            _mm256_div_pd(num, _mm256_add_pd(one, visits)));
+        _mm256_store_pd(batch.values + i, _mm256_add_pd(winrate, puct));
+    }
+}
+
+SIMD_TARGET("avx2")
+static void prior_values_avx2(SelectBatch& batch, const float* scores,
+                              const size_t count, const float fpu_eval,
+                              const double numerator) {
+    const auto puct = _mm_set1_ps(cfg_puct);
+    const auto fpu = _mm256_set1_pd(fpu_eval);
+    const auto num = _mm256_set1_pd(numerator);
+    for (auto i = size_t{0}; i < count; i += 4) {
+        const auto scale = _mm256_cvtps_pd(
+            _mm_mul_ps(puct, _mm_loadu_ps(scores + i)));
+        _mm256_store_pd(batch.child_values + i,
+                        _mm256_add_pd(fpu, _mm256_mul_pd(scale, num)));
+    }
+}
+
+SIMD_TARGET("avx512f")
+static void puct_values_avx512(SelectBatch& batch, const size_t count,
+                               const bool white, const float fpu_eval,
+                               const double numerator) {
+    // The masked forms, unlike the plain ones, don't leave GCC
+    // warning about an undefined source register.
+    const auto all_lanes = __mmask8(0xff);
+    const auto zero = _mm512_setzero_pd();
+    const auto one = _mm512_set1_pd(1.0);
+    const auto fpu = _mm512_set1_pd(fpu_eval);
+    const auto num = _mm512_set1_pd(numerator);
+    const auto white_lanes = __mmask8(white ? 0xff : 0);
+    for (auto i = size_t{0}; i < count; i += 8) {
+        const auto visits = _mm512_load_pd(batch.visits + i);
+        const auto virtual_loss = _mm512_load_pd(batch.virtual_loss + i);
+        const auto blackeval = _mm512_add_pd(
+            _mm512_load_pd(batch.blackevals + i),
+            _mm512_maskz_mov_pd(white_lanes, virtual_loss));
+        auto score = _mm512_maskz_cvtpd_ps(
+            all_lanes,
+            _mm512_div_pd(blackeval, _mm512_add_pd(visits, virtual_loss)));
+        if (white) {
+            score = _mm256_sub_ps(_mm256_set1_ps(1.0f), score);
+        }
+        const auto winrate = _mm512_mask_blend_pd(
+            _mm512_cmp_pd_mask(visits, zero, _CMP_GT_OQ),
+            fpu, _mm512_maskz_cvtps_pd(all_lanes, score));
+        // Explicit rounding keeps the compiler from fusing this
+        // into an FMA, which would round differently.
+        const auto puct = _mm512_maskz_mul_round_pd(
+            all_lanes, _mm512_load_pd(batch.puct_scale + i),
+            _mm512_div_pd(num, _mm512_add_pd(one, visits)),
+            _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+        _mm512_store_pd(batch.values + i, _mm512_add_pd(winrate, puct));
+    }
+}
+
+SIMD_TARGET("avx512f")
+static void prior_values_avx512(SelectBatch& batch, const float* scores,
+                                const size_t count, const float fpu_eval,
+                                const double numerator) {
+    const auto all_lanes = __mmask8(0xff);
+    const auto puct = _mm256_set1_ps(cfg_puct);
+    const auto fpu = _mm512_set1_pd(fpu_eval);
+    const auto num = _mm512_set1_pd(numerator);
+    for (auto i = size_t{0}; i < count; i += 8) {
+        const auto scale = _mm512_maskz_cvtps_pd(
+            all_lanes, _mm256_mul_ps(puct, _mm256_loadu_ps(scores + i)));
+        const auto value = _mm512_maskz_mul_round_pd(
+            all_lanes, scale, num,
+            _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+        _mm512_store_pd(batch.child_values + i, _mm512_add_pd(fpu, value));
+    }
+}
+#endif
+
+static PuctKernel get_puct_kernel() {
+#ifdef SIMD_X86
+    const auto level = SIMD::get_level();
+    if (level >= SIMD::AVX512) {
+        return puct_values_avx512;
+    }
+    if (level >= SIMD::AVX2) {
+        return puct_values_avx2;
+    }
+#endif
+    return puct_values_scalar;
+}
+
+static PriorKernel get_prior_kernel() {
+#ifdef SIMD_X86
+    const auto level = SIMD::get_level();
+    if (level >= SIMD::AVX512) {
+        return prior_values_avx512;
+    }
+    if (level >= SIMD::AVX2) {
+        return prior_values_avx2;
+    }
+#endif
+    return prior_values_scalar;
 }
 
 UCTNode* UCTNode::uct_select_child(int color, bool is_root) {
-    LOCK(get_mutex(), lock);
+    static const auto puct_values = get_puct_kernel();
+    static const auto prior_values = get_prior_kernel();
+    SelectBatch batch;
+
+    // No lock is needed to read the children, they are published with
+    // release stores. Another thread can link or inflate children
+    // while we read, which only makes our snapshot slightly stale.
 
+    // Only inflated children can have visits.
     // Count parentvisits manually to avoid issues with transpositions.
+    // Copy the inputs of the PUCT formula on the way.
+    const auto scores = m_children.scores();
     auto total_visited_policy = 0.0f;
     auto parentvisits = size_t{0};
-    for (const auto& child : m_children) {
-        if (child.valid()) {
-            parentvisits += child.get_visits();
-            if (child.get_visits() > 0) {
-                total_visited_policy += child.get_score();
+    auto inflated = size_t{0};
+    for (auto stats = m_children.m_stats.load(std::memory_order_acquire);
+         stats != nullptr;
+         stats = stats->m_next.load(std::memory_order_acquire)) {
+        const auto size = stats->m_size.load(std::memory_order_acquire);
+        for (auto j = size_t{0}; j < size; j++) {
+            const auto entry = stats->entries()[j];
+            if (entry < 0) {
+                continue;
+            }
+            const auto child_visits = stats->visits()[j].load();
+            const auto status = stats->statuses()[j].load();
+            if (status != UCTNodeStats::INVALID) {
+                parentvisits += child_visits;
+                if (child_visits > 0) {
+                    total_visited_policy += scores[entry];
+                }
             }
+            batch.visits[inflated] = child_visits;
+            batch.virtual_loss[inflated] = stats->virtual_losses()[j].load();
+            batch.blackevals[inflated] = stats->blackevals()[j].load();
+            batch.puct_scale[inflated] = status == UCTNodeStats::ACTIVE
+                ? double(cfg_puct * scores[entry])
+                : -std::numeric_limits<double>::infinity();
+            batch.entries[inflated] = entry;
+            batch.nodes[inflated] = stats->nodes()[j];
+            inflated++;
         }
     }
+    const auto padded_inflated = (inflated + 7) & ~size_t{7};
+    for (auto i = inflated; i < padded_inflated; i++) {
+        batch.visits[i] = 0.0;
+        batch.virtual_loss[i] = 0.0;
+        batch.blackevals[i] = 0.0;
+        batch.puct_scale[i] = 0.0;
+    }
 
     auto numerator = std::sqrt(double(parentvisits));
     auto fpu_reduction = 0.0f;
@@ -263,33 +488,40 @@ UCTNode* UCTNode::uct_select_child(int color, bool is_root) {
     // Estimated eval for unknown nodes = original parent NN eval - reduction
     auto fpu_eval = get_net_eval(color) - fpu_reduction;
 
-    auto best = static_cast<UCTNodePointer*>(nullptr);
-    auto best_value = std::numeric_limits<double>::lowest();
+    // The table capacity is a multiple of 8, so the scores are padded.
+    // Read after the statistics, so it covers every inflated child.
+    const auto count = m_children.size();
+    prior_values(batch, scores, (count + 7) & ~size_t{7},
+                 fpu_eval, numerator);
+    puct_values(batch, padded_inflated, color == FastBoard::WHITE,
+                fpu_eval, numerator);
+    for (auto i = size_t{0}; i < inflated; i++) {
+        batch.child_values[batch.entries[i]] = batch.values[i];
+    }
 
-    for (auto& child : m_children) {
-        if (!child.active()) {
-            continue;
+    // Children that can't be picked score -infinity or NaN.
+    auto best = count;
+    auto best_value = std::numeric_limits<double>::lowest();
+    for (auto i = size_t{0}; i < count; i++) {
+        if (batch.child_values[i] > best_value) {
+            best_value = batch.child_values[i];
+            best = i;
         }
+    }
 
-        auto winrate = fpu_eval;
-        if (child.get_visits() > 0) {
-            winrate = child.get_eval(color);
-        }
-        auto psa = child.get_score();
-        auto denom = 1.0 + child.get_visits();
-        auto puct = cfg_puct * psa * (numerator / denom);
-        auto value = winrate + puct;
-        assert(value > std::numeric_limits<double>::lowest());
-
-        if (value > best_value) {
-            best_value = value;
-            best = &child;
+    assert(best < count);
+    for (auto i = size_t{0}; i < inflated; i++) {
+        if (batch.entries[i] == int(best)) {
+            return batch.nodes[i];
         }
     }
 
-    assert(best != nullptr);
-    best->inflate();
-    return best->get();
+    // Inflating needs the lock, and someone may have beaten us to it.
+    LOCK(get_mutex(), lock);
+    if (m_children[best].is_inflated()) {
+        return m_children[best].get();
+    }
+    return m_children.inflate(best);
 }
 
 class NodeComp : public std::binary_function<UCTNodePointer&,
@@ -317,23 +549,36 @@ private:
 
 void UCTNode::sort_children(int color) {
     LOCK(get_mutex(), lock);
-    std::stable_sort(rbegin(m_children), rend(m_children), NodeComp(color));
+    // Stable sort from the last child to the first, best first.
+    auto order = std::vector<size_t>(m_children.size());
+    std::iota(order.rbegin(), order.rend(), size_t{0});
+    auto comp = NodeComp(color);
+    std::stable_sort(begin(order), end(order), [&](size_t a, size_t b) {
+        return comp(m_children[a], m_children[b]);
+    });
+    std::reverse(begin(order), end(order));
+    m_children.permute(order);
 }
 
 UCTNode& UCTNode::get_best_root_child(int color) {
     LOCK(get_mutex(), lock);
     assert(!m_children.empty());
 
-    auto ret = std::max_element(begin(m_children), end(m_children),
-                                NodeComp(color));
-    ret->inflate();
-    return *(ret->get());
+    auto comp = NodeComp(color);
+    auto best = size_t{0};
+    for (auto i = size_t{1}; i < m_children.size(); i++) {
+        if (comp(m_children[best], m_children[i])) {
+            best = i;
+        }
+    }
+    m_children[best].inflate();
+    return *m_children[best];
 }
 
 size_t UCTNode::count_nodes() const {
     auto nodecount = size_t{0};
     nodecount += m_children.size();
-    for (auto& child : m_children) {
+    for (const auto& child : m_children) {
         if (child.get_visits() > 0) {
             nodecount += child->count_nodes();
         }
@@ -341,20 +586,60 @@ size_t UCTNode::count_nodes() const {
     return nodecount;
 }
 
+UCTNode* UCTNode::clone(UCTNodeArena& arena) const {
+    auto root = arena.make<UCTNodeChildren>();
+    root->reserve(1);
+    root->emplace_back(get_move(), get_score());
+    const auto copy = root->inflate(0);
+    copy_stats(*copy);
+    copy_subtree(*copy);
+    return copy;
+}
+
+void UCTNode::copy_stats(UCTNode& copy) const {
+    const auto i = m_stats_index;
+    const auto j = copy.m_stats_index;
+    copy.m_stats->blackevals()[j].store(m_stats->blackevals()[i],
+                                        std::memory_order_relaxed);
+    copy.m_stats->visits()[j].store(m_stats->visits()[i],
+                                    std::memory_order_relaxed);
+    copy.m_stats->virtual_losses()[j].store(m_stats->virtual_losses()[i],
+                                            std::memory_order_relaxed);
+    copy.m_stats->statuses()[j].store(m_stats->statuses()[i],
+                                      std::memory_order_relaxed);
+}
+
+void UCTNode::copy_subtree(UCTNode& copy) const {
+    copy.m_net_eval = m_net_eval;
+    copy.m_min_psa_ratio_children = m_min_psa_ratio_children.load();
+
+    copy.m_children.reserve(m_children.m_capacity);
+    for (auto i = size_t{0}; i < m_children.size(); i++) {
+        const auto child = m_children[i];
+        copy.m_children.emplace_back(child.get_move(), child.get_score());
+        if (child.is_inflated()) {
+            const auto child_copy = copy.m_children.inflate(i);
+            child->copy_stats(*child_copy);
+            child->copy_subtree(*child_copy);
+        }
+    }
+}
+
 void UCTNode::invalidate() {
-    m_status = INVALID;
+    m_stats->set_status(m_stats_index, UCTNodeStats::INVALID);
 }
 
 void UCTNode::set_active(const bool active) {
     if (valid()) {
-        m_status = active ? ACTIVE : PRUNED;
+        m_stats->set_status(m_stats_index, active ? UCTNodeStats::ACTIVE
+                                                  : UCTNodeStats::PRUNED);
     }
 }
 
 bool UCTNode::valid() const {
-    return m_status != INVALID;
+    return m_stats->get_status(m_stats_index) != UCTNodeStats::INVALID;
 }
 
 bool UCTNode::active() const {
-    return m_status == ACTIVE;
+    return m_stats->get_status(m_stats_index) == UCTNodeStats::ACTIVE;
 }
@@ -28,8 +28,10 @@
 #include <cstring>
 
 #include "GameState.h"
+#include "PlayoutState.h"
 #include "Network.h"
 #include "SMP.h"
+#include "UCTNodeGraph.h"
 #include "UCTNodePointer.h"
 
 class UCTNode {
@@ -39,20 +41,25 @@ public:
     // search tree.
     static constexpr auto VIRTUAL_LOSS_COUNT = 3;
     // Defined in UCTNode.cpp
-    explicit UCTNode(int vertex, float score);
+    UCTNode(UCTNodeStats* stats, size_t stats_index);
     UCTNode() = delete;
     ~UCTNode() = default;
 
+    // A new root node, with an entry of its own since it has no parent.
+    static UCTNode* create_root(UCTNodeArena& arena);
+
     bool create_children(std::atomic<int>& nodecount,
-                         GameState& state, float& eval,
+                         PlayoutState& state, float& eval,
                          float min_psa_ratio = 0.0f);
 
-    const std::vector<UCTNodePointer>& get_children() const;
+    const UCTNodeChildren& get_children() const;
     void sort_children(int color);
     UCTNode& get_best_root_child(int color);
     UCTNode* uct_select_child(int color, bool is_root);
 
     size_t count_nodes() const;
+    // Deep copy of the subtree, as a new root in another arena.
+    UCTNode* clone(UCTNodeArena& arena) const;
     SMP::Mutex& get_mutex();
     bool first_visit() const;
     bool has_children() const;
@@ -71,6 +78,12 @@ public:
     void virtual_loss_undo(void);
     void update(float eval);
 
+    // Register the position of this node in a search graph, the first
+    // time only. Returns the node whose children this node shares.
+    UCTNode* join_graph(UCTNodeGraph& graph, std::uint64_t hash);
+    // The node whose children this node shares, itself if none.
+    UCTNode* get_transposition() const;
+
     // Defined in UCTNodeRoot.cpp, only to be called on m_root in UCTSearch
     void randomize_first_proportionally();
     void prepare_root_node(int color,
@@ -79,20 +92,17 @@ public:
 
     UCTNode* get_first_child() const;
     UCTNode* get_nopass_child(FastState& state) const;
-    std::unique_ptr<UCTNode> find_child(const int move);
+    UCTNode* find_child(const int move);
     void inflate_all_children();
 
 private:
-    enum Status : char {
-        INVALID, // superko
-        PRUNED,
-        ACTIVE
-    };
+    friend class UCTNodeChildren;
+
     void link_nodelist(std::atomic<int>& nodecount,
                        std::vector<Network::ScoreVertexPair>& nodelist,
                        float min_psa_ratio);
-    double get_blackevals() const;
-    void accumulate_eval(float eval);
+    void copy_stats(UCTNode& copy) const;
+    void copy_subtree(UCTNode& copy) const;
     void kill_superkos(const KoState& state);
     void dirichlet_noise(float epsilon, float alpha);
 
@@ -100,24 +110,22 @@ private:
     // tens of millions of instances of these.  Please put extra caution
     // if you want to add/remove/reorder any variables here.
 
-    // Move
-    std::int16_t m_move;
-    // UCT
-    std::atomic<std::int16_t> m_virtual_loss{0};
-    std::atomic<int> m_visits{0};
-    // UCT eval
-    float m_score;
-    // Original net eval for this node (not children).
-    float m_net_eval{0.0f};
-    std::atomic<double> m_blackevals{0.0};
-    std::atomic<Status> m_status{ACTIVE};
+    // Visits and evals of this node, in the parent's statistics
+    UCTNodeStats* m_stats;
+    std::uint16_t m_stats_index;
     // Is someone adding scores to this node?
     bool m_is_expanding{false};
+    // Has join_graph() been called?
+    std::atomic<bool> m_in_graph{false};
+    // Original net eval for this node (not children).
+    float m_net_eval{0.0f};
     SMP::Mutex m_nodemutex;
 
     // Tree data
     std::atomic<float> m_min_psa_ratio_children{2.0f};
-    std::vector<UCTNodePointer> m_children;
+    UCTNodeChildren m_children;
+    // Node of the same position which has the children, in a graph.
+    std::atomic<UCTNode*> m_transposition{nullptr};
 };
 
 #endif
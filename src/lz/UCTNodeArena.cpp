@@ -0,0 +1,126 @@
+/*
+    This file is part of Leela Zero.
+    Copyright (C) 2017-2018 Gian-Carlo Pascutto and contributors
+
+    Leela Zero is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Leela Zero is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Leela Zero.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "config.h"
+#include "UCTNodeArena.h"
+
+#include <atomic>
+#include <cstdlib>
+#ifdef _WIN32
+#include <malloc.h>
+#endif
+
+constexpr size_t UCTNodeArena::SLAB_SIZE;
+constexpr size_t UCTNodeArena::SLAB_HEADER_SIZE;
+
+static std::atomic<std::uint64_t> next_arena_id{1};
+
+// Slabs of destroyed arenas, kept for the next tree. The tree is rebuilt
+// every move, and handing aligned blocks back to malloc fragments the
+// heap badly enough that the process keeps growing. Beyond the size of a
+// typical game tree they are released, so that one large analysis
+// doesn't keep its memory for the rest of the process.
+static constexpr auto MAX_FREE_BYTES = size_t{128} * 1024 * 1024;
+static std::mutex free_slabs_mutex;
+static std::vector<void*> free_slabs;
+
+static void release_slab(void* slab) {
+#ifdef _WIN32
+    _aligned_free(slab);
+#else
+    std::free(slab);
+#endif
+}
+
+static void* get_slab(size_t size) {
+    {
+        std::lock_guard<std::mutex> lock(free_slabs_mutex);
+        if (!free_slabs.empty()) {
+            const auto slab = free_slabs.back();
+            free_slabs.pop_back();
+            return slab;
+        }
+    }
+    void* slab = nullptr;
+#ifdef _WIN32
+    slab = _aligned_malloc(size, size);
+#else
+    if (posix_memalign(&slab, size, size) != 0) {
+        slab = nullptr;
+    }
+#endif
+    if (slab == nullptr) {
+        throw std::bad_alloc();
+    }
+    return slab;
+}
+
+// The slab a thread is currently filling, so that allocations only
+// take the arena lock once per slab.
+struct ThreadCache {
+    std::uint64_t arena_id{0};
+    char* next{nullptr};
+    char* end{nullptr};
+};
+static thread_local ThreadCache thread_cache;
+
+UCTNodeArena::UCTNodeArena() : m_id(next_arena_id++) {}
+
+UCTNodeArena::~UCTNodeArena() {
+    constexpr auto MAX_FREE_SLABS = MAX_FREE_BYTES / SLAB_SIZE;
+    auto slab = begin(m_slabs);
+    {
+        std::lock_guard<std::mutex> lock(free_slabs_mutex);
+        for (; slab != end(m_slabs) && free_slabs.size() < MAX_FREE_SLABS;
+             ++slab) {
+            free_slabs.emplace_back(*slab);
+        }
+    }
+    for (; slab != end(m_slabs); ++slab) {
+        release_slab(*slab);
+    }
+}
+
+void* UCTNodeArena::allocate(size_t bytes) {
+    // Keep everything 8 byte aligned for the atomics in the nodes.
+    bytes = (bytes + 7) & ~size_t{7};
+    assert(bytes <= SLAB_SIZE - SLAB_HEADER_SIZE);
+
+    auto& cache = thread_cache;
+    if (cache.arena_id != m_id || size_t(cache.end - cache.next) < bytes) {
+        const auto slab = get_slab(SLAB_SIZE);
+        static_cast<SlabHeader*>(slab)->arena = this;
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_slabs.emplace_back(slab);
+        }
+        cache.arena_id = m_id;
+        cache.next = static_cast<char*>(slab) + SLAB_HEADER_SIZE;
+        cache.end = static_cast<char*>(slab) + SLAB_SIZE;
+    }
+
+    const auto ptr = cache.next;
+    cache.next += bytes;
+    return ptr;
+}
+
+size_t UCTNodeArena::get_bytes() const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_slabs.size() * SLAB_SIZE;
+}
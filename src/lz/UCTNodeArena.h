@@ -0,0 +1,83 @@
+/*
+    This file is part of Leela Zero.
+    Copyright (C) 2017-2018 Gian-Carlo Pascutto and contributors
+
+    Leela Zero is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Leela Zero is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Leela Zero.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef UCTNODEARENA_H_INCLUDED
+#define UCTNODEARENA_H_INCLUDED
+
+#include "config.h"
+
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// Memory for one search tree: its nodes and child arrays. Objects are
+// carved from large aligned slabs by per-thread bump pointers and are
+// never freed one by one; destroying the arena releases the whole tree.
+// Everything allocated here must be trivially destructible.
+//
+// Slabs are aligned to their size, so the arena owning an object can be
+// found from the object's address alone.
+class UCTNodeArena {
+public:
+    UCTNodeArena();
+    ~UCTNodeArena();
+    UCTNodeArena(const UCTNodeArena&) = delete;
+    UCTNodeArena& operator=(const UCTNodeArena&) = delete;
+
+    void* allocate(size_t bytes);
+
+    template <typename T, typename... Args>
+    T* make(Args&&... args) {
+        static_assert(std::is_trivially_destructible<T>::value,
+                      "Arena objects are never destroyed");
+        return new (allocate(sizeof(T))) T(std::forward<Args>(args)...);
+    }
+
+    // The arena an object was allocated from.
+    static UCTNodeArena& get(const void* object) {
+        const auto slab = reinterpret_cast<std::uintptr_t>(object)
+                          & ~std::uintptr_t(SLAB_SIZE - 1);
+        const auto arena = reinterpret_cast<const SlabHeader*>(slab)->arena;
+        assert(arena != nullptr);
+        return *arena;
+    }
+
+    size_t get_bytes() const;
+
+private:
+    static constexpr auto SLAB_SIZE = size_t{256} * 1024;
+
+    struct SlabHeader {
+        UCTNodeArena* arena;
+    };
+    static constexpr auto SLAB_HEADER_SIZE = size_t{64};
+
+    mutable std::mutex m_mutex;
+    std::vector<void*> m_slabs;
+    // Never reused, so that thread caches of a destroyed arena are
+    // recognized even if a new arena gets the same address.
+    const std::uint64_t m_id;
+};
+
+#endif
@@ -0,0 +1,41 @@
+/*
+    This file is part of Leela Zero.
+    Copyright (C) 2018 Gian-Carlo Pascutto
+
+    Leela Zero is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Leela Zero is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Leela Zero.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "config.h"
+
+#include "UCTNodeGraph.h"
+#include "Utils.h"
+
+UCTNode* UCTNodeGraph::find_or_insert(std::uint64_t hash, UCTNode* node) {
+    // The low bits pick the bucket inside the shard.
+    auto& shard = m_shards[(hash >> 58) % NUM_SHARDS];
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    const auto inserted = shard.nodes.emplace(hash, node);
+    if (inserted.second) {
+        m_positions++;
+    } else {
+        m_transpositions++;
+    }
+    return inserted.first->second;
+}
+
+void UCTNodeGraph::dump_stats() const {
+    Utils::myprintf("Graph: %lld positions, %lld transpositions\n",
+                    static_cast<long long>(m_positions.load()),
+                    static_cast<long long>(m_transpositions.load()));
+}
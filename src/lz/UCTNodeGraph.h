@@ -0,0 +1,62 @@
+/*
+    This file is part of Leela Zero.
+    Copyright (C) 2018 Gian-Carlo Pascutto
+
+    Leela Zero is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Leela Zero is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Leela Zero.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef UCTNODEGRAPH_H_INCLUDED
+#define UCTNODEGRAPH_H_INCLUDED
+
+#include "config.h"
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <unordered_map>
+
+class UCTNode;
+
+// The positions of a search, for searching a graph instead of a tree.
+// The first node that reaches a position owns its children, and nodes
+// reaching it by other move orders share them (see UCTNode::join_graph).
+//
+// Positions are keyed by the board hash, which covers the stones, ko,
+// side to move, passes and prisoners. The map is split in shards with
+// a lock each, it is only consulted once per node.
+class UCTNodeGraph {
+public:
+    // The node that owns the children of the position, node itself if
+    // the position is new.
+    UCTNode* find_or_insert(std::uint64_t hash, UCTNode* node);
+
+    void dump_stats() const;
+
+private:
+    static constexpr auto NUM_SHARDS = size_t{64};
+
+    struct Shard {
+        std::mutex mutex;
+        std::unordered_map<std::uint64_t, UCTNode*> nodes;
+    };
+    std::array<Shard, NUM_SHARDS> m_shards;
+
+    // Statistics
+    std::atomic<std::int64_t> m_positions{0};
+    std::atomic<std::int64_t> m_transpositions{0};
+};
+
+#endif
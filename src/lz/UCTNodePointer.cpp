@@ -1,6 +1,6 @@
 /*
     This file is part of Leela Zero.
-    Copyright (C) 2018 Gian-Carlo Pascutto and contributors
+    Copyright (C) 2018 Gian-Carlo Pascutto
 
     Leela Zero is free software: you can redistribute it and/or modify
     it under the terms of the GNU General Public License as published by
@@ -15,82 +15,220 @@
     You should have received a copy of the GNU General Public License
     along with Leela Zero.  If not, see <http://www.gnu.org/licenses/>.
 */
-
 #include "config.h"
 
+#include <algorithm>
 #include <atomic>
-#include <memory>
 #include <cassert>
-#include <cstring>
+#include <new>
 
 #include "UCTNode.h"
+#include "FastBoard.h"
+#include "Utils.h"
 
-UCTNodePointer::~UCTNodePointer() {
-    if (is_inflated()) {
-        delete read_ptr();
-    }
+int UCTNodeStats::get_move(size_t i) const {
+    return m_children->moves()[entries()[i]];
+}
+
+float UCTNodeStats::get_score(size_t i) const {
+    return m_children->scores()[entries()[i]];
+}
+
+void UCTNodeStats::set_score(size_t i, float score) {
+    m_children->scores()[entries()[i]] = score;
 }
 
-UCTNodePointer::UCTNodePointer(UCTNodePointer&& n) {
-    if (is_inflated()) {
-        delete read_ptr();
+float UCTNodeStats::get_eval(size_t i, int tomove) const {
+    // Due to the use of atomic updates and virtual losses, it is
+    // possible for the visit count to change underneath us. Make sure
+    // to return a consistent result to the caller by caching the values.
+    auto virtual_loss = int{virtual_losses()[i]};
+    auto visits = get_visits(i) + virtual_loss;
+    assert(visits > 0);
+    auto blackeval = blackevals()[i].load();
+    if (tomove == FastBoard::WHITE) {
+        blackeval += static_cast<double>(virtual_loss);
     }
-    m_data = n.m_data;
-    n.m_data = 1; // non-inflated garbage
+    auto score = static_cast<float>(blackeval / double(visits));
+    if (tomove == FastBoard::WHITE) {
+        score = 1.0f - score;
+    }
+    return score;
 }
 
-UCTNodePointer::UCTNodePointer(std::int16_t vertex, float score) {
-    std::uint32_t i_score;
-    auto i_vertex = static_cast<std::uint16_t>(vertex);
-    std::memcpy(&i_score, &score, sizeof(i_score));
+void UCTNodeStats::virtual_loss(size_t i) {
+    virtual_losses()[i] += UCTNode::VIRTUAL_LOSS_COUNT;
+}
 
-    m_data =  (static_cast<std::uint64_t>(i_score)  << 32)
-            | (static_cast<std::uint64_t>(i_vertex) << 16) | 1ULL;
+void UCTNodeStats::virtual_loss_undo(size_t i) {
+    virtual_losses()[i] -= UCTNode::VIRTUAL_LOSS_COUNT;
 }
 
-UCTNodePointer& UCTNodePointer::operator=(UCTNodePointer&& n) {
-    if (is_inflated()) {
-        delete read_ptr();
-    }
-    m_data = n.m_data;
-    n.m_data = 1;
+void UCTNodeStats::update(size_t i, float eval) {
+    visits()[i]++;
+    Utils::atomic_add(blackevals()[i], double(eval));
+}
 
-    return *this;
+bool UCTNodePointer::is_inflated() const {
+    return m_children->stats_indices()[m_index].load(
+        std::memory_order_acquire) != 0;
+}
+
+UCTNode* UCTNodePointer::get() const {
+    assert(is_inflated());
+    auto index = size_t{0};
+    const auto stats = m_children->find_stats(m_index, index);
+    return stats->nodes()[index];
 }
 
 void UCTNodePointer::inflate() const {
     if (is_inflated()) return;
-    m_data = reinterpret_cast<std::uint64_t>(
-        new UCTNode(read_vertex(), read_score()));
+    m_children->inflate(m_index);
 }
 
 bool UCTNodePointer::valid() const {
-    if (is_inflated()) return read_ptr()->valid();
-    return true;
+    if (!is_inflated()) return true;
+    auto index = size_t{0};
+    const auto stats = m_children->find_stats(m_index, index);
+    return stats->get_status(index) != UCTNodeStats::INVALID;
 }
 
-int UCTNodePointer::get_visits() const {
-    if (is_inflated()) return read_ptr()->get_visits();
-    return 0;
+bool UCTNodePointer::active() const {
+    if (!is_inflated()) return true;
+    auto index = size_t{0};
+    const auto stats = m_children->find_stats(m_index, index);
+    return stats->get_status(index) == UCTNodeStats::ACTIVE;
 }
 
-float UCTNodePointer::get_score() const {
-    if (is_inflated()) return read_ptr()->get_score();
-    return read_score();
+int UCTNodePointer::get_move() const {
+    return m_children->moves()[m_index];
 }
 
-bool UCTNodePointer::active() const {
-    if (is_inflated()) return read_ptr()->active();
-    return true;
+int UCTNodePointer::get_visits() const {
+    if (!is_inflated()) return 0;
+    auto index = size_t{0};
+    const auto stats = m_children->find_stats(m_index, index);
+    return stats->get_visits(index);
+}
+
+float UCTNodePointer::get_score() const {
+    return m_children->scores()[m_index];
 }
 
 float UCTNodePointer::get_eval(int tomove) const {
     // this can only be called if it is an inflated pointer
     assert(is_inflated());
-    return read_ptr()->get_eval(tomove);
+    auto index = size_t{0};
+    const auto stats = m_children->find_stats(m_index, index);
+    return stats->get_eval(index, tomove);
 }
 
-int UCTNodePointer::get_move() const {
-    if (is_inflated()) return read_ptr()->get_move();
-    return read_vertex();
+constexpr size_t UCTNodeStats::ENTRY_BYTES;
+constexpr size_t UCTNodeChildren::ENTRY_BYTES;
+
+void UCTNodeChildren::reserve(size_t capacity) {
+    if (m_capacity != 0 || capacity == 0) {
+        assert(capacity <= m_capacity);
+        return;
+    }
+    // Keep every array 8 byte aligned.
+    capacity = (capacity + 7) & ~size_t{7};
+    auto& arena = UCTNodeArena::get(this);
+    m_data = static_cast<char*>(arena.allocate(capacity * ENTRY_BYTES));
+    m_capacity = static_cast<std::uint32_t>(capacity);
+    // The selection kernels read the scores up to the capacity.
+    std::fill_n(scores(), capacity, 0.0f);
+}
+
+void UCTNodeChildren::emplace_back(int vertex, float score) {
+    const auto i = m_size.load(std::memory_order_relaxed);
+    assert(i < m_capacity);
+    scores()[i] = score;
+    moves()[i] = static_cast<std::int16_t>(vertex);
+    new (&stats_indices()[i]) std::atomic<std::uint16_t>(0);
+    m_size.store(i + 1, std::memory_order_release);
+}
+
+UCTNodeStats* UCTNodeChildren::find_stats(size_t i, size_t& index) const {
+    index = stats_indices()[i].load(std::memory_order_acquire) - size_t{1};
+    auto stats = m_stats.load(std::memory_order_acquire);
+    // Only the last chunk can be partly filled.
+    while (index >= stats->m_capacity) {
+        index -= stats->m_capacity;
+        stats = stats->m_next.load(std::memory_order_acquire);
+    }
+    return stats;
+}
+
+UCTNode* UCTNodeChildren::inflate(size_t i) const {
+    assert(stats_indices()[i] == 0);
+    auto& arena = UCTNodeArena::get(this);
+    auto stats = m_last_stats;
+    auto before = size_t{0};
+    if (stats == nullptr || stats->m_size.load() == stats->m_capacity) {
+        // Start with room for a few children, most nodes never get
+        // more, and double from there.
+        const auto capacity = stats == nullptr
+            ? size_t{4} : size_t{2} * stats->m_capacity;
+        const auto bytes = sizeof(UCTNodeStats)
+                           + capacity * UCTNodeStats::ENTRY_BYTES;
+        const auto chunk = new (arena.allocate(bytes))
+            UCTNodeStats(this, capacity);
+        if (stats == nullptr) {
+            m_stats.store(chunk, std::memory_order_release);
+        } else {
+            stats->m_next.store(chunk, std::memory_order_release);
+        }
+        m_last_stats = stats = chunk;
+    }
+    for (auto chunk = m_stats.load(); chunk != stats; chunk = chunk->m_next) {
+        before += chunk->m_capacity;
+    }
+
+    const auto index = stats->m_size.load(std::memory_order_relaxed);
+    new (&stats->blackevals()[index]) std::atomic<double>(0.0);
+    new (&stats->visits()[index]) std::atomic<int>(0);
+    new (&stats->virtual_losses()[index]) std::atomic<std::int16_t>(0);
+    new (&stats->statuses()[index]) std::atomic<UCTNodeStats::Status>(
+        UCTNodeStats::ACTIVE);
+    stats->entries()[index] = static_cast<std::int16_t>(i);
+    const auto node = arena.make<UCTNode>(stats, index);
+    stats->nodes()[index] = node;
+    stats->m_size.store(index + 1, std::memory_order_release);
+    stats_indices()[i].store(static_cast<std::uint16_t>(before + index + 1),
+                             std::memory_order_release);
+    return node;
+}
+
+void UCTNodeChildren::permute(const std::vector<size_t>& order) {
+    assert(order.size() <= size());
+    auto score = std::vector<float>{};
+    auto move = std::vector<std::int16_t>{};
+    auto stats_index = std::vector<std::uint16_t>{};
+    for (const auto j : order) {
+        score.emplace_back(scores()[j]);
+        move.emplace_back(moves()[j]);
+        stats_index.emplace_back(stats_indices()[j]);
+    }
+    for (auto i = size_t{0}; i < order.size(); i++) {
+        scores()[i] = score[i];
+        moves()[i] = move[i];
+        stats_indices()[i] = stats_index[i];
+    }
+    m_size = static_cast<std::uint32_t>(order.size());
+
+    // The statistics stay where they are, only the entries they point
+    // back to change. Dropped children are marked as removed.
+    for (auto stats = m_stats.load(); stats != nullptr; stats = stats->m_next) {
+        for (auto j = size_t{0}; j < stats->m_size; j++) {
+            stats->entries()[j] = -1;
+        }
+    }
+    for (auto i = size_t{0}; i < size(); i++) {
+        if (stats_indices()[i] != 0) {
+            auto index = size_t{0};
+            const auto stats = find_stats(i, index);
+            stats->entries()[index] = static_cast<std::int16_t>(i);
+        }
+    }
 }
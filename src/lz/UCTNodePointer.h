@@ -22,83 +22,117 @@
 #include "config.h"
 
 #include <atomic>
-#include <memory>
 #include <cassert>
-#include <cstring>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <vector>
 
-#include "SMP.h"
+#include "UCTNodeArena.h"
 
 class UCTNode;
+class UCTNodeChildren;
+
+// Statistics of the inflated children of a node: parallel arrays of
+// visits, virtual loss, value sum and status, plus the UCTNode pointer
+// and the child's index in the parent's UCTNodeChildren. A node gets
+// chunks of growing size as children are inflated. Chunks never move,
+// so a node refers to its statistics by chunk and index.
+class UCTNodeStats {
+public:
+    enum Status : char {
+        INVALID, // superko
+        PRUNED,
+        ACTIVE
+    };
+
+    int get_move(size_t i) const;
+    float get_score(size_t i) const;
+    void set_score(size_t i, float score);
+    int get_visits(size_t i) const {
+        return visits()[i];
+    }
+    float get_eval(size_t i, int tomove) const;
+    Status get_status(size_t i) const {
+        return statuses()[i];
+    }
+    void set_status(size_t i, Status status) {
+        statuses()[i] = status;
+    }
+    void virtual_loss(size_t i);
+    void virtual_loss_undo(size_t i);
+    void update(size_t i, float eval);
 
-// 'lazy-initializable' version of std::unique_ptr<UCTNode>.
-// When a UCTNodePointer is constructed, the constructor arguments
-// are stored instead of constructing the actual UCTNode instance.
-// Later when the UCTNode is needed, the external code calls inflate()
-// which actually constructs the UCTNode. Basically, this is a 'tagged union'
-// of:
-//  - std::unique_ptr<UCTNode> pointer;
-//  - std::pair<float, std::int16_t> args;
-
-// WARNING : inflate() is not thread-safe and hence has to be protected
-// by an external lock.
-
-class UCTNodePointer {
 private:
-    // the raw storage used here.
-    // if bit 0 is 0, m_data is the actual pointer.
-    // if bit 0 is 1, bit [31:16] is the vertex value, bit [63:32] is the score.
-    // (C-style bit fields and unions are not portable)
-    mutable uint64_t m_data = 1;
+    friend class UCTNode;
+    friend class UCTNodeChildren;
+    friend class UCTNodePointer;
 
-    UCTNode * read_ptr() const {
-        assert(is_inflated());
-        return reinterpret_cast<UCTNode*>(m_data);
-    }
+    UCTNodeStats(const UCTNodeChildren* children, size_t capacity)
+        : m_children(children),
+          m_capacity(static_cast<std::uint32_t>(capacity)) {}
 
-    std::int16_t read_vertex() const {
-        assert(!is_inflated());
-        return static_cast<std::int16_t>(m_data >> 16);
+    // Layout of the arrays following the header, ordered by alignment.
+    char* data() const {
+        return reinterpret_cast<char*>(const_cast<UCTNodeStats*>(this + 1));
     }
+    std::atomic<double>* blackevals() const {
+        return reinterpret_cast<std::atomic<double>*>(data());
+    }
+    UCTNode** nodes() const {
+        return reinterpret_cast<UCTNode**>(data() + 8 * m_capacity);
+    }
+    std::atomic<int>* visits() const {
+        return reinterpret_cast<std::atomic<int>*>(data() + 16 * m_capacity);
+    }
+    std::atomic<std::int16_t>* virtual_losses() const {
+        return reinterpret_cast<std::atomic<std::int16_t>*>(
+            data() + 20 * m_capacity);
+    }
+    // Index of the child in m_children, -1 once it was removed.
+    std::int16_t* entries() const {
+        return reinterpret_cast<std::int16_t*>(data() + 22 * m_capacity);
+    }
+    std::atomic<Status>* statuses() const {
+        return reinterpret_cast<std::atomic<Status>*>(
+            data() + 24 * m_capacity);
+    }
+    static constexpr auto ENTRY_BYTES = size_t{25};
+
+    const UCTNodeChildren* m_children;
+    std::atomic<UCTNodeStats*> m_next{nullptr};
+    std::uint32_t m_capacity;
+    // Entries are filled in before they are published here.
+    std::atomic<std::uint32_t> m_size{0};
+};
 
-    float read_score() const {
-        static_assert(sizeof(float) == 4,
-            "This code assumes floats are 32-bit");
-        assert(!is_inflated());
+// Handle to one child in a UCTNodeChildren table. The prior and move
+// of every child are in the table, and the statistics of the inflated
+// children in its UCTNodeStats, so none of them require following a
+// pointer to the child's UCTNode. The UCTNode itself, which holds the
+// child's own children, is only created when needed, by inflate().
 
-        auto x = static_cast<std::uint32_t>(m_data >> 32);
-        float ret;
-        std::memcpy(&ret, &x, sizeof(ret));
-        return ret;
-    }
+// WARNING : inflate() is not thread-safe and hence has to be protected
+// by an external lock.
 
+class UCTNodePointer {
 public:
-    ~UCTNodePointer();
-    UCTNodePointer(UCTNodePointer&& n);
-    UCTNodePointer(std::int16_t vertex, float score);
-    UCTNodePointer(const UCTNodePointer&) = delete;
+    UCTNodePointer(const UCTNodeChildren* children, size_t index)
+        : m_children(children), m_index(static_cast<std::uint32_t>(index)) {}
 
-    bool is_inflated() const {
-        return (m_data & 1ULL) == 0;
-    }
+    bool is_inflated() const;
 
-    // methods from std::unique_ptr<UCTNode>
-    typename std::add_lvalue_reference<UCTNode>::type operator*() const{
-        return *read_ptr();
+    // methods from std::unique_ptr<UCTNode>, except that the
+    // pointer doesn't own the node
+    UCTNode& operator*() const {
+        return *get();
     }
     UCTNode* operator->() const {
-        return read_ptr();
-    }
-    UCTNode* get() const {
-        return read_ptr();
-    }
-    UCTNodePointer& operator=(UCTNodePointer&& n);
-    UCTNode * release() {
-        auto ret = read_ptr();
-        m_data = 1;
-        return ret;
+        return get();
     }
+    UCTNode* get() const;
 
-    // construct UCTNode instance from the vertex/score pair
+    // construct UCTNode instance for this child
     void inflate() const;
 
     // proxy of UCTNode methods which can be called without
@@ -110,6 +144,101 @@ public:
     int get_move() const;
     // this can only be called if it is an inflated pointer
     float get_eval(int tomove) const;
+
+private:
+    const UCTNodeChildren* m_children;
+    std::uint32_t m_index;
+};
+
+// The children of a UCTNode: parallel arrays of the priors and moves
+// of all children, and the statistics of the inflated ones.
+//
+// The arrays come from the arena the table lives in and are sized once
+// for all legal moves, so children never move while a search runs.
+// Children and their statistics are only added under the owner's lock
+// and published with release stores, so they can be read without it.
+class UCTNodeChildren {
+public:
+    class iterator {
+    public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = UCTNodePointer;
+        using difference_type = std::ptrdiff_t;
+        using pointer = void;
+        using reference = UCTNodePointer;
+
+        iterator(const UCTNodeChildren* children, size_t index)
+            : m_children(children), m_index(index) {}
+        UCTNodePointer operator*() const {
+            return UCTNodePointer(m_children, m_index);
+        }
+        iterator& operator++() {
+            ++m_index;
+            return *this;
+        }
+        bool operator==(const iterator& other) const {
+            return m_index == other.m_index;
+        }
+        bool operator!=(const iterator& other) const {
+            return m_index != other.m_index;
+        }
+    private:
+        const UCTNodeChildren* m_children;
+        size_t m_index;
+    };
+
+    UCTNodeChildren() = default;
+    UCTNodeChildren(const UCTNodeChildren&) = delete;
+    UCTNodeChildren& operator=(const UCTNodeChildren&) = delete;
+
+    iterator begin() const { return iterator(this, 0); }
+    iterator end() const { return iterator(this, size()); }
+    size_t size() const { return m_size.load(std::memory_order_acquire); }
+    bool empty() const { return size() == 0; }
+    UCTNodePointer front() const { return UCTNodePointer(this, 0); }
+    UCTNodePointer operator[](size_t i) const {
+        return UCTNodePointer(this, i);
+    }
+
+    // Allocate room for capacity children. Only the first call
+    // allocates, later calls must not ask for more.
+    void reserve(size_t capacity);
+    void emplace_back(int vertex, float score);
+
+    // Reorder the children so that child i is the old child order[i].
+    // Children not in order are dropped. Not thread-safe.
+    void permute(const std::vector<size_t>& order);
+
+private:
+    friend class UCTNode;
+    friend class UCTNodePointer;
+    friend class UCTNodeStats;
+
+    // Give child i statistics and a UCTNode. Needs the owner's lock.
+    UCTNode* inflate(size_t i) const;
+    // The statistics of child i, which must be inflated.
+    UCTNodeStats* find_stats(size_t i, size_t& index) const;
+
+    // Layout of m_data, ordered by alignment.
+    float* scores() const {
+        return reinterpret_cast<float*>(m_data);
+    }
+    std::int16_t* moves() const {
+        return reinterpret_cast<std::int16_t*>(m_data + 4 * m_capacity);
+    }
+    // 1 + the index of the child in the statistics, 0 if not inflated.
+    std::atomic<std::uint16_t>* stats_indices() const {
+        return reinterpret_cast<std::atomic<std::uint16_t>*>(
+            m_data + 6 * m_capacity);
+    }
+    static constexpr auto ENTRY_BYTES = size_t{8};
+
+    char* m_data{nullptr};
+    mutable std::atomic<UCTNodeStats*> m_stats{nullptr};
+    mutable UCTNodeStats* m_last_stats{nullptr};
+    // Children are filled in before they are published here.
+    std::atomic<std::uint32_t> m_size{0};
+    std::uint32_t m_capacity{0};
 };
 
 #endif
@@ -49,7 +49,7 @@ UCTNode* UCTNode::get_first_child() const {
 }
 
 void UCTNode::kill_superkos(const KoState& state) {
-    for (auto& child : m_children) {
+    for (const auto& child : m_children) {
         auto move = child->get_move();
         if (move != FastBoard::PASS) {
             KoState mystate = state;
@@ -63,11 +63,13 @@ void UCTNode::kill_superkos(const KoState& state) {
     }
 
     // Now do the actual deletion.
-    m_children.erase(
-        std::remove_if(begin(m_children), end(m_children),
-                       [](const auto &child) { return !child->valid(); }),
-        end(m_children)
-    );
+    auto order = std::vector<size_t>{};
+    for (auto i = size_t{0}; i < m_children.size(); i++) {
+        if (m_children[i].valid()) {
+            order.emplace_back(i);
+        }
+    }
+    m_children.permute(order);
 }
 
 void UCTNode::dirichlet_noise(float epsilon, float alpha) {
@@ -93,7 +95,7 @@ void UCTNode::dirichlet_noise(float epsilon, float alpha) {
     }
 
     child_cnt = 0;
-    for (auto& child : m_children) {
+    for (const auto& child : m_children) {
         auto score = child->get_score();
         auto eta_a = dirichlet_vector[child_cnt++];
         score = score * (1 - epsilon) + epsilon * eta_a;
@@ -126,7 +128,10 @@ void UCTNode::randomize_first_proportionally() {
     assert(m_children.size() >= index);
 
     // Now swap the child at index with the first child
-    std::iter_swap(begin(m_children), begin(m_children) + index);
+    auto order = std::vector<size_t>(m_children.size());
+    std::iota(begin(order), end(order), size_t{0});
+    std::swap(order[0], order[index]);
+    m_children.permute(order);
 }
 
 UCTNode* UCTNode::get_nopass_child(FastState& state) const {
@@ -135,8 +140,8 @@ UCTNode* UCTNode::get_nopass_child(FastState& state) const {
            we only have unreasonable moves to pick, like filling eyes.
            Note that this knowledge isn't required by the engine,
            we require it because we're overruling its moves. */
-        if (child->m_move != FastBoard::PASS
-            && !state.board.is_eye(state.get_to_move(), child->m_move)) {
+        if (child.get_move() != FastBoard::PASS
+            && !state.board.is_eye(state.get_to_move(), child.get_move())) {
             return child.get();
         }
     }
@@ -144,12 +149,12 @@ UCTNode* UCTNode::get_nopass_child(FastState& state) const {
 }
 
 // Used to find new root in UCTSearch.
-std::unique_ptr<UCTNode> UCTNode::find_child(const int move) {
-    for (auto& child : m_children) {
+UCTNode* UCTNode::find_child(const int move) {
+    for (const auto& child : m_children) {
         if (child.get_move() == move) {
              // no guarantee that this is a non-inflated node
             child.inflate();
-            return std::unique_ptr<UCTNode>(child.release());
+            return child.get();
         }
     }
 
@@ -169,7 +174,8 @@ void UCTNode::prepare_root_node(int color,
     float root_eval;
     const auto had_children = has_children();
     if (expandable()) {
-        create_children(nodes, root_state, root_eval);
+        auto state = PlayoutState{root_state};
+        create_children(nodes, state, root_eval);
     }
     if (had_children) {
         root_eval = get_eval(color);
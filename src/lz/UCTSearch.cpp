@@ -31,6 +31,7 @@
 #include "FullBoard.h"
 #include "GTP.h"
 #include "GameState.h"
+#include "NNEvaluator.h"
 #include "TimeControl.h"
 #include "Timing.h"
 #include "Training.h"
@@ -44,7 +45,23 @@ UCTSearch::UCTSearch(GameState& g)
     : m_rootstate(g) {
     set_playout_limit(cfg_max_playouts);
     set_visit_limit(cfg_max_visits);
-    m_root = std::make_unique<UCTNode>(FastBoard::PASS, 0.0f);
+    reset_root();
+}
+
+void UCTSearch::reset_root() {
+    m_arena = std::make_unique<UCTNodeArena>();
+    m_root = UCTNode::create_root(*m_arena);
+    reset_graph();
+}
+
+void UCTSearch::reset_graph() {
+    // The graph points into m_arena, so it starts over with it. Reused
+    // nodes join the new graph when they are next visited.
+    if (cfg_search_graph) {
+        m_graph = std::make_unique<UCTNodeGraph>();
+    } else {
+        m_graph.reset();
+    }
 }
 
 bool UCTSearch::advance_to_new_rootstate() {
@@ -75,31 +92,12 @@ bool UCTSearch::advance_to_new_rootstate() {
         return false;
     }
 
-    // Make sure that the nodes we destroyed the previous move are
-    // in fact destroyed.
-    while (!m_delete_futures.empty()) {
-        m_delete_futures.front().wait_all();
-        m_delete_futures.pop_front();
-    }
-
     // Try to replay moves advancing m_root
     for (auto i = 0; i < depth; i++) {
-        ThreadGroup tg(thread_pool);
-
         test->forward_move();
         const auto move = test->get_last_move();
 
-        auto oldroot = std::move(m_root);
-        m_root = oldroot->find_child(move);
-
-        // Lazy tree destruction.  Instead of calling the destructor of the
-        // old root node on the main thread, send the old root to a separate
-        // thread and destroy it from the child thread.  This will save a
-        // bit of time when dealing with large trees.
-        auto p = oldroot.release();
-        tg.add_task([p]() { delete p; });
-        m_delete_futures.push_back(std::move(tg));
-
+        m_root = m_root->find_child(move);
         if (!m_root) {
             // Tree hasn't been expanded this far
             return false;
@@ -114,6 +112,14 @@ bool UCTSearch::advance_to_new_rootstate() {
         return false;
     }
 
+    // Copy the surviving subtree into a fresh arena and free everything
+    // else at once. This touches only the nodes we keep, so it is cheaper
+    // than destroying the discarded ones node by node.
+    auto arena = std::make_unique<UCTNodeArena>();
+    m_root = m_root->clone(*arena);
+    m_arena = std::move(arena);
+    reset_graph();
+
     return true;
 }
 
@@ -127,7 +133,7 @@ void UCTSearch::update_root() {
 #endif
 
     if (!advance_to_new_rootstate() || !m_root) {
-        m_root = std::make_unique<UCTNode>(FastBoard::PASS, 0.0f);
+        reset_root();
     }
     // Clear last_rootstate to prevent accidental use.
     m_last_rootstate.reset(nullptr);
@@ -157,31 +163,52 @@ float UCTSearch::get_min_psa_ratio() const {
     return 0.0f;
 }
 
-SearchResult UCTSearch::play_simulation(GameState & currstate,
+bool UCTSearch::captured_since_root(const PlayoutState& currstate) const {
+    const auto prisoners = [](const FastState& state) {
+        return state.board.get_prisoners(FastBoard::BLACK)
+               + state.board.get_prisoners(FastBoard::WHITE);
+    };
+    return prisoners(currstate) != prisoners(m_rootstate);
+}
+
+SearchResult UCTSearch::play_simulation(PlayoutState & currstate,
                                         UCTNode* const node) {
     const auto color = currstate.get_to_move();
     auto result = SearchResult{};
 
     node->virtual_loss();
 
-    if (node->expandable()) {
+    // In a search graph, transpositions of a position share the children
+    // of the first node that reached it, and with them the evaluation
+    // and the statistics below. The visits and evals of node itself
+    // only count playouts through it, which keeps the backup safe.
+    // A superko repetition needs stones to be captured after the earlier
+    // position, so positions reached through a capture since the root
+    // keep their own children: a move that repeats a position of this
+    // playout is then only invalidated on this path.
+    auto position = node;
+    if (m_graph && !captured_since_root(currstate)) {
+        position = node->join_graph(*m_graph, currstate.board.get_hash());
+    }
+
+    if (position->expandable()) {
         if (currstate.get_passes() >= 2) {
             auto score = currstate.final_score();
             result = SearchResult::from_score(score);
         } else if (m_nodes < MAX_TREE_SIZE) {
             float eval;
-            const auto had_children = node->has_children();
+            const auto had_children = position->has_children();
             const auto success =
-                node->create_children(m_nodes, currstate, eval,
-                                      get_min_psa_ratio());
+                position->create_children(m_nodes, currstate, eval,
+                                          get_min_psa_ratio());
             if (!had_children && success) {
                 result = SearchResult::from_eval(eval);
             }
         }
     }
 
-    if (node->has_children() && !result.valid()) {
-        auto next = node->uct_select_child(color, node == m_root.get());
+    if (position->has_children() && !result.valid()) {
+        auto next = position->uct_select_child(color, node == m_root);
         auto move = next->get_move();
 
         currstate.play_move(move);
@@ -436,11 +463,12 @@ int UCTSearch::get_best_move(passflag_t passflag) {
 }
 
 std::string UCTSearch::get_pv(FastState & state, UCTNode& parent) {
-    if (!parent.has_children()) {
+    auto& position = *parent.get_transposition();
+    if (!position.has_children()) {
         return std::string();
     }
 
-    auto& best_child = parent.get_best_root_child(state.get_to_move());
+    auto& best_child = position.get_best_root_child(state.get_to_move());
     if (best_child.first_visit()) {
         return std::string();
     }
@@ -559,9 +587,10 @@ bool UCTSearch::stop_thinking(int elapsed_centis, int time_for_move) const {
 }
 
 void UCTWorker::operator()() {
+    auto currstate = PlayoutState{};
     do {
-        auto currstate = std::make_unique<GameState>(m_rootstate);
-        auto result = m_search->play_simulation(*currstate, m_root);
+        currstate.reset(m_rootstate);
+        auto result = m_search->play_simulation(currstate, m_root);
         if (result.valid()) {
             m_search->increment_playouts();
         }
@@ -588,6 +617,7 @@ int UCTSearch::think(int color, passflag_t passflag) {
     auto time_for_move = m_rootstate.get_timecontrol().max_time_for_move(color, m_rootstate.get_movenum());
 
     myprintf("Thinking at most %.1f seconds...\n", time_for_move/100.0f);
+    NNEvaluator::get_NNEvaluator().reset_stats();
 
     // create a sorted list of legal moves (make sure we
     // play something legal and decent even in time trouble)
@@ -597,15 +627,16 @@ int UCTSearch::think(int color, passflag_t passflag) {
     int cpus = cfg_num_threads;
     ThreadGroup tg(thread_pool);
     for (int i = 1; i < cpus; i++) {
-        tg.add_task(UCTWorker(m_rootstate, this, m_root.get()));
+        tg.add_task(UCTWorker(m_rootstate, this, m_root));
     }
 
     bool keeprunning = true;
     int last_update = 0;
+    auto currstate = PlayoutState{};
     do {
-        auto currstate = std::make_unique<GameState>(m_rootstate);
+        currstate.reset(m_rootstate);
 
-        auto result = play_simulation(*currstate, m_root.get());
+        auto result = play_simulation(currstate, m_root);
         if (result.valid()) {
             increment_playouts();
         }
@@ -652,6 +683,11 @@ int UCTSearch::think(int color, passflag_t passflag) {
                  static_cast<int>(m_playouts),
                  (m_playouts * 100.0) / (elapsed_centis+1));
     }
+    NNEvaluator::get_NNEvaluator().dump_stats();
+    SMP::dump_lock_stats();
+    if (m_graph) {
+        m_graph->dump_stats();
+    }
     int bestmove = get_best_move(passflag);
 
     // Copy the root state. Use to check for tree re-use in future calls.
@@ -668,12 +704,13 @@ void UCTSearch::ponder() {
     m_run = true;
     ThreadGroup tg(thread_pool);
     for (int i = 1; i < cfg_num_threads; i++) {
-        tg.add_task(UCTWorker(m_rootstate, this, m_root.get()));
+        tg.add_task(UCTWorker(m_rootstate, this, m_root));
     }
     auto keeprunning = true;
+    auto currstate = PlayoutState{};
     do {
-        auto currstate = std::make_unique<GameState>(m_rootstate);
-        auto result = play_simulation(*currstate, m_root.get());
+        currstate.reset(m_rootstate);
+        auto result = play_simulation(currstate, m_root);
         if (result.valid()) {
             increment_playouts();
         }
@@ -19,7 +19,6 @@
 #ifndef UCTSEARCH_H_INCLUDED
 #define UCTSEARCH_H_INCLUDED
 
-#include <list>
 #include <atomic>
 #include <memory>
 #include <string>
@@ -30,7 +29,10 @@
 #include "FastBoard.h"
 #include "FastState.h"
 #include "GameState.h"
+#include "PlayoutState.h"
 #include "UCTNode.h"
+#include "UCTNodeArena.h"
+#include "UCTNodeGraph.h"
 
 
 class SearchResult {
@@ -76,9 +78,10 @@ public:
     static constexpr passflag_t NORESIGN = 1 << 1;
 
     /*
-        Maximum size of the tree in memory. Nodes are about
-        48 bytes, so limit to ~1.2G on 32-bits and about 5.5G
-        on 64-bits.
+        Maximum size of the tree in memory. Children take 8 bytes
+        in their parent's table, and about 80 more once they are
+        searched, which few are. So limit to ~0.3G on 32-bits and
+        about 1G on 64-bits.
     */
     static constexpr auto MAX_TREE_SIZE =
         (sizeof(void*) == 4 ? 25'000'000 : 100'000'000);
@@ -99,10 +102,12 @@ public:
     bool is_running() const;
     void stop_think();
     void increment_playouts();
-    SearchResult play_simulation(GameState& currstate, UCTNode* const node);
+    SearchResult play_simulation(PlayoutState& currstate,
+                                 UCTNode* const node);
 
 private:
     float get_min_psa_ratio() const;
+    bool captured_since_root(const PlayoutState& currstate) const;
     void dump_stats(FastState& state, UCTNode& parent);
     void tree_stats(const UCTNode& node);
     std::string get_pv(FastState& state, UCTNode& parent);
@@ -115,17 +120,21 @@ private:
     int get_best_move(passflag_t passflag);
     void update_root();
     bool advance_to_new_rootstate();
+    void reset_root();
+    void reset_graph();
 
     GameState & m_rootstate;
     std::unique_ptr<GameState> m_last_rootstate;
-    std::unique_ptr<UCTNode> m_root;
+    // All nodes of the tree live in m_arena.
+    std::unique_ptr<UCTNodeArena> m_arena;
+    UCTNode* m_root{nullptr};
+    // Positions of the tree, when searching a graph.
+    std::unique_ptr<UCTNodeGraph> m_graph;
     std::atomic<int> m_nodes{0};
     std::atomic<int> m_playouts{0};
     std::atomic<bool> m_run{false};
     int m_maxplayouts;
     int m_maxvisits;
-
-    std::list<Utils::ThreadGroup> m_delete_futures;
 };
 
 class UCTWorker {
@@ -19,9 +19,13 @@
 #include "config.h"
 #include "Utils.h"
 
+#include <algorithm>
 #include <mutex>
+#include <new>
 #include <cstdarg>
 #include <cstdio>
+#include <cstdlib>
+#include <cstring>
 
 #ifdef _WIN32
 #include <windows.h>
@@ -144,3 +148,112 @@ size_t Utils::ceilMultiple(size_t a, size_t b) {
     auto ret = a + (b - a % b);
     return ret;
 }
+
+// Numbers with at most 15 significant digits and a small exponent are
+// exact in a double, so one multiplication or division rounds them
+// correctly to a double. Rounding that double to a float once more is
+// only wrong when it lands exactly halfway between two floats, so those
+// and everything else go through strtof.
+bool Utils::parse_float(const char*& p, const char* const end, float& out) {
+    static constexpr double powers[] = {
+        1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+        1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+    };
+    const auto start = p;
+    const auto negative = p != end && *p == '-';
+    if (p != end && (*p == '-' || *p == '+')) {
+        p++;
+    }
+
+    auto mantissa = std::uint64_t{0};
+    auto significant = 0;
+    auto exponent = 0;
+    auto has_digits = false;
+    const auto add_digit = [&](const char c) {
+        if (significant < 19) {
+            mantissa = mantissa * 10 + (c - '0');
+            significant += (mantissa != 0);
+            return true;
+        }
+        return false;
+    };
+    for (; p != end && *p >= '0' && *p <= '9'; p++) {
+        has_digits = true;
+        if (!add_digit(*p)) {
+            exponent++;
+        }
+    }
+    if (p != end && *p == '.') {
+        for (p++; p != end && *p >= '0' && *p <= '9'; p++) {
+            has_digits = true;
+            if (add_digit(*p)) {
+                exponent--;
+            }
+        }
+    }
+    if (!has_digits) {
+        return false;
+    }
+    if (p != end && (*p == 'e' || *p == 'E')) {
+        p++;
+        const auto exp_negative = p != end && *p == '-';
+        if (p != end && (*p == '-' || *p == '+')) {
+            p++;
+        }
+        if (p == end || *p < '0' || *p > '9') {
+            return false;
+        }
+        auto exp = 0;
+        for (; p != end && *p >= '0' && *p <= '9'; p++) {
+            exp = std::min(exp * 10 + (*p - '0'), 10000);
+        }
+        exponent += exp_negative ? -exp : exp;
+    }
+    if (p != end && !is_blank(*p)) {
+        return false;
+    }
+
+    if (significant <= 15 && exponent >= -22 && exponent <= 22) {
+        auto value = double(mantissa);
+        value = exponent < 0 ? value / powers[-exponent]
+                             : value * powers[exponent];
+        auto bits = std::uint64_t{};
+        std::memcpy(&bits, &value, sizeof(bits));
+        // The 29 bits a float drops, halfway is a 1 followed by zeros.
+        // Only normal floats keep 24 bits, so tiny values fall back too.
+        constexpr auto DROPPED = (std::uint64_t{1} << 29) - 1;
+        constexpr auto HALFWAY = std::uint64_t{1} << 28;
+        if ((bits & DROPPED) != HALFWAY
+            && (value == 0.0
+                || value >= std::numeric_limits<float>::min())) {
+            out = float(negative ? -value : value);
+            return true;
+        }
+    }
+    out = std::strtof(std::string(start, p).c_str(), nullptr);
+    return true;
+}
+
+static thread_local std::uint64_t thread_allocations = 0;
+
+std::uint64_t Utils::get_thread_allocations() {
+    return thread_allocations;
+}
+
+// Count the allocations of each thread, so the benchmark can check that
+// evaluating a position doesn't touch the heap.
+void* operator new(std::size_t size) {
+    thread_allocations++;
+    if (auto ptr = std::malloc(size == 0 ? 1 : size)) {
+        return ptr;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void* ptr) noexcept {
+    std::free(ptr);
+}
+
+void operator delete(void* ptr, std::size_t) noexcept {
+    std::free(ptr);
+}
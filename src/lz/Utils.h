@@ -22,6 +22,7 @@
 #include "config.h"
 
 #include <atomic>
+#include <cstdint>
 #include <limits>
 #include <string>
 
@@ -52,6 +53,17 @@ namespace Utils {
     }
 
     size_t ceilMultiple(size_t a, size_t b);
+
+    inline bool is_blank(const char c) {
+        return c == ' ' || c == '\t' || c == '\r';
+    }
+
+    // Parses one float that ends at end or a blank and advances p past
+    // it. The result is rounded correctly, like strtof.
+    bool parse_float(const char*& p, const char* const end, float& out);
+
+    // Heap allocations made by the calling thread so far.
+    std::uint64_t get_thread_allocations();
 }
 
 #endif
@@ -0,0 +1,756 @@
+/*
+    This file is part of Leela Zero.
+    Copyright (C) 2017-2018 Gian-Carlo Pascutto and contributors
+
+    Leela Zero is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Leela Zero is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Leela Zero.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "config.h"
+
+#include <array>
+
+#include "Winograd.h"
+#include "Network.h"
+
+constexpr auto W = BOARD_SIZE;
+constexpr auto H = BOARD_SIZE;
+constexpr auto WTILES = (W + 1) / 2;
+constexpr auto P = WTILES * WTILES;
+constexpr auto ALPHA = Network::WINOGRAD_ALPHA;
+
+// F(4x4, 3x3)
+constexpr auto WTILES4 = (W + 3) / 4;
+constexpr auto P4 = WTILES4 * WTILES4;
+constexpr auto ALPHA4 = Winograd::get_alpha(4);
+
+std::vector<Winograd::Kernels> Winograd::get_available_kernels(const int m) {
+    auto kernels = std::vector<Kernels>{};
+    if (m == 4) {
+        kernels.push_back({SIMD::SCALAR,
+                           transform_in_f4_scalar, transform_out_f4_scalar});
+        return kernels;
+    }
+#ifdef SIMD_X86
+    // The vector kernels cover a row of tiles in one masked 16 wide
+    // pass or two overlapping 8 wide passes.
+    const auto level = SIMD::get_level();
+    if (level >= SIMD::AVX512 && WTILES <= 16) {
+        kernels.push_back({SIMD::AVX512,
+                           transform_in_avx512, transform_out_avx512});
+    }
+    if (level >= SIMD::AVX2 && WTILES >= 8 && WTILES <= 16) {
+        kernels.push_back({SIMD::AVX2,
+                           transform_in_avx2, transform_out_avx2});
+    }
+#endif
+    kernels.push_back({SIMD::SCALAR,
+                       transform_in_scalar, transform_out_scalar});
+    return kernels;
+}
+
+// Calculates transpose(B).x.B for every tile of one input plane.
+// V points at the plane's channel and position, rows are CBP apart.
+static void transform_in_plane_scalar(const float* in, float* V,
+                                      const int CBP) {
+    std::array<std::array<float, WTILES * 2 + 2>, WTILES * 2 + 2> in_pad;
+    for (auto xin = size_t{0}; xin < in_pad.size(); xin++) {
+        in_pad[0][xin]     = 0.0f;
+        in_pad[H + 1][xin] = 0.0f;
+        in_pad[H + 2][xin] = 0.0f;
+    }
+    for (auto yin = size_t{1}; yin < in_pad[0].size() - 2; yin++) {
+        in_pad[yin][0]     = 0.0f;
+        in_pad[yin][W + 1] = 0.0f;
+        in_pad[yin][W + 2] = 0.0f;
+    }
+    for (auto yin = 0; yin < H; yin++) {
+        for (auto xin = 0; xin < W; xin++) {
+            in_pad[yin + 1][xin + 1] = in[yin*W + xin];
+        }
+    }
+
+    for (auto block_y = 0; block_y < WTILES; block_y++) {
+        // Tiles overlap by 2
+        const auto yin = 2 * block_y;
+        for (auto block_x = 0; block_x < WTILES; block_x++) {
+            const auto xin = 2 * block_x;
+
+            // Calculates transpose(B).x.B
+            // B = [[ 1.0,  0.0,  0.0,  0.0],
+            //      [ 0.0,  1.0, -1.0,  1.0],
+            //      [-1.0,  1.0,  1.0,  0.0],
+            //      [ 0.0,  0.0,  0.0, -1.0]]
+
+            using WinogradTile =
+                std::array<std::array<float, ALPHA>, ALPHA>;
+            WinogradTile T1, T2;
+
+            T1[0][0] = in_pad[yin + 0][xin + 0] - in_pad[yin + 2][xin + 0];
+            T1[0][1] = in_pad[yin + 0][xin + 1] - in_pad[yin + 2][xin + 1];
+            T1[0][2] = in_pad[yin + 0][xin + 2] - in_pad[yin + 2][xin + 2];
+            T1[0][3] = in_pad[yin + 0][xin + 3] - in_pad[yin + 2][xin + 3];
+            T1[1][0] = in_pad[yin + 1][xin + 0] + in_pad[yin + 2][xin + 0];
+            T1[1][1] = in_pad[yin + 1][xin + 1] + in_pad[yin + 2][xin + 1];
+            T1[1][2] = in_pad[yin + 1][xin + 2] + in_pad[yin + 2][xin + 2];
+            T1[1][3] = in_pad[yin + 1][xin + 3] + in_pad[yin + 2][xin + 3];
+            T1[2][0] = in_pad[yin + 2][xin + 0] - in_pad[yin + 1][xin + 0];
+            T1[2][1] = in_pad[yin + 2][xin + 1] - in_pad[yin + 1][xin + 1];
+            T1[2][2] = in_pad[yin + 2][xin + 2] - in_pad[yin + 1][xin + 2];
+            T1[2][3] = in_pad[yin + 2][xin + 3] - in_pad[yin + 1][xin + 3];
+            T1[3][0] = in_pad[yin + 1][xin + 0] - in_pad[yin + 3][xin + 0];
+            T1[3][1] = in_pad[yin + 1][xin + 1] - in_pad[yin + 3][xin + 1];
+            T1[3][2] = in_pad[yin + 1][xin + 2] - in_pad[yin + 3][xin + 2];
+            T1[3][3] = in_pad[yin + 1][xin + 3] - in_pad[yin + 3][xin + 3];
+
+            T2[0][0] = T1[0][0] - T1[0][2];
+            T2[0][1] = T1[0][1] + T1[0][2];
+            T2[0][2] = T1[0][2] - T1[0][1];
+            T2[0][3] = T1[0][1] - T1[0][3];
+            T2[1][0] = T1[1][0] - T1[1][2];
+            T2[1][1] = T1[1][1] + T1[1][2];
+            T2[1][2] = T1[1][2] - T1[1][1];
+            T2[1][3] = T1[1][1] - T1[1][3];
+            T2[2][0] = T1[2][0] - T1[2][2];
+            T2[2][1] = T1[2][1] + T1[2][2];
+            T2[2][2] = T1[2][2] - T1[2][1];
+            T2[2][3] = T1[2][1] - T1[2][3];
+            T2[3][0] = T1[3][0] - T1[3][2];
+            T2[3][1] = T1[3][1] + T1[3][2];
+            T2[3][2] = T1[3][2] - T1[3][1];
+            T2[3][3] = T1[3][1] - T1[3][3];
+
+            const auto offset = block_y * WTILES + block_x;
+            for (auto i = 0; i < ALPHA; i++) {
+                for (auto j = 0; j < ALPHA; j++) {
+                    V[(i*ALPHA + j)*CBP + offset] = T2[i][j];
+                }
+            }
+        }
+    }
+}
+
+void Winograd::transform_in_scalar(const float* in, float* V,
+                                   const int C, const int batch_size,
+                                   const int c_begin, const int c_end) {
+    // Tiles of all positions in the batch are laid out next to each
+    // other, so a single SGEMM handles the whole batch.
+    const auto BP = batch_size * P;
+
+    for (auto n = 0; n < batch_size; n++) {
+        for (auto ch = c_begin; ch < c_end; ch++) {
+            transform_in_plane_scalar(in + (n * C + ch) * W * H,
+                                      V + ch * BP + n * P, C * BP);
+        }
+    }
+}
+
+// Calculates transpose(A).m.A for every tile of one output plane,
+// followed by batchnorm, the optional residual add and ReLU.
+static void transform_out_plane_scalar(const float* M, const int KBP,
+                                       const float mean, const float scale,
+                                       const float* residual, float* Y) {
+    for (auto block_x = 0; block_x < WTILES; block_x++) {
+        const auto x = 2 * block_x;
+        for (auto block_y = 0; block_y < WTILES; block_y++) {
+            const auto y = 2 * block_y;
+
+            const auto b = block_y * WTILES + block_x;
+            using WinogradTile =
+                std::array<std::array<float, ALPHA>, ALPHA>;
+            WinogradTile temp_m;
+            for (auto xi = 0; xi < ALPHA; xi++) {
+                for (auto nu = 0; nu < ALPHA; nu++) {
+                    temp_m[xi][nu] = M[(xi*ALPHA + nu)*KBP + b];
+                }
+            }
+
+            // Calculates transpose(A).temp_m.A
+            //    A = [1.0,  0.0],
+            //        [1.0,  1.0],
+            //        [1.0, -1.0],
+            //        [0.0, -1.0]]
+
+            const std::array<std::array<float, 2>, 2> o = {
+                temp_m[0][0] + temp_m[0][1] + temp_m[0][2] +
+                temp_m[1][0] + temp_m[1][1] + temp_m[1][2] +
+                temp_m[2][0] + temp_m[2][1] + temp_m[2][2],
+                temp_m[0][1] - temp_m[0][2] - temp_m[0][3] +
+                temp_m[1][1] - temp_m[1][2] - temp_m[1][3] +
+                temp_m[2][1] - temp_m[2][2] - temp_m[2][3],
+                temp_m[1][0] + temp_m[1][1] + temp_m[1][2] -
+                temp_m[2][0] - temp_m[2][1] - temp_m[2][2] -
+                temp_m[3][0] - temp_m[3][1] - temp_m[3][2],
+                temp_m[1][1] - temp_m[1][2] - temp_m[1][3] -
+                temp_m[2][1] + temp_m[2][2] + temp_m[2][3] -
+                temp_m[3][1] + temp_m[3][2] + temp_m[3][3]
+            };
+
+            for (auto i = 0; i < 2 && y + i < H; i++) {
+                for (auto j = 0; j < 2 && x + j < W; j++) {
+                    const auto y_ind = (y + i)*W + (x + j);
+                    auto val = scale * (o[i][j] - mean);
+                    if (residual) {
+                        val += residual[y_ind];
+                    }
+                    Y[y_ind] = (val > 0.0f) ? val : 0.0f;
+                }
+            }
+        }
+    }
+}
+
+void Winograd::transform_out_scalar(const float* M, const int K,
+                                    const int batch_size,
+                                    const float* means, const float* stddivs,
+                                    const float* residual, float* Y, float* V,
+                                    const int k_begin, const int k_end) {
+    const auto BP = batch_size * P;
+
+    std::array<float, W * H> plane;
+    for (auto n = 0; n < batch_size; n++) {
+        for (auto k = k_begin; k < k_end; k++) {
+            const auto kHW = (n * K + k) * W * H;
+            const auto out = Y ? Y + kHW : plane.data();
+            transform_out_plane_scalar(M + k * BP + n * P, K * BP,
+                                       means[k], stddivs[k],
+                                       residual ? residual + kHW : nullptr,
+                                       out);
+            if (V) {
+                transform_in_plane_scalar(out, V + k * BP + n * P, K * BP);
+            }
+        }
+    }
+}
+
+// Calculates transpose(B).x.B with the 6x6 B of F(4x4, 3x3) for every
+// tile of one input plane.
+static void transform_in_f4_plane_scalar(const float* in, float* V,
+                                         const int CBP) {
+    constexpr auto PAD = 4 * WTILES4 + 2;
+    std::array<std::array<float, PAD>, PAD> in_pad{};
+    for (auto yin = 0; yin < H; yin++) {
+        for (auto xin = 0; xin < W; xin++) {
+            in_pad[yin + 1][xin + 1] = in[yin*W + xin];
+        }
+    }
+
+    // transpose(B) = [[4,  0, -5,  0, 1, 0],
+    //                 [0, -4, -4,  1, 1, 0],
+    //                 [0,  4, -4, -1, 1, 0],
+    //                 [0, -2, -1,  2, 1, 0],
+    //                 [0,  2, -1, -2, 1, 0],
+    //                 [0,  4,  0, -5, 0, 1]]
+    const auto transform = [](const std::array<float, ALPHA4>& d,
+                              std::array<float, ALPHA4>& t) {
+        t[0] = 4.0f * d[0] - 5.0f * d[2] + d[4];
+        t[1] = -4.0f * (d[1] + d[2]) + d[3] + d[4];
+        t[2] = 4.0f * (d[1] - d[2]) - d[3] + d[4];
+        t[3] = 2.0f * (d[3] - d[1]) - d[2] + d[4];
+        t[4] = 2.0f * (d[1] - d[3]) - d[2] + d[4];
+        t[5] = 4.0f * d[1] - 5.0f * d[3] + d[5];
+    };
+
+    for (auto block_y = 0; block_y < WTILES4; block_y++) {
+        // Tiles overlap by 2
+        const auto yin = 4 * block_y;
+        for (auto block_x = 0; block_x < WTILES4; block_x++) {
+            const auto xin = 4 * block_x;
+
+            using WinogradTile =
+                std::array<std::array<float, ALPHA4>, ALPHA4>;
+            WinogradTile T1, T2;
+            auto column = std::array<float, ALPHA4>{};
+            auto result = std::array<float, ALPHA4>{};
+            for (auto j = 0; j < ALPHA4; j++) {
+                for (auto i = 0; i < ALPHA4; i++) {
+                    column[i] = in_pad[yin + i][xin + j];
+                }
+                transform(column, result);
+                for (auto i = 0; i < ALPHA4; i++) {
+                    T1[i][j] = result[i];
+                }
+            }
+            for (auto i = 0; i < ALPHA4; i++) {
+                transform(T1[i], T2[i]);
+            }
+
+            const auto offset = block_y * WTILES4 + block_x;
+            for (auto i = 0; i < ALPHA4; i++) {
+                for (auto j = 0; j < ALPHA4; j++) {
+                    V[(i*ALPHA4 + j)*CBP + offset] = T2[i][j];
+                }
+            }
+        }
+    }
+}
+
+void Winograd::transform_in_f4_scalar(const float* in, float* V,
+                                      const int C, const int batch_size,
+                                      const int c_begin, const int c_end) {
+    const auto BP = batch_size * P4;
+
+    for (auto n = 0; n < batch_size; n++) {
+        for (auto ch = c_begin; ch < c_end; ch++) {
+            transform_in_f4_plane_scalar(in + (n * C + ch) * W * H,
+                                         V + ch * BP + n * P4, C * BP);
+        }
+    }
+}
+
+// Calculates transpose(A).m.A with the 6x4 A of F(4x4, 3x3) for every
+// tile of one output plane, followed by batchnorm, the optional
+// residual add and ReLU.
+static void transform_out_f4_plane_scalar(const float* M, const int KBP,
+                                          const float mean, const float scale,
+                                          const float* residual, float* Y) {
+    // transpose(A) = [[1, 1,  1, 1,  1, 0],
+    //                 [0, 1, -1, 2, -2, 0],
+    //                 [0, 1,  1, 4,  4, 0],
+    //                 [0, 1, -1, 8, -8, 1]]
+    const auto transform = [](const std::array<float, ALPHA4>& m,
+                              std::array<float, 4>& o) {
+        const auto sum12 = m[1] + m[2];
+        const auto diff12 = m[1] - m[2];
+        const auto sum34 = m[3] + m[4];
+        const auto diff34 = m[3] - m[4];
+        o[0] = m[0] + sum12 + sum34;
+        o[1] = diff12 + 2.0f * diff34;
+        o[2] = sum12 + 4.0f * sum34;
+        o[3] = diff12 + 8.0f * diff34 + m[5];
+    };
+
+    for (auto block_y = 0; block_y < WTILES4; block_y++) {
+        const auto y = 4 * block_y;
+        for (auto block_x = 0; block_x < WTILES4; block_x++) {
+            const auto x = 4 * block_x;
+
+            const auto b = block_y * WTILES4 + block_x;
+            std::array<std::array<float, 4>, ALPHA4> T1;
+            auto column = std::array<float, ALPHA4>{};
+            for (auto nu = 0; nu < ALPHA4; nu++) {
+                for (auto xi = 0; xi < ALPHA4; xi++) {
+                    column[xi] = M[(xi*ALPHA4 + nu)*KBP + b];
+                }
+                transform(column, T1[nu]);
+            }
+
+            auto o = std::array<float, 4>{};
+            for (auto i = 0; i < 4 && y + i < H; i++) {
+                for (auto nu = 0; nu < ALPHA4; nu++) {
+                    column[nu] = T1[nu][i];
+                }
+                transform(column, o);
+                for (auto j = 0; j < 4 && x + j < W; j++) {
+                    const auto y_ind = (y + i)*W + (x + j);
+                    auto val = scale * (o[j] - mean);
+                    if (residual) {
+                        val += residual[y_ind];
+                    }
+                    Y[y_ind] = (val > 0.0f) ? val : 0.0f;
+                }
+            }
+        }
+    }
+}
+
+void Winograd::transform_out_f4_scalar(const float* M, const int K,
+                                       const int batch_size,
+                                       const float* means,
+                                       const float* stddivs,
+                                       const float* residual,
+                                       float* Y, float* V,
+                                       const int k_begin, const int k_end) {
+    const auto BP = batch_size * P4;
+
+    std::array<float, W * H> plane;
+    for (auto n = 0; n < batch_size; n++) {
+        for (auto k = k_begin; k < k_end; k++) {
+            const auto kHW = (n * K + k) * W * H;
+            const auto out = Y ? Y + kHW : plane.data();
+            transform_out_f4_plane_scalar(M + k * BP + n * P4, K * BP,
+                                          means[k], stddivs[k],
+                                          residual ? residual + kHW : nullptr,
+                                          out);
+            if (V) {
+                transform_in_f4_plane_scalar(out, V + k * BP + n * P4,
+                                             K * BP);
+            }
+        }
+    }
+}
+
+#ifdef SIMD_X86
+// The zero padded input plane split into even and odd columns. Padded
+// column c is stored at [c % 2][c / 2], so for every tile row the four
+// columns of the tiles are unit stride loads starting at tile bx
+// (even, odd) and bx + 1 (even, odd).
+namespace {
+    constexpr auto SPLIT_ROWS = 2 * WTILES + 2;
+    constexpr auto SPLIT_STRIDE = 32;
+
+    struct SplitPlane {
+        alignas(64) float even[SPLIT_ROWS][SPLIT_STRIDE];
+        alignas(64) float odd[SPLIT_ROWS][SPLIT_STRIDE];
+    };
+}
+
+// Padding cells are never written, so split must start out zeroed.
+SIMD_TARGET("avx2,fma")
+static void split_plane_avx2(const float* in, SplitPlane& split) {
+    const auto deinterleave = _mm256_setr_epi32(0, 2, 4, 6, 1, 3, 5, 7);
+    for (auto y = 0; y < H; y++) {
+        const auto row = in + y * W;
+        auto x = 0;
+        for (; x + 8 <= W; x += 8) {
+            const auto v = _mm256_permutevar8x32_ps(_mm256_loadu_ps(row + x),
+                                                    deinterleave);
+            _mm_storeu_ps(&split.odd[y + 1][x / 2], _mm256_castps256_ps128(v));
+            _mm_storeu_ps(&split.even[y + 1][x / 2 + 1],
+                          _mm256_extractf128_ps(v, 1));
+        }
+        for (; x < W; x++) {
+            if (x % 2 == 0) {
+                split.odd[y + 1][x / 2] = row[x];
+            } else {
+                split.even[y + 1][(x + 1) / 2] = row[x];
+            }
+        }
+    }
+}
+
+// As above, but the zero padding is rewritten by the full width stores.
+SIMD_TARGET("avx512f,fma")
+static void split_plane_avx512(const float* in, SplitPlane& split) {
+    const auto row_mask_lo = __mmask16(W >= 16 ? 0xffff : (1u << W) - 1);
+    const auto row_mask_hi = __mmask16(W > 16 ? (1u << (W - 16)) - 1 : 0);
+    const auto odd_columns = _mm512_setr_epi32(0, 1, 3, 5, 7, 9, 11, 13,
+                                               15, 17, 19, 21, 23, 25, 27, 29);
+    const auto even_columns = _mm512_setr_epi32(0, 2, 4, 6, 8, 10, 12, 14,
+                                                16, 18, 20, 22, 24, 26, 28, 30);
+    for (auto y = 0; y < H; y++) {
+        const auto row = in + y * W;
+        const auto lo = _mm512_maskz_loadu_ps(row_mask_lo, row);
+        const auto hi = _mm512_maskz_loadu_ps(row_mask_hi, row + 16);
+        // Padded column 0 is zero, input column x goes to padded x + 1.
+        _mm512_storeu_ps(&split.even[y + 1][0],
+            _mm512_maskz_permutex2var_ps(0xfffe, lo, odd_columns, hi));
+        _mm512_storeu_ps(&split.odd[y + 1][0],
+            _mm512_permutex2var_ps(lo, even_columns, hi));
+    }
+}
+
+// Two passes of 8 tiles cover a tile row. They overlap when there are
+// fewer than 16 tiles, which is harmless for the input transform.
+static const int AVX2_PASSES[2] = {0, WTILES - 8};
+
+SIMD_TARGET("avx2,fma")
+static void transform_in_plane_avx2(const float* in, SplitPlane& split,
+                                    float* V, const int CBP) {
+    split_plane_avx2(in, split);
+    for (auto by = 0; by < WTILES; by++) {
+        const auto y = 2 * by;
+        for (const auto bx : AVX2_PASSES) {
+            __m256 T1[ALPHA][ALPHA];
+            for (auto col = 0; col < ALPHA; col++) {
+                const auto& plane = (col % 2) ? split.odd : split.even;
+                const auto x = bx + col / 2;
+                const auto d0 = _mm256_loadu_ps(&plane[y + 0][x]);
+                const auto d1 = _mm256_loadu_ps(&plane[y + 1][x]);
+                const auto d2 = _mm256_loadu_ps(&plane[y + 2][x]);
+                const auto d3 = _mm256_loadu_ps(&plane[y + 3][x]);
+                T1[0][col] = _mm256_sub_ps(d0, d2);
+                T1[1][col] = _mm256_add_ps(d1, d2);
+                T1[2][col] = _mm256_sub_ps(d2, d1);
+                T1[3][col] = _mm256_sub_ps(d1, d3);
+            }
+            for (auto i = 0; i < ALPHA; i++) {
+                const auto out = V + i * ALPHA * CBP + by * WTILES + bx;
+                _mm256_storeu_ps(out + 0 * CBP,
+                    _mm256_sub_ps(T1[i][0], T1[i][2]));
+                _mm256_storeu_ps(out + 1 * CBP,
+                    _mm256_add_ps(T1[i][1], T1[i][2]));
+                _mm256_storeu_ps(out + 2 * CBP,
+                    _mm256_sub_ps(T1[i][2], T1[i][1]));
+                _mm256_storeu_ps(out + 3 * CBP,
+                    _mm256_sub_ps(T1[i][1], T1[i][3]));
+            }
+        }
+    }
+}
+
+SIMD_TARGET("avx2,fma")
+void Winograd::transform_in_avx2(const float* in, float* V,
+                                 const int C, const int batch_size,
+                                 const int c_begin, const int c_end) {
+    const auto BP = batch_size * P;
+
+    SplitPlane split{};
+    for (auto n = 0; n < batch_size; n++) {
+        for (auto ch = c_begin; ch < c_end; ch++) {
+            transform_in_plane_avx2(in + (n * C + ch) * W * H, split,
+                                    V + ch * BP + n * P, C * BP);
+        }
+    }
+}
+
+// Applies batchnorm, the residual add and ReLU to the 2x2 outputs of
+// 8 tiles and stores them interleaved into one board row.
+SIMD_TARGET("avx2,fma")
+static inline void store_row_avx2(float* dst,
+                                  const __m256 left, const __m256 right,
+                                  const __m256 mean, const __m256 scale,
+                                  const float* residual,
+                                  const __m256i (&mask)[2]) {
+    const auto lo = _mm256_unpacklo_ps(left, right);
+    const auto hi = _mm256_unpackhi_ps(left, right);
+    __m256 row[2] = {
+        _mm256_mul_ps(scale, _mm256_sub_ps(
+            _mm256_permute2f128_ps(lo, hi, 0x20), mean)),
+        _mm256_mul_ps(scale, _mm256_sub_ps(
+            _mm256_permute2f128_ps(lo, hi, 0x31), mean))
+    };
+    for (auto half = 0; half < 2; half++) {
+        if (residual) {
+            row[half] = _mm256_add_ps(row[half],
+                _mm256_maskload_ps(residual + 8 * half, mask[half]));
+        }
+        _mm256_maskstore_ps(dst + 8 * half, mask[half],
+                            _mm256_max_ps(row[half], _mm256_setzero_ps()));
+    }
+}
+
+SIMD_TARGET("avx2,fma")
+static void transform_out_plane_avx2(const float* M, const int KBP,
+                                     const float mean, const float scale,
+                                     const float* residual, float* Y) {
+    // Store only inside the board row, and don't let the second pass
+    // redo columns of the first: the residual may alias Y.
+    __m256i mask[2][2];
+    for (auto p = 0; p < 2; p++) {
+        const auto x_begin = _mm256_set1_epi32(p == 0 ? 0 : 16);
+        const auto x_end = _mm256_set1_epi32(W);
+        for (auto half = 0; half < 2; half++) {
+            const auto x = _mm256_add_epi32(
+                _mm256_set1_epi32(2 * AVX2_PASSES[p] + 8 * half),
+                _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+            mask[p][half] = _mm256_andnot_si256(
+                _mm256_cmpgt_epi32(x_begin, x),
+                _mm256_cmpgt_epi32(x_end, x));
+        }
+    }
+    const auto mean_v = _mm256_set1_ps(mean);
+    const auto scale_v = _mm256_set1_ps(scale);
+
+    for (auto by = 0; by < WTILES; by++) {
+        const auto y = 2 * by;
+        for (auto p = 0; p < 2; p++) {
+            const auto bx = AVX2_PASSES[p];
+            const auto tiles = M + by * WTILES + bx;
+
+            // transpose(A).m.A, rows first
+            __m256 t0[ALPHA], t1[ALPHA];
+            for (auto nu = 0; nu < ALPHA; nu++) {
+                const auto m0 = _mm256_loadu_ps(tiles + (0 * ALPHA + nu) * KBP);
+                const auto m1 = _mm256_loadu_ps(tiles + (1 * ALPHA + nu) * KBP);
+                const auto m2 = _mm256_loadu_ps(tiles + (2 * ALPHA + nu) * KBP);
+                const auto m3 = _mm256_loadu_ps(tiles + (3 * ALPHA + nu) * KBP);
+                t0[nu] = _mm256_add_ps(_mm256_add_ps(m0, m1), m2);
+                t1[nu] = _mm256_sub_ps(_mm256_sub_ps(m1, m2), m3);
+            }
+            const auto o00 = _mm256_add_ps(_mm256_add_ps(t0[0], t0[1]), t0[2]);
+            const auto o01 = _mm256_sub_ps(_mm256_sub_ps(t0[1], t0[2]), t0[3]);
+            const auto o10 = _mm256_add_ps(_mm256_add_ps(t1[0], t1[1]), t1[2]);
+            const auto o11 = _mm256_sub_ps(_mm256_sub_ps(t1[1], t1[2]), t1[3]);
+
+            const auto offset = y * W + 2 * bx;
+            store_row_avx2(Y + offset, o00, o01, mean_v, scale_v,
+                           residual ? residual + offset : nullptr, mask[p]);
+            if (y + 1 < H) {
+                store_row_avx2(Y + offset + W, o10, o11, mean_v, scale_v,
+                               residual ? residual + offset + W : nullptr,
+                               mask[p]);
+            }
+        }
+    }
+}
+
+SIMD_TARGET("avx2,fma")
+void Winograd::transform_out_avx2(const float* M, const int K,
+                                  const int batch_size,
+                                  const float* means, const float* stddivs,
+                                  const float* residual, float* Y, float* V,
+                                  const int k_begin, const int k_end) {
+    const auto BP = batch_size * P;
+
+    alignas(32) std::array<float, W * H> plane;
+    SplitPlane split{};
+    for (auto n = 0; n < batch_size; n++) {
+        for (auto k = k_begin; k < k_end; k++) {
+            const auto kHW = (n * K + k) * W * H;
+            const auto out = Y ? Y + kHW : plane.data();
+            transform_out_plane_avx2(M + k * BP + n * P, K * BP,
+                                     means[k], stddivs[k],
+                                     residual ? residual + kHW : nullptr,
+                                     out);
+            if (V) {
+                transform_in_plane_avx2(out, split,
+                                        V + k * BP + n * P, K * BP);
+            }
+        }
+    }
+}
+
+SIMD_TARGET("avx512f,fma")
+static void transform_in_plane_avx512(const float* in, SplitPlane& split,
+                                      float* V, const int CBP) {
+    const auto tile_mask = __mmask16((1u << WTILES) - 1);
+
+    split_plane_avx512(in, split);
+    for (auto by = 0; by < WTILES; by++) {
+        const auto y = 2 * by;
+        __m512 T1[ALPHA][ALPHA];
+        for (auto col = 0; col < ALPHA; col++) {
+            const auto& plane = (col % 2) ? split.odd : split.even;
+            const auto x = col / 2;
+            const auto d0 = _mm512_loadu_ps(&plane[y + 0][x]);
+            const auto d1 = _mm512_loadu_ps(&plane[y + 1][x]);
+            const auto d2 = _mm512_loadu_ps(&plane[y + 2][x]);
+            const auto d3 = _mm512_loadu_ps(&plane[y + 3][x]);
+            T1[0][col] = _mm512_sub_ps(d0, d2);
+            T1[1][col] = _mm512_add_ps(d1, d2);
+            T1[2][col] = _mm512_sub_ps(d2, d1);
+            T1[3][col] = _mm512_sub_ps(d1, d3);
+        }
+        for (auto i = 0; i < ALPHA; i++) {
+            const auto out = V + i * ALPHA * CBP + by * WTILES;
+            _mm512_mask_storeu_ps(out + 0 * CBP, tile_mask,
+                _mm512_sub_ps(T1[i][0], T1[i][2]));
+            _mm512_mask_storeu_ps(out + 1 * CBP, tile_mask,
+                _mm512_add_ps(T1[i][1], T1[i][2]));
+            _mm512_mask_storeu_ps(out + 2 * CBP, tile_mask,
+                _mm512_sub_ps(T1[i][2], T1[i][1]));
+            _mm512_mask_storeu_ps(out + 3 * CBP, tile_mask,
+                _mm512_sub_ps(T1[i][1], T1[i][3]));
+        }
+    }
+}
+
+SIMD_TARGET("avx512f,fma")
+void Winograd::transform_in_avx512(const float* in, float* V,
+                                   const int C, const int batch_size,
+                                   const int c_begin, const int c_end) {
+    const auto BP = batch_size * P;
+
+    SplitPlane split{};
+    for (auto n = 0; n < batch_size; n++) {
+        for (auto ch = c_begin; ch < c_end; ch++) {
+            transform_in_plane_avx512(in + (n * C + ch) * W * H, split,
+                                      V + ch * BP + n * P, C * BP);
+        }
+    }
+}
+
+// Applies batchnorm, the residual add and ReLU to the 2x2 outputs of a
+// tile row and stores them interleaved into one board row.
+SIMD_TARGET("avx512f,fma")
+static inline void store_row_avx512(float* dst,
+                                    const __m512 left, const __m512 right,
+                                    const __m512 mean, const __m512 scale,
+                                    const float* residual) {
+    const auto row_mask_lo = __mmask16(W >= 16 ? 0xffff : (1u << W) - 1);
+    const auto row_mask_hi = __mmask16(W > 16 ? (1u << (W - 16)) - 1 : 0);
+    const auto interleave_lo = _mm512_setr_epi32(0, 16, 1, 17, 2, 18, 3, 19,
+                                                 4, 20, 5, 21, 6, 22, 7, 23);
+    const auto interleave_hi = _mm512_setr_epi32(8, 24, 9, 25, 10, 26, 11, 27,
+                                                 12, 28, 13, 29, 14, 30, 15, 31);
+    const __mmask16 mask[2] = {row_mask_lo, row_mask_hi};
+    __m512 row[2] = {
+        _mm512_mul_ps(scale, _mm512_sub_ps(
+            _mm512_permutex2var_ps(left, interleave_lo, right), mean)),
+        _mm512_mul_ps(scale, _mm512_sub_ps(
+            _mm512_permutex2var_ps(left, interleave_hi, right), mean))
+    };
+    for (auto half = 0; half < 2; half++) {
+        if (residual) {
+            row[half] = _mm512_add_ps(row[half],
+                _mm512_maskz_loadu_ps(mask[half], residual + 16 * half));
+        }
+        _mm512_mask_storeu_ps(dst + 16 * half, mask[half],
+                              _mm512_max_ps(row[half], _mm512_setzero_ps()));
+    }
+}
+
+SIMD_TARGET("avx512f,fma")
+static void transform_out_plane_avx512(const float* M, const int KBP,
+                                       const float mean, const float scale,
+                                       const float* residual, float* Y) {
+    const auto tile_mask = __mmask16((1u << WTILES) - 1);
+    const auto mean_v = _mm512_set1_ps(mean);
+    const auto scale_v = _mm512_set1_ps(scale);
+
+    for (auto by = 0; by < WTILES; by++) {
+        const auto y = 2 * by;
+        const auto tiles = M + by * WTILES;
+
+        // transpose(A).m.A, rows first
+        __m512 t0[ALPHA], t1[ALPHA];
+        for (auto nu = 0; nu < ALPHA; nu++) {
+            const auto m0 = _mm512_maskz_loadu_ps(tile_mask, tiles + (0 * ALPHA + nu) * KBP);
+            const auto m1 = _mm512_maskz_loadu_ps(tile_mask, tiles + (1 * ALPHA + nu) * KBP);
+            const auto m2 = _mm512_maskz_loadu_ps(tile_mask, tiles + (2 * ALPHA + nu) * KBP);
+            const auto m3 = _mm512_maskz_loadu_ps(tile_mask, tiles + (3 * ALPHA + nu) * KBP);
+            t0[nu] = _mm512_add_ps(_mm512_add_ps(m0, m1), m2);
+            t1[nu] = _mm512_sub_ps(_mm512_sub_ps(m1, m2), m3);
+        }
+        const auto o00 = _mm512_add_ps(_mm512_add_ps(t0[0], t0[1]), t0[2]);
+        const auto o01 = _mm512_sub_ps(_mm512_sub_ps(t0[1], t0[2]), t0[3]);
+        const auto o10 = _mm512_add_ps(_mm512_add_ps(t1[0], t1[1]), t1[2]);
+        const auto o11 = _mm512_sub_ps(_mm512_sub_ps(t1[1], t1[2]), t1[3]);
+
+        const auto offset = y * W;
+        store_row_avx512(Y + offset, o00, o01, mean_v, scale_v,
+                         residual ? residual + offset : nullptr);
+        if (y + 1 < H) {
+            store_row_avx512(Y + offset + W, o10, o11, mean_v, scale_v,
+                             residual ? residual + offset + W : nullptr);
+        }
+    }
+}
+
+SIMD_TARGET("avx512f,fma")
+void Winograd::transform_out_avx512(const float* M, const int K,
+                                    const int batch_size,
+                                    const float* means, const float* stddivs,
+                                    const float* residual, float* Y, float* V,
+                                    const int k_begin, const int k_end) {
+    const auto BP = batch_size * P;
+
+    alignas(64) std::array<float, W * H> plane;
+    SplitPlane split{};
+    for (auto n = 0; n < batch_size; n++) {
+        for (auto k = k_begin; k < k_end; k++) {
+            const auto kHW = (n * K + k) * W * H;
+            const auto out = Y ? Y + kHW : plane.data();
+            transform_out_plane_avx512(M + k * BP + n * P, K * BP,
+                                       means[k], stddivs[k],
+                                       residual ? residual + kHW : nullptr,
+                                       out);
+            if (V) {
+                transform_in_plane_avx512(out, split,
+                                          V + k * BP + n * P, K * BP);
+            }
+        }
+    }
+}
+#endif
@@ -0,0 +1,104 @@
+/*
+    This file is part of Leela Zero.
+    Copyright (C) 2017-2018 Gian-Carlo Pascutto and contributors
+
+    Leela Zero is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Leela Zero is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Leela Zero.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef WINOGRAD_H_INCLUDED
+#define WINOGRAD_H_INCLUDED
+
+#include "config.h"
+
+#include <vector>
+
+#include "SIMD.h"
+
+// F(m x m, 3x3) Winograd input and output transforms used by the CPU
+// forward pass, for m = 2 and m = 4. V is laid out as [tile][C][batch * P]
+// and M as [tile][K][batch * P], with P the number of m x m output tiles
+// per board.
+namespace Winograd {
+    // Edge of the input tiles, the filters are transformed to this size.
+    constexpr int get_alpha(const int m) {
+        return m + 2;
+    }
+    // Number of output tiles per board (P).
+    constexpr int get_tiles(const int m) {
+        return ((BOARD_SIZE + m - 1) / m) * ((BOARD_SIZE + m - 1) / m);
+    }
+
+    // The transforms only process the channels in [c_begin, c_end) or
+    // [k_begin, k_end), so a layer can be split across threads.
+    using TransformIn = void (*)(const float* in, float* V,
+                                 const int C, const int batch_size,
+                                 const int c_begin, const int c_end);
+    // Output transform followed by batchnorm, the optional residual add
+    // and ReLU. Each channel is written to Y if it is not null, and
+    // transformed into the input tiles V of the next convolution if that
+    // is not null, while the channel is still in L1. residual may alias Y.
+    using TransformOut = void (*)(const float* M, const int K,
+                                  const int batch_size,
+                                  const float* means, const float* stddivs,
+                                  const float* residual,
+                                  float* Y, float* V,
+                                  const int k_begin, const int k_end);
+
+    struct Kernels {
+        SIMD::Level level;
+        TransformIn transform_in;
+        TransformOut transform_out;
+    };
+
+    // Kernels for F(m x m, 3x3) that run on this CPU, fastest first.
+    // The scalar kernels are always last.
+    std::vector<Kernels> get_available_kernels(const int m = 2);
+
+    void transform_in_scalar(const float* in, float* V,
+                             const int C, const int batch_size,
+                             const int c_begin, const int c_end);
+    void transform_out_scalar(const float* M, const int K,
+                              const int batch_size,
+                              const float* means, const float* stddivs,
+                              const float* residual, float* Y, float* V,
+                              const int k_begin, const int k_end);
+    void transform_in_f4_scalar(const float* in, float* V,
+                                const int C, const int batch_size,
+                                const int c_begin, const int c_end);
+    void transform_out_f4_scalar(const float* M, const int K,
+                                 const int batch_size,
+                                 const float* means, const float* stddivs,
+                                 const float* residual, float* Y, float* V,
+                                 const int k_begin, const int k_end);
+#ifdef SIMD_X86
+    void transform_in_avx2(const float* in, float* V,
+                           const int C, const int batch_size,
+                           const int c_begin, const int c_end);
+    void transform_out_avx2(const float* M, const int K,
+                            const int batch_size,
+                            const float* means, const float* stddivs,
+                            const float* residual, float* Y, float* V,
+                            const int k_begin, const int k_end);
+    void transform_in_avx512(const float* in, float* V,
+                             const int C, const int batch_size,
+                             const int c_begin, const int c_end);
+    void transform_out_avx512(const float* M, const int K,
+                              const int batch_size,
+                              const float* means, const float* stddivs,
+                              const float* residual, float* Y, float* V,
+                              const int k_begin, const int k_end);
+#endif
+}
+
+#endif
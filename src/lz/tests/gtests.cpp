@@ -21,15 +21,22 @@
 
 #include <cstdint>
 #include <algorithm>
+#include <atomic>
 #include <iostream>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
 #include <memory>
+#include <random>
 #include <regex>
 #include <string>
+#include <thread>
 #include <vector>
 
 #include "GTP.h"
 #include "GameState.h"
 #include "NNCache.h"
+#include "PlayoutState.h"
 #include "Random.h"
 #include "ThreadPool.h"
 #include "Utils.h"
@@ -206,6 +213,252 @@ TEST_F(LeelaTest, MoveOnOccupiedSq) {
     EXPECT_NE(output.find("illegal move"), std::string::npos);
 }
 
+static int random_legal_move(GameState& state) {
+    auto moves = std::vector<int>{FastBoard::PASS};
+    const auto size = state.board.get_boardsize();
+    for (auto i = 0; i < size * size; i++) {
+        const auto vertex = state.board.get_vertex(i % size, i / size);
+        if (state.is_move_legal(state.get_to_move(), vertex)) {
+            moves.emplace_back(vertex);
+        }
+    }
+    return moves[Random::get_Rng().randuint64(moves.size())];
+}
+
+// The 8 mirrored and rotated copies of a random game must share their
+// canonical hash at every move, and each copy's hash must be the
+// symmetry hash of the original.
+TEST_F(LeelaTest, SymmetryHash) {
+    cfg_cache_symmetry = true;
+    for (auto size : {9, 19}) {
+        auto games = std::vector<GameState>(8);
+        for (auto& game : games) {
+            game.init_game(size, 7.5f);
+        }
+        for (auto move = 0; move < 300; move++) {
+            const auto vertex = random_legal_move(games[0]);
+            for (auto s = 0; s < 8; s++) {
+                auto mirrored = vertex;
+                if (vertex != FastBoard::PASS) {
+                    const auto xy = games[0].board.get_xy(vertex);
+                    const auto sym = FastBoard::get_symmetry(xy, s, size);
+                    mirrored = games[s].board.get_vertex(sym.first,
+                                                         sym.second);
+                }
+                games[s].play_move(mirrored);
+            }
+
+            const auto& board = games[0].board;
+            const auto canonical =
+                board.get_symmetry_hash(board.get_canonical_symmetry());
+            for (auto s = 0; s < 8; s++) {
+                EXPECT_EQ(games[s].board.get_hash(),
+                          board.get_symmetry_hash(s));
+                const auto& other = games[s].board;
+                EXPECT_EQ(canonical, other.get_symmetry_hash(
+                                         other.get_canonical_symmetry()));
+            }
+        }
+    }
+}
+
+// Playouts find superko through a set of positions, which should
+// agree with the game history on long random games.
+TEST_F(LeelaTest, PlayoutSuperko) {
+    auto repeats = 0;
+    for (auto size : {5, 7, 19}) {
+        for (auto game = 0; game < 20; game++) {
+            auto root = GameState{};
+            root.init_game(size, 7.5f);
+            const auto opening = Random::get_Rng().randuint64(200);
+            for (auto i = size_t{0}; i < opening; i++) {
+                root.play_move(random_legal_move(root));
+            }
+
+            auto playout = PlayoutState{};
+            for (auto i = 0; i < 5; i++) {
+                playout.reset(root);
+                auto state = root;
+                for (auto move = 0; move < 300; move++) {
+                    const auto vertex = random_legal_move(state);
+                    state.play_move(vertex);
+                    playout.play_move(vertex);
+                    EXPECT_EQ(state.board.get_ko_hash(),
+                              playout.board.get_ko_hash());
+                    if (vertex != FastBoard::PASS) {
+                        EXPECT_EQ(state.superko(), playout.superko());
+                        repeats += state.superko();
+                    }
+                }
+            }
+        }
+    }
+    // Small boards repeat positions often enough to test both answers.
+    EXPECT_GT(repeats, 0);
+}
+
+// Probabilities come back within 1/32 of their value from 2^-15 up,
+// the winrate within half a step of 16 bit fixed point.
+TEST(NNCacheTest, RecordRoundTrip) {
+    NNCache cache(size_t{1} * 1024 * 1024);
+    auto rng = std::mt19937{5489};
+    auto log2p = std::uniform_real_distribution<float>{-20.0f, 0.0f};
+    auto uniform = std::uniform_real_distribution<float>{0.0f, 1.0f};
+    for (auto n = 0; n < 100; n++) {
+        auto expected = Network::Netresult{};
+        for (auto& p : expected.policy) {
+            p = std::exp2(log2p(rng));
+        }
+        expected.policy[n] = 0.0f;
+        expected.policy[n + 1] = 1.0f;
+        expected.policy_pass = std::exp2(log2p(rng));
+        expected.winrate = uniform(rng);
+        cache.insert(n, expected);
+
+        auto result = Network::Netresult{};
+        ASSERT_TRUE(cache.lookup(n, result));
+        const auto check = [](const float p, const float q) {
+            if (p >= std::exp2(-15.0f)) {
+                EXPECT_NEAR(q, p, p / 32);
+            } else {
+                EXPECT_LE(q, std::exp2(-15.0f));
+            }
+        };
+        for (auto i = size_t{0}; i < expected.policy.size(); i++) {
+            check(expected.policy[i], result.policy[i]);
+        }
+        check(expected.policy_pass, result.policy_pass);
+        EXPECT_EQ(result.policy[n], 0.0f);
+        EXPECT_EQ(result.policy[n + 1], 1.0f);
+        EXPECT_NEAR(result.winrate, expected.winrate, 0.5f / 65535 + 1e-7f);
+    }
+}
+
+// Readers racing writers on a few slots must only see whole records.
+// Every record holds one value in all its points, so a torn copy shows
+// up as mixed values.
+TEST(NNCacheTest, ConcurrentReads) {
+    NNCache cache(size_t{64} * 1024);
+    constexpr auto KEYS = 256;
+    const auto make_result = [](const int key) {
+        auto result = Network::Netresult{};
+        std::fill(begin(result.policy), end(result.policy),
+                  (key + 1) / 512.0f);
+        result.policy_pass = (key + 1) / 512.0f;
+        result.winrate = key / float(KEYS);
+        return result;
+    };
+
+    // Seed the cache so the reader hits even if it finishes before the
+    // writers get scheduled.
+    for (auto key = 0; key < KEYS; key++) {
+        cache.insert(std::uint64_t(key) * 0x9E3779B97F4A7C15,
+                     make_result(key));
+    }
+    std::atomic<bool> running{true};
+    auto writers = std::vector<std::thread>{};
+    for (auto t = 0; t < 2; t++) {
+        writers.emplace_back([&, t]() {
+            for (auto i = 0; running; i++) {
+                const auto key = (i * 7 + t) % KEYS;
+                cache.insert(std::uint64_t(key) * 0x9E3779B97F4A7C15,
+                             make_result(key));
+            }
+        });
+    }
+    auto hits = 0;
+    auto result = Network::Netresult{};
+    for (auto i = 0; i < 200000; i++) {
+        const auto key = i % KEYS;
+        if (!cache.lookup(std::uint64_t(key) * 0x9E3779B97F4A7C15, result)) {
+            continue;
+        }
+        hits++;
+        const auto expected = make_result(key);
+        EXPECT_NEAR(result.winrate, expected.winrate, 1e-4f);
+        EXPECT_NEAR(result.policy_pass, expected.policy_pass,
+                    expected.policy_pass / 32);
+        for (const auto p : result.policy) {
+            ASSERT_EQ(p, result.policy_pass);
+        }
+    }
+    running = false;
+    for (auto& writer : writers) {
+        writer.join();
+    }
+    EXPECT_GT(hits, 0);
+}
+
+// A cache file keeps its results for the same network, but they are
+// ignored for another network or precision. A file that doesn't match
+// this build is recreated empty.
+TEST(NNCacheTest, FileReattach) {
+    const auto filename = std::string{"nncache_test.bin"};
+    std::remove(filename.c_str());
+    const auto network_hash = std::uint64_t{0x123456789abcdef};
+    const auto count_hits = [&](const std::uint64_t hash) {
+        NNCache cache(size_t{1} * 1024 * 1024);
+        EXPECT_TRUE(cache.attach_file(filename, hash));
+        auto hits = 0;
+        auto result = Network::Netresult{};
+        for (auto n = 0; n < 100; n++) {
+            if (cache.lookup(n, result)) {
+                EXPECT_NEAR(result.winrate, 0.25f, 1e-4f);
+                hits++;
+            }
+        }
+        return hits;
+    };
+
+    {
+        NNCache cache(size_t{1} * 1024 * 1024);
+        ASSERT_TRUE(cache.attach_file(filename, network_hash));
+        auto result = Network::Netresult{};
+        result.winrate = 0.25f;
+        for (auto n = 0; n < 100; n++) {
+            cache.insert(n, result);
+        }
+    }
+    EXPECT_GT(count_hits(network_hash), 90);
+    // Precisions are added to the network hash.
+    EXPECT_EQ(count_hits(network_hash + 1), 0);
+    EXPECT_EQ(count_hits(~network_hash), 0);
+    EXPECT_GT(count_hits(network_hash), 90);
+
+    std::ofstream{filename, std::ios::trunc} << "not a cache file";
+    EXPECT_EQ(count_hits(network_hash), 0);
+    std::remove(filename.c_str());
+}
+
+// The input written straight from the state must match the planes of
+// gather_features, which the batched evaluations use, under every
+// symmetry.
+TEST_F(LeelaTest, EncodeInput) {
+    constexpr auto input_size = Network::INPUT_CHANNELS * BOARD_SQUARES;
+    auto expected = std::vector<net_t>(input_size);
+    auto input = std::vector<net_t>(input_size);
+    auto state = GameState{};
+    state.init_game(BOARD_SIZE, 7.5f);
+    for (auto move = 0; move < 200; move++) {
+        state.play_move(random_legal_move(state));
+        if (move % 10 != 0 && move > 10) {
+            continue;
+        }
+        const auto playout = PlayoutState{state};
+        auto planes = Network::NNPlanes{};
+        Network::gather_features(&playout, planes);
+        for (auto s = 0; s < 8; s++) {
+            Network::encode_planes(planes, s, expected.data());
+            Network::encode_input(&playout, s, input.data());
+            for (auto i = 0; i < input_size; i++) {
+                ASSERT_EQ(float(expected[i]), float(input[i]))
+                    << "move " << move << ", symmetry " << s
+                    << ", input " << i;
+            }
+        }
+    }
+}
+
 // Basic TimeControl test
 TEST_F(LeelaTest, TimeControl) {
     std::pair<std::string, std::string> result;
@@ -17,9 +17,16 @@
 */
 
 #include <boost/math/distributions/chi_squared.hpp>
+#include <boost/spirit/home/x3.hpp>
 #include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
 #include <gtest/gtest.h>
 #include <limits>
+#include <random>
+#include <string>
 #include <vector>
 
 #include "Random.h"
@@ -128,3 +135,110 @@ TEST(UtilsTest, Randuint64_max) {
     auto p = randomlyDistributedProbability(count, expected);
     EXPECT_PRED2(rngBucketsLookRandom, p, ALPHA);
 }
+
+// strtof rounds correctly, so parse_float must give the same bits.
+static void expect_parse_float(const std::string& text) {
+    auto p = text.data();
+    auto value = 0.0f;
+    ASSERT_TRUE(parse_float(p, text.data() + text.size(), value)) << text;
+    EXPECT_EQ(p, text.data() + text.size()) << text;
+    const auto expected = std::strtof(text.c_str(), nullptr);
+    EXPECT_EQ(0, std::memcmp(&value, &expected, sizeof(value)))
+        << text << ": " << value << " instead of " << expected;
+}
+
+TEST(UtilsTest, ParseFloatEdgeCases) {
+    for (const auto text : {
+        "0", "-0", "1", "-1.5", "+2.25", "0.1", "123456789012345",
+        // More than 15 and 19 significant digits
+        "1234567890123456", "3.14159265358979323846",
+        "1234567890123456789012", "0.0000000000000000000123456789",
+        // Around the exact powers of ten in a double
+        "1e22", "1e23", "1e-22", "1e-23", "4.5e22", "7e-23",
+        "9.99999999999999e22", "1.23456789012345e-22",
+        // Halfway between two floats and just around it
+        "16777217", "16777219", "1.000000059604644775390625",
+        "1.0000000596046447753906251", "1.0000000596046447753906249",
+        // Denormals, the smallest normal and the largest float
+        "1.4e-45", "1e-45", "7e-46", "2.5e-40", "1.17549421e-38",
+        "1.17549435e-38", "3.4028235e38", "3.4028236e38", "1e39"}) {
+        expect_parse_float(text);
+    }
+
+    const auto reject = [](const std::string& text) {
+        auto p = text.data();
+        auto value = 0.0f;
+        return !parse_float(p, text.data() + text.size(), value);
+    };
+    EXPECT_TRUE(reject(""));
+    EXPECT_TRUE(reject("-"));
+    EXPECT_TRUE(reject("."));
+    EXPECT_TRUE(reject("1e"));
+    EXPECT_TRUE(reject("1.5x"));
+}
+
+TEST(UtilsTest, ParseFloatRandom) {
+    auto rng = std::mt19937_64{5489};
+    auto uniform = std::uniform_real_distribution<double>{-1.0, 1.0};
+    char text[64];
+    for (auto i = 0; i < 100000; i++) {
+        switch (i % 4) {
+        case 0:
+            std::snprintf(text, sizeof(text), "%.9g", uniform(rng));
+            break;
+        case 1:
+            std::snprintf(text, sizeof(text), "%.17g", uniform(rng));
+            break;
+        case 2:
+            std::snprintf(text, sizeof(text), "%.14fe%d", uniform(rng),
+                          int(rng() % 61) - 30);
+            break;
+        default:
+            // Up to 19 significant digits
+            std::snprintf(text, sizeof(text), "%llue%d",
+                          static_cast<unsigned long long>(
+                              rng() % 10000000000000000000ull),
+                          int(rng() % 61) - 30);
+        }
+        expect_parse_float(text);
+    }
+}
+
+// Every number of a real weights file. The Spirit parser used before
+// wasn't correctly rounded in the last bits, so it is only expected to
+// be close.
+TEST(UtilsTest, ParseFloatWeightsFile) {
+    std::ifstream file("../src/tests/0k.txt");
+    ASSERT_TRUE(file.is_open());
+    auto previous = std::vector<float>{};
+    auto count = size_t{0};
+    auto line = std::string{};
+    while (std::getline(file, line)) {
+        auto p = line.data();
+        const auto end = line.data() + line.size();
+        auto values = std::vector<float>{};
+        while (p != end) {
+            if (is_blank(*p)) {
+                p++;
+                continue;
+            }
+            const auto start = p;
+            auto value = 0.0f;
+            ASSERT_TRUE(parse_float(p, end, value));
+            values.emplace_back(value);
+            expect_parse_float(std::string(start, p));
+        }
+
+        namespace x3 = boost::spirit::x3;
+        previous.clear();
+        auto it = line.cbegin();
+        x3::phrase_parse(it, line.cend(), *x3::float_, x3::space, previous);
+        ASSERT_EQ(values.size(), previous.size());
+        for (auto i = size_t{0}; i < values.size(); i++) {
+            EXPECT_NEAR(values[i], previous[i],
+                        1e-6f * std::abs(previous[i]));
+        }
+        count += values.size();
+    }
+    EXPECT_GT(count, size_t{100000});
+}
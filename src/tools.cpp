@@ -1,5 +1,6 @@
 #include "tools.h"
 #include "lz/GTP.h"
+#include "lz/Network.h"
 
 #include <iostream>
 #ifdef _WIN32
@@ -20,15 +21,24 @@
 #include <algorithm>
 #include <array>
 #include <cassert>
+#include <map>
 #include <memory>
 
+#include <zlib.h>
+
 using namespace std;
 
 
 
-static vector<string> listFiles(const string &directory)
+struct FileEntry {
+    string name;
+    long long size;
+    long long mtime;
+};
+
+static vector<FileEntry> listFiles(const string &directory)
 {
-    vector<string> out;
+    vector<FileEntry> out;
 #ifdef _WIN32
     HANDLE dir;
     WIN32_FIND_DATA file_data;
@@ -38,11 +48,15 @@ static vector<string> listFiles(const string &directory)
 
     do {
         const string file_name = file_data.cFileName;
-        const string full_file_name = directory + "/" + file_name;
         const bool is_directory = (file_data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) != 0;
 
-        if (!is_directory && file_name[0] != '.')
-            out.push_back(full_file_name);
+        if (!is_directory && file_name[0] != '.') {
+            const auto size = (static_cast<long long>(file_data.nFileSizeHigh) << 32)
+                              | file_data.nFileSizeLow;
+            const auto mtime = (static_cast<long long>(file_data.ftLastWriteTime.dwHighDateTime) << 32)
+                               | file_data.ftLastWriteTime.dwLowDateTime;
+            out.push_back({file_name, size, mtime});
+        }
 
     } while (FindNextFile(dir, &file_data));
 
@@ -66,7 +80,8 @@ static vector<string> listFiles(const string &directory)
         const bool is_directory = (st.st_mode & S_IFDIR) != 0;
 
         if (!is_directory && file_name[0] != '.')
-            out.push_back(full_file_name);
+            out.push_back({file_name, static_cast<long long>(st.st_size),
+                           static_cast<long long>(st.st_mtime)});
     }
     closedir(dir);
 #endif
@@ -74,77 +89,228 @@ static vector<string> listFiles(const string &directory)
 } // GetFilesInDirectory
 
 
-static 
-std::pair<int, int>  parse_v1_network(std::ifstream& wtfile) {
+// What discovery knows about a weights file. residual_blocks is 0 until
+// the file has been counted, channels is 0 for files that are not
+// usable weights.
+struct WeightsInfo {
+    long long size;
+    long long mtime;
+    int format_version;
+    int channels;
+    int residual_blocks;
+};
 
-    // First line was the version number
-    auto linecount = size_t{1};
-    auto channels = 0;
+using WeightsIndex = std::map<string, WeightsInfo>;
+
+// Sidecar cache in the weights directory, one line per file:
+// size mtime format_version channels residual_blocks name
+static const char WEIGHTS_INDEX_NAME[] = ".weights-index";
+static const char WEIGHTS_INDEX_HEADER[] = "weights-index 1";
+
+static WeightsIndex loadWeightsIndex(const string &directory) {
+    WeightsIndex index;
+    auto file = std::ifstream{directory + "/" + WEIGHTS_INDEX_NAME};
     auto line = std::string{};
-    while (std::getline(wtfile, line)) {
-        auto iss = std::stringstream{line};
-        // Third line of parameters are the convolution layer biases,
-        // so this tells us the amount of channels in the residual layers.
-        // We are assuming all layers have the same amount of filters.
-        if (linecount == 2) {
-            auto count = std::distance(std::istream_iterator<std::string>(iss),
-                                       std::istream_iterator<std::string>());
-            channels = count;
+    if (!std::getline(file, line) || line != WEIGHTS_INDEX_HEADER)
+        return index;
+
+    while (std::getline(file, line)) {
+        auto iss = std::istringstream{line};
+        auto info = WeightsInfo{};
+        auto name = std::string{};
+        if (iss >> info.size >> info.mtime >> info.format_version
+                >> info.channels >> info.residual_blocks
+            && std::getline(iss >> std::ws, name) && name.size()) {
+            index[name] = info;
         }
-        linecount++;
     }
+    return index;
+}
+
+static void saveWeightsIndex(const string &directory, const WeightsIndex &index) {
+    // Write a temporary and rename it so concurrent readers never see
+    // a partial index. A read-only directory just means no cache.
+    const auto path = directory + "/" + WEIGHTS_INDEX_NAME;
+    const auto tmp_path = path + ".tmp";
+    {
+        auto file = std::ofstream{tmp_path};
+        if (!file)
+            return;
+        file << WEIGHTS_INDEX_HEADER << "\n";
+        for (const auto &entry : index) {
+            const auto &info = entry.second;
+            file << info.size << " " << info.mtime << " "
+                 << info.format_version << " " << info.channels << " "
+                 << info.residual_blocks << " " << entry.first << "\n";
+        }
+        if (!file) {
+            file.close();
+            std::remove(tmp_path.c_str());
+            return;
+        }
+    }
+#ifdef _WIN32
+    std::remove(path.c_str());
+#endif
+    if (std::rename(tmp_path.c_str(), path.c_str()) != 0)
+        std::remove(tmp_path.c_str());
+}
+
+// Read only the first lines: the format version and, from the third
+// line (the input convolution biases), the number of channels.
+// gzopen reads plain text files transparently.
+static void probeWeightsHeader(const string &path, WeightsInfo &info) {
+    info.format_version = -1;
+    info.channels = 0;
+    info.residual_blocks = 0;
+
+    auto gzhandle = gzopen(path.c_str(), "rb");
+    if (gzhandle == nullptr)
+        return;
+
+    auto buffer = std::vector<char>(64 * 1024);
+    auto version = std::string{};
+    auto channels = 0;
+    auto linecount = 0;
+    auto prev_blank = true;
+    while (linecount < 3) {
+        if (gzgets(gzhandle, buffer.data(), buffer.size()) == nullptr)
+            break;
+        const auto length = strlen(buffer.data());
+        const auto complete = length > 0 && buffer[length - 1] == '\n';
+        if (linecount == 0) {
+            version.append(buffer.data(), length);
+            if (version.size() > 4)
+                break;
+        } else if (linecount == 2) {
+            // Count the starts of whitespace separated tokens.
+            for (auto i = size_t{0}; i < length; i++) {
+                const auto blank = isspace(static_cast<unsigned char>(buffer[i])) != 0;
+                if (!blank && prev_blank)
+                    channels++;
+                prev_blank = blank;
+            }
+        }
+        if (complete)
+            linecount++;
+    }
+    gzclose(gzhandle);
+
+    if (linecount < 3)
+        return;
+    auto iss = std::istringstream{version};
+    if (!(iss >> info.format_version))
+        info.format_version = -1;
+    if (info.format_version == 1)
+        info.channels = channels;
+}
+
+// Only needed to tell apart candidates with the same width: the block
+// count follows from the number of lines, which means reading (and for
+// .gz files inflating) the whole file.
+static void countResidualBlocks(const string &path, WeightsInfo &info) {
+    auto gzhandle = gzopen(path.c_str(), "rb");
+    if (gzhandle == nullptr) {
+        info.channels = 0;
+        return;
+    }
+    gzbuffer(gzhandle, 1024 * 1024);
+
+    auto buffer = std::vector<char>(1024 * 1024);
+    auto linecount = size_t{0};
+    auto last = '\n';
+    int bytes;
+    while ((bytes = gzread(gzhandle, buffer.data(), buffer.size())) > 0) {
+        const auto end = buffer.data() + bytes;
+        for (auto p = buffer.data();
+             (p = static_cast<char*>(memchr(p, '\n', end - p))) != nullptr; p++) {
+            linecount++;
+        }
+        last = buffer[bytes - 1];
+    }
+    gzclose(gzhandle);
+    if (bytes < 0) {
+        info.channels = 0;
+        return;
+    }
+    if (last != '\n')
+        linecount++;
+
     // 1 format id, 1 input layer (4 x weights), 14 ending weights,
     // the rest are residuals, every residual has 8 x weight lines
-    auto residual_blocks = linecount - (1 + 4 + 14);
-    if (residual_blocks % 8 != 0) {
-        return {0, 0};
+    if (linecount < 1 + 4 + 14 || (linecount - (1 + 4 + 14)) % 8 != 0) {
+        info.channels = 0;
+        return;
     }
-    residual_blocks /= 8;
-    wtfile.close();
-
-    return {channels, residual_blocks};
+    info.residual_blocks = static_cast<int>((linecount - (1 + 4 + 14)) / 8);
 }
 
+// Pick the widest network in the directory, the deepest one among
+// equally wide networks. Files are identified from their first lines
+// and the results are cached in a sidecar index keyed by name, size and
+// modification time, so unchanged directories are never rescanned.
 string findPossibleWeightsFile(const string &directory) {
 
     auto flist = listFiles(directory);
+    auto cached = loadWeightsIndex(directory);
+    auto index = WeightsIndex{};
+    auto changed = false;
 
-    size_t max_residual_blocks = 0;
-    string select_file;
+    for (const auto &file : flist) {
+        auto ext = file.name.substr(file.name.rfind(".")+1);
+        if (ext != "txt" && ext != "gz")
+            continue;
 
-    for (auto fullpath : flist) {
-        auto ext = fullpath.substr(fullpath.rfind(".")+1);
-        if (ext == "txt") {
-            auto format_version = -1;
-            size_t channels = 0, residual_blocks;
-
-            auto wtfile = std::ifstream{fullpath};
-            if (wtfile) {
-                auto line = std::string{};
-                if (std::getline(wtfile, line)) {
-                    if (line.size() < 4)
-                        format_version = stoi(line);
-
-                    if (format_version == 1) {
-                
-                        std::tie(channels, residual_blocks) = parse_v1_network(wtfile);
-                        if (channels != 0) {
-                            cerr << "Found weights: " << fullpath << endl;
-                            cerr << "channels: " << channels << endl;
-                            cerr << "residual_blocks: " << residual_blocks << endl;
-
-                            if (channels > max_residual_blocks) {
-                                max_residual_blocks = channels;
-                                select_file = fullpath;
-                            }
-                        }
-                    }
-                }
-                wtfile.close();
-            }
+        auto it = cached.find(file.name);
+        if (it != cached.end()
+            && it->second.size == file.size && it->second.mtime == file.mtime) {
+            index[file.name] = it->second;
+            continue;
+        }
+
+        auto info = WeightsInfo{file.size, file.mtime, -1, 0, 0};
+        probeWeightsHeader(directory + "/" + file.name, info);
+        index[file.name] = info;
+        changed = true;
+    }
+    // Forget files that were removed from the directory.
+    changed |= index.size() != cached.size();
+
+    auto max_channels = 0;
+    for (const auto &entry : index)
+        max_channels = std::max(max_channels, entry.second.channels);
+
+    string select_file;
+    auto select_blocks = -1;
+    for (auto &entry : index) {
+        auto &info = entry.second;
+        if (info.channels == 0 || info.channels != max_channels)
+            continue;
+        if (info.residual_blocks == 0) {
+            countResidualBlocks(directory + "/" + entry.first, info);
+            changed = true;
+            if (info.channels == 0)
+                continue;
         }
+        if (info.residual_blocks > select_blocks) {
+            select_blocks = info.residual_blocks;
+            select_file = directory + "/" + entry.first;
+        }
+    }
+
+    for (const auto &entry : index) {
+        const auto &info = entry.second;
+        if (info.channels == 0)
+            continue;
+        cerr << "Found weights: " << directory << "/" << entry.first << endl;
+        cerr << "channels: " << info.channels << endl;
+        if (info.residual_blocks != 0)
+            cerr << "residual_blocks: " << info.residual_blocks << endl;
     }
 
+    if (changed)
+        saveWeightsIndex(directory, index);
+
     if (select_file.size())
         cerr << "Select weights: " << select_file << endl;
     return select_file;
@@ -154,6 +320,7 @@ string findPossibleWeightsFile(const string &directory) {
 void parseLeelaZeroArgs(int argc, char **argv, vector<string>& players) {
 
     string append_str;
+    string convert_file;
 
     string selfpath = argv[0];
     auto pos  = selfpath.rfind(
@@ -230,6 +397,50 @@ void parseLeelaZeroArgs(int argc, char **argv, vector<string>& players) {
         else if (opt == "--dumbpass" || opt == "-d") {
             cfg_dumbpass = true;
         }
+        else if (opt == "--graph") {
+            cfg_search_graph = true;
+        }
+        else if (opt == "--batchsize") {
+            cfg_batch_size = std::stoi(argv[++i]);
+        }
+        else if (opt == "--batchwait") {
+            cfg_batch_wait_us = std::stoi(argv[++i]);
+        }
+        else if (opt == "--winograd") {
+            cfg_winograd_tile = std::stoi(argv[++i]);
+            if (cfg_winograd_tile != 2 && cfg_winograd_tile != 4) {
+                fprintf(stderr, "Invalid winograd value.\n");
+                throw std::runtime_error("Invalid winograd value.");
+            }
+        }
+        else if (opt == "--int8") {
+            cfg_int8 = true;
+        }
+        else if (opt == "--calibration") {
+            cfg_int8_calibration = argv[++i];
+        }
+        else if (opt == "--weightformat") {
+            const auto format = std::string{argv[++i]};
+            if (format == "fp32") {
+                cfg_weight_storage = Gemm::FP32;
+            } else if (format == "fp16") {
+                cfg_weight_storage = Gemm::FP16;
+            } else if (format == "bf16") {
+                cfg_weight_storage = Gemm::BF16;
+            } else {
+                fprintf(stderr, "Invalid weightformat value.\n");
+                throw std::runtime_error("Invalid weightformat value.");
+            }
+        }
+        else if (opt == "--convert") {
+            convert_file = argv[++i];
+        }
+        else if (opt == "--cachefile") {
+            cfg_cache_file = argv[++i];
+        }
+        else if (opt == "--cachesymmetry") {
+            cfg_cache_symmetry = true;
+        }
         else if (opt == "--weights" || opt == "-w") {
             cfg_weightsfile = argv[++i];
             players.push_back("");
@@ -295,5 +506,10 @@ void parseLeelaZeroArgs(int argc, char **argv, vector<string>& players) {
             players.push_back("");
         }
     }
+
+    if (convert_file.size()) {
+        exit(Network::convert_network(cfg_weightsfile, convert_file)
+             ? EXIT_SUCCESS : EXIT_FAILURE);
+    }
 }
 